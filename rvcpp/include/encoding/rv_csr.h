@@ -54,6 +54,7 @@
 #define MSTATUS_MPIE        0x00000080
 #define MSTATUS_SPP         0x00000100
 #define MSTATUS_HPP         0x00000600
+#define MSTATUS_VS          0x00000600
 #define MSTATUS_MPP         0x00001800
 #define MSTATUS_FS          0x00006000
 #define MSTATUS_XS          0x00018000
@@ -73,6 +74,7 @@
 #define SSTATUS_UPIE        0x00000010
 #define SSTATUS_SPIE        0x00000020
 #define SSTATUS_SPP         0x00000100
+#define SSTATUS_VS          0x00000600
 #define SSTATUS_FS          0x00006000
 #define SSTATUS_XS          0x00018000
 #define SSTATUS_SUM         0x00040000
@@ -81,6 +83,45 @@
 #define SSTATUS_UXL         0x0000000300000000
 #define SSTATUS64_SD        0x8000000000000000
 
+#define MSTATUS_FS_OFF      0x00000000
+#define MSTATUS_FS_INITIAL  0x00002000
+#define MSTATUS_FS_CLEAN    0x00004000
+#define MSTATUS_FS_DIRTY    0x00006000
+
+#define MSTATUS_VS_OFF      0x00000000
+#define MSTATUS_VS_INITIAL  0x00000200
+#define MSTATUS_VS_CLEAN    0x00000400
+#define MSTATUS_VS_DIRTY    0x00000600
+
+#define ENVCFG_FIOM         0x00000001
+#define ENVCFG_CBIE         0x00000030
+#define ENVCFG_CBIE_FLUSH   0x00000010
+#define ENVCFG_CBIE_INVAL   0x00000030
+#define ENVCFG_CBCFE        0x00000040
+#define ENVCFG_CBZE         0x00000080
+#define ENVCFGH_STCE        0x80000000
+#define ENVCFGH_ADUE        0x20000000
+
+#define VTYPE_VILL          0x80000000
+#define VTYPE_VMA           0x00000080
+#define VTYPE_VTA           0x00000040
+#define VTYPE_VSEW          0x00000038
+#define VTYPE_VLMUL         0x00000007
+
+#define VCSR_VXRM_SHIFT     1
+#define VCSR_VXRM           (0x3 << VCSR_VXRM_SHIFT)
+#define VCSR_VXSAT          0x1
+
+#define FSR_RD_SHIFT        5
+#define FSR_RD              (0x7 << FSR_RD_SHIFT)
+#define FSR_AEXC            0x1f
+
+#define FPEXC_NX            0x01
+#define FPEXC_UF            0x02
+#define FPEXC_OF            0x04
+#define FPEXC_DZ            0x08
+#define FPEXC_NV            0x10
+
 #define DCSR_XDEBUGVER      (3U<<30)
 #define DCSR_NDRESET        (1<<29)
 #define DCSR_FULLRESET      (1<<28)
@@ -215,6 +256,10 @@
 #define CSR_FFLAGS 0x1
 #define CSR_FRM 0x2
 #define CSR_FCSR 0x3
+#define CSR_VSTART 0x8
+#define CSR_VXSAT 0x9
+#define CSR_VXRM 0xa
+#define CSR_VCSR 0xf
 #define CSR_CYCLE 0xc00
 #define CSR_TIME 0xc01
 #define CSR_INSTRET 0xc02
@@ -251,6 +296,9 @@
 #define CSR_SIE 0x104
 #define CSR_STVEC 0x105
 #define CSR_SCOUNTEREN 0x106
+#define CSR_SENVCFG 0x10a
+#define CSR_STIMECMP 0x14d
+#define CSR_STIMECMPH 0x15d
 #define CSR_SSCRATCH 0x140
 #define CSR_SEPC 0x141
 #define CSR_SCAUSE 0x142
@@ -264,6 +312,8 @@
 #define CSR_MIE 0x304
 #define CSR_MTVEC 0x305
 #define CSR_MCOUNTEREN 0x306
+#define CSR_MENVCFG 0x30a
+#define CSR_MENVCFGH 0x31a
 #define CSR_MSCRATCH 0x340
 #define CSR_MEPC 0x341
 #define CSR_MCAUSE 0x342
@@ -363,6 +413,9 @@
 #define CSR_CYCLEH 0xc80
 #define CSR_TIMEH 0xc81
 #define CSR_INSTRETH 0xc82
+#define CSR_VL 0xc20
+#define CSR_VTYPE 0xc21
+#define CSR_VLENB 0xc22
 #define CSR_HPMCOUNTER3H 0xc83
 #define CSR_HPMCOUNTER4H 0xc84
 #define CSR_HPMCOUNTER5H 0xc85
@@ -80,6 +80,14 @@
 #define RVOPC_FENCE_MASK       0b00000000000011111111111111111111
 #define RVOPC_FENCE_I_BITS     0b00000000000000000001000000001111
 #define RVOPC_FENCE_I_MASK     0b11111111111111111111111111111111
+#define RVOPC_CBO_INVAL_BITS   0b00000000000000000010000000001111
+#define RVOPC_CBO_INVAL_MASK   0b11111111111100000111111111111111
+#define RVOPC_CBO_CLEAN_BITS   0b00000000000100000010000000001111
+#define RVOPC_CBO_CLEAN_MASK   0b11111111111100000111111111111111
+#define RVOPC_CBO_FLUSH_BITS   0b00000000001000000010000000001111
+#define RVOPC_CBO_FLUSH_MASK   0b11111111111100000111111111111111
+#define RVOPC_CBO_ZERO_BITS    0b00000000010000000010000000001111
+#define RVOPC_CBO_ZERO_MASK    0b11111111111100000111111111111111
 #define RVOPC_ECALL_BITS       0b00000000000000000000000001110011
 #define RVOPC_ECALL_MASK       0b11111111111111111111111111111111
 #define RVOPC_EBREAK_BITS      0b00000000000100000000000001110011
@@ -149,6 +157,499 @@
 #define RVOPC_AMOMAXU_W_BITS   0b11100000000000000010000000101111
 #define RVOPC_AMOMAXU_W_MASK   0b11111000000000000111000001111111
 
+// F extension
+#define RVOPC_FLW_BITS         0b00000000000000000010000000000111
+#define RVOPC_FLW_MASK         0b00000000000000000111000001111111
+#define RVOPC_FSW_BITS         0b00000000000000000010000000100111
+#define RVOPC_FSW_MASK         0b00000000000000000111000001111111
+#define RVOPC_FMADD_S_BITS     0b00000000000000000000000001000011
+#define RVOPC_FMADD_S_MASK     0b00000110000000000000000001111111
+#define RVOPC_FMSUB_S_BITS     0b00000000000000000000000001000111
+#define RVOPC_FMSUB_S_MASK     0b00000110000000000000000001111111
+#define RVOPC_FNMSUB_S_BITS    0b00000000000000000000000001001011
+#define RVOPC_FNMSUB_S_MASK    0b00000110000000000000000001111111
+#define RVOPC_FNMADD_S_BITS    0b00000000000000000000000001001111
+#define RVOPC_FNMADD_S_MASK    0b00000110000000000000000001111111
+#define RVOPC_FADD_S_BITS      0b00000000000000000000000001010011
+#define RVOPC_FADD_S_MASK      0b11111110000000000000000001111111
+#define RVOPC_FSUB_S_BITS      0b00001000000000000000000001010011
+#define RVOPC_FSUB_S_MASK      0b11111110000000000000000001111111
+#define RVOPC_FMUL_S_BITS      0b00010000000000000000000001010011
+#define RVOPC_FMUL_S_MASK      0b11111110000000000000000001111111
+#define RVOPC_FDIV_S_BITS      0b00011000000000000000000001010011
+#define RVOPC_FDIV_S_MASK      0b11111110000000000000000001111111
+#define RVOPC_FSQRT_S_BITS     0b01011000000000000000000001010011
+#define RVOPC_FSQRT_S_MASK     0b11111111111100000000000001111111
+#define RVOPC_FSGNJ_S_BITS     0b00100000000000000000000001010011
+#define RVOPC_FSGNJ_S_MASK     0b11111110000000000111000001111111
+#define RVOPC_FSGNJN_S_BITS    0b00100000000000000001000001010011
+#define RVOPC_FSGNJN_S_MASK    0b11111110000000000111000001111111
+#define RVOPC_FSGNJX_S_BITS    0b00100000000000000010000001010011
+#define RVOPC_FSGNJX_S_MASK    0b11111110000000000111000001111111
+#define RVOPC_FMIN_S_BITS      0b00101000000000000000000001010011
+#define RVOPC_FMIN_S_MASK      0b11111110000000000111000001111111
+#define RVOPC_FMAX_S_BITS      0b00101000000000000001000001010011
+#define RVOPC_FMAX_S_MASK      0b11111110000000000111000001111111
+#define RVOPC_FEQ_S_BITS       0b10100000000000000010000001010011
+#define RVOPC_FEQ_S_MASK       0b11111110000000000111000001111111
+#define RVOPC_FLT_S_BITS       0b10100000000000000001000001010011
+#define RVOPC_FLT_S_MASK       0b11111110000000000111000001111111
+#define RVOPC_FLE_S_BITS       0b10100000000000000000000001010011
+#define RVOPC_FLE_S_MASK       0b11111110000000000111000001111111
+#define RVOPC_FCLASS_S_BITS    0b11100000000000000001000001010011
+#define RVOPC_FCLASS_S_MASK    0b11111111111100000111000001111111
+#define RVOPC_FCVT_W_S_BITS    0b11000000000000000000000001010011
+#define RVOPC_FCVT_W_S_MASK    0b11111111111100000000000001111111
+#define RVOPC_FCVT_WU_S_BITS   0b11000000000100000000000001010011
+#define RVOPC_FCVT_WU_S_MASK   0b11111111111100000000000001111111
+#define RVOPC_FCVT_S_W_BITS    0b11010000000000000000000001010011
+#define RVOPC_FCVT_S_W_MASK    0b11111111111100000000000001111111
+#define RVOPC_FCVT_S_WU_BITS   0b11010000000100000000000001010011
+#define RVOPC_FCVT_S_WU_MASK   0b11111111111100000000000001111111
+#define RVOPC_FMV_X_W_BITS     0b11100000000000000000000001010011
+#define RVOPC_FMV_X_W_MASK     0b11111111111100000111000001111111
+#define RVOPC_FMV_W_X_BITS     0b11110000000000000000000001010011
+#define RVOPC_FMV_W_X_MASK     0b11111111111100000111000001111111
+
+// D extension
+#define RVOPC_FLD_BITS         0b00000000000000000011000000000111
+#define RVOPC_FLD_MASK         0b00000000000000000111000001111111
+#define RVOPC_FSD_BITS         0b00000000000000000011000000100111
+#define RVOPC_FSD_MASK         0b00000000000000000111000001111111
+#define RVOPC_FMADD_D_BITS     0b00000010000000000000000001000011
+#define RVOPC_FMADD_D_MASK     0b00000110000000000000000001111111
+#define RVOPC_FMSUB_D_BITS     0b00000010000000000000000001000111
+#define RVOPC_FMSUB_D_MASK     0b00000110000000000000000001111111
+#define RVOPC_FNMSUB_D_BITS    0b00000010000000000000000001001011
+#define RVOPC_FNMSUB_D_MASK    0b00000110000000000000000001111111
+#define RVOPC_FNMADD_D_BITS    0b00000010000000000000000001001111
+#define RVOPC_FNMADD_D_MASK    0b00000110000000000000000001111111
+#define RVOPC_FADD_D_BITS      0b00000010000000000000000001010011
+#define RVOPC_FADD_D_MASK      0b11111110000000000000000001111111
+#define RVOPC_FSUB_D_BITS      0b00001010000000000000000001010011
+#define RVOPC_FSUB_D_MASK      0b11111110000000000000000001111111
+#define RVOPC_FMUL_D_BITS      0b00010010000000000000000001010011
+#define RVOPC_FMUL_D_MASK      0b11111110000000000000000001111111
+#define RVOPC_FDIV_D_BITS      0b00011010000000000000000001010011
+#define RVOPC_FDIV_D_MASK      0b11111110000000000000000001111111
+#define RVOPC_FSQRT_D_BITS     0b01011010000000000000000001010011
+#define RVOPC_FSQRT_D_MASK     0b11111111111100000000000001111111
+#define RVOPC_FSGNJ_D_BITS     0b00100010000000000000000001010011
+#define RVOPC_FSGNJ_D_MASK     0b11111110000000000111000001111111
+#define RVOPC_FSGNJN_D_BITS    0b00100010000000000001000001010011
+#define RVOPC_FSGNJN_D_MASK    0b11111110000000000111000001111111
+#define RVOPC_FSGNJX_D_BITS    0b00100010000000000010000001010011
+#define RVOPC_FSGNJX_D_MASK    0b11111110000000000111000001111111
+#define RVOPC_FMIN_D_BITS      0b00101010000000000000000001010011
+#define RVOPC_FMIN_D_MASK      0b11111110000000000111000001111111
+#define RVOPC_FMAX_D_BITS      0b00101010000000000001000001010011
+#define RVOPC_FMAX_D_MASK      0b11111110000000000111000001111111
+#define RVOPC_FCVT_S_D_BITS    0b01000000000100000000000001010011
+#define RVOPC_FCVT_S_D_MASK    0b11111111111100000000000001111111
+#define RVOPC_FCVT_D_S_BITS    0b01000010000000000000000001010011
+#define RVOPC_FCVT_D_S_MASK    0b11111111111100000000000001111111
+#define RVOPC_FEQ_D_BITS       0b10100010000000000010000001010011
+#define RVOPC_FEQ_D_MASK       0b11111110000000000111000001111111
+#define RVOPC_FLT_D_BITS       0b10100010000000000001000001010011
+#define RVOPC_FLT_D_MASK       0b11111110000000000111000001111111
+#define RVOPC_FLE_D_BITS       0b10100010000000000000000001010011
+#define RVOPC_FLE_D_MASK       0b11111110000000000111000001111111
+#define RVOPC_FCLASS_D_BITS    0b11100010000000000001000001010011
+#define RVOPC_FCLASS_D_MASK    0b11111111111100000111000001111111
+#define RVOPC_FCVT_W_D_BITS    0b11000010000000000000000001010011
+#define RVOPC_FCVT_W_D_MASK    0b11111111111100000000000001111111
+#define RVOPC_FCVT_WU_D_BITS   0b11000010000100000000000001010011
+#define RVOPC_FCVT_WU_D_MASK   0b11111111111100000000000001111111
+#define RVOPC_FCVT_D_W_BITS    0b11010010000000000000000001010011
+#define RVOPC_FCVT_D_W_MASK    0b11111111111100000000000001111111
+#define RVOPC_FCVT_D_WU_BITS   0b11010010000100000000000001010011
+#define RVOPC_FCVT_D_WU_MASK   0b11111111111100000000000001111111
+// V extension (integer subset, Zve64x)
+#define RVOPC_VSETVLI_BITS     0b00000000000000000111000001010111
+#define RVOPC_VSETVLI_MASK     0b10000000000000000111000001111111
+#define RVOPC_VSETIVLI_BITS    0b11000000000000000111000001010111
+#define RVOPC_VSETIVLI_MASK    0b11000000000000000111000001111111
+#define RVOPC_VSETVL_BITS      0b10000000000000000111000001010111
+#define RVOPC_VSETVL_MASK      0b11111110000000000111000001111111
+#define RVOPC_VLE8_V_BITS      0b00000000000000000000000000000111
+#define RVOPC_VLE8_V_MASK      0b11111101111100000111000001111111
+#define RVOPC_VLE16_V_BITS     0b00000000000000000101000000000111
+#define RVOPC_VLE16_V_MASK     0b11111101111100000111000001111111
+#define RVOPC_VLE32_V_BITS     0b00000000000000000110000000000111
+#define RVOPC_VLE32_V_MASK     0b11111101111100000111000001111111
+#define RVOPC_VLE64_V_BITS     0b00000000000000000111000000000111
+#define RVOPC_VLE64_V_MASK     0b11111101111100000111000001111111
+#define RVOPC_VLSE8_V_BITS     0b00001000000000000000000000000111
+#define RVOPC_VLSE8_V_MASK     0b11111100000000000111000001111111
+#define RVOPC_VLSE16_V_BITS    0b00001000000000000101000000000111
+#define RVOPC_VLSE16_V_MASK    0b11111100000000000111000001111111
+#define RVOPC_VLSE32_V_BITS    0b00001000000000000110000000000111
+#define RVOPC_VLSE32_V_MASK    0b11111100000000000111000001111111
+#define RVOPC_VLSE64_V_BITS    0b00001000000000000111000000000111
+#define RVOPC_VLSE64_V_MASK    0b11111100000000000111000001111111
+#define RVOPC_VLUXEI8_V_BITS   0b00000100000000000000000000000111
+#define RVOPC_VLUXEI8_V_MASK   0b11111100000000000111000001111111
+#define RVOPC_VLOXEI8_V_BITS   0b00001100000000000000000000000111
+#define RVOPC_VLOXEI8_V_MASK   0b11111100000000000111000001111111
+#define RVOPC_VLUXEI16_V_BITS  0b00000100000000000101000000000111
+#define RVOPC_VLUXEI16_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VLOXEI16_V_BITS  0b00001100000000000101000000000111
+#define RVOPC_VLOXEI16_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VLUXEI32_V_BITS  0b00000100000000000110000000000111
+#define RVOPC_VLUXEI32_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VLOXEI32_V_BITS  0b00001100000000000110000000000111
+#define RVOPC_VLOXEI32_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VLUXEI64_V_BITS  0b00000100000000000111000000000111
+#define RVOPC_VLUXEI64_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VLOXEI64_V_BITS  0b00001100000000000111000000000111
+#define RVOPC_VLOXEI64_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VLE8FF_V_BITS    0b00000001000000000000000000000111
+#define RVOPC_VLE8FF_V_MASK    0b11111101111100000111000001111111
+#define RVOPC_VLE16FF_V_BITS   0b00000001000000000101000000000111
+#define RVOPC_VLE16FF_V_MASK   0b11111101111100000111000001111111
+#define RVOPC_VLE32FF_V_BITS   0b00000001000000000110000000000111
+#define RVOPC_VLE32FF_V_MASK   0b11111101111100000111000001111111
+#define RVOPC_VLE64FF_V_BITS   0b00000001000000000111000000000111
+#define RVOPC_VLE64FF_V_MASK   0b11111101111100000111000001111111
+#define RVOPC_VLM_V_BITS       0b00000010101100000000000000000111
+#define RVOPC_VLM_V_MASK       0b11111111111100000111000001111111
+#define RVOPC_VL1RE8_V_BITS    0b00000010100000000000000000000111
+#define RVOPC_VL1RE8_V_MASK    0b11111111111100000111000001111111
+#define RVOPC_VL1RE16_V_BITS   0b00000010100000000101000000000111
+#define RVOPC_VL1RE16_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL1RE32_V_BITS   0b00000010100000000110000000000111
+#define RVOPC_VL1RE32_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL1RE64_V_BITS   0b00000010100000000111000000000111
+#define RVOPC_VL1RE64_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL2RE8_V_BITS    0b00100010100000000000000000000111
+#define RVOPC_VL2RE8_V_MASK    0b11111111111100000111000001111111
+#define RVOPC_VL2RE16_V_BITS   0b00100010100000000101000000000111
+#define RVOPC_VL2RE16_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL2RE32_V_BITS   0b00100010100000000110000000000111
+#define RVOPC_VL2RE32_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL2RE64_V_BITS   0b00100010100000000111000000000111
+#define RVOPC_VL2RE64_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL4RE8_V_BITS    0b01100010100000000000000000000111
+#define RVOPC_VL4RE8_V_MASK    0b11111111111100000111000001111111
+#define RVOPC_VL4RE16_V_BITS   0b01100010100000000101000000000111
+#define RVOPC_VL4RE16_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL4RE32_V_BITS   0b01100010100000000110000000000111
+#define RVOPC_VL4RE32_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL4RE64_V_BITS   0b01100010100000000111000000000111
+#define RVOPC_VL4RE64_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL8RE8_V_BITS    0b11100010100000000000000000000111
+#define RVOPC_VL8RE8_V_MASK    0b11111111111100000111000001111111
+#define RVOPC_VL8RE16_V_BITS   0b11100010100000000101000000000111
+#define RVOPC_VL8RE16_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL8RE32_V_BITS   0b11100010100000000110000000000111
+#define RVOPC_VL8RE32_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VL8RE64_V_BITS   0b11100010100000000111000000000111
+#define RVOPC_VL8RE64_V_MASK   0b11111111111100000111000001111111
+#define RVOPC_VSE8_V_BITS      0b00000000000000000000000000100111
+#define RVOPC_VSE8_V_MASK      0b11111101111100000111000001111111
+#define RVOPC_VSE16_V_BITS     0b00000000000000000101000000100111
+#define RVOPC_VSE16_V_MASK     0b11111101111100000111000001111111
+#define RVOPC_VSE32_V_BITS     0b00000000000000000110000000100111
+#define RVOPC_VSE32_V_MASK     0b11111101111100000111000001111111
+#define RVOPC_VSE64_V_BITS     0b00000000000000000111000000100111
+#define RVOPC_VSE64_V_MASK     0b11111101111100000111000001111111
+#define RVOPC_VSSE8_V_BITS     0b00001000000000000000000000100111
+#define RVOPC_VSSE8_V_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSSE16_V_BITS    0b00001000000000000101000000100111
+#define RVOPC_VSSE16_V_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSSE32_V_BITS    0b00001000000000000110000000100111
+#define RVOPC_VSSE32_V_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSSE64_V_BITS    0b00001000000000000111000000100111
+#define RVOPC_VSSE64_V_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSUXEI8_V_BITS   0b00000100000000000000000000100111
+#define RVOPC_VSUXEI8_V_MASK   0b11111100000000000111000001111111
+#define RVOPC_VSOXEI8_V_BITS   0b00001100000000000000000000100111
+#define RVOPC_VSOXEI8_V_MASK   0b11111100000000000111000001111111
+#define RVOPC_VSUXEI16_V_BITS  0b00000100000000000101000000100111
+#define RVOPC_VSUXEI16_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VSOXEI16_V_BITS  0b00001100000000000101000000100111
+#define RVOPC_VSOXEI16_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VSUXEI32_V_BITS  0b00000100000000000110000000100111
+#define RVOPC_VSUXEI32_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VSOXEI32_V_BITS  0b00001100000000000110000000100111
+#define RVOPC_VSOXEI32_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VSUXEI64_V_BITS  0b00000100000000000111000000100111
+#define RVOPC_VSUXEI64_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VSOXEI64_V_BITS  0b00001100000000000111000000100111
+#define RVOPC_VSOXEI64_V_MASK  0b11111100000000000111000001111111
+#define RVOPC_VSM_V_BITS       0b00000010101100000000000000100111
+#define RVOPC_VSM_V_MASK       0b11111111111100000111000001111111
+#define RVOPC_VS1R_V_BITS      0b00000010100000000000000000100111
+#define RVOPC_VS1R_V_MASK      0b11111111111100000111000001111111
+#define RVOPC_VS2R_V_BITS      0b00100010100000000000000000100111
+#define RVOPC_VS2R_V_MASK      0b11111111111100000111000001111111
+#define RVOPC_VS4R_V_BITS      0b01100010100000000000000000100111
+#define RVOPC_VS4R_V_MASK      0b11111111111100000111000001111111
+#define RVOPC_VS8R_V_BITS      0b11100010100000000000000000100111
+#define RVOPC_VS8R_V_MASK      0b11111111111100000111000001111111
+#define RVOPC_VADD_VV_BITS     0b00000000000000000000000001010111
+#define RVOPC_VADD_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VADD_VX_BITS     0b00000000000000000100000001010111
+#define RVOPC_VADD_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VADD_VI_BITS     0b00000000000000000011000001010111
+#define RVOPC_VADD_VI_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSUB_VV_BITS     0b00001000000000000000000001010111
+#define RVOPC_VSUB_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSUB_VX_BITS     0b00001000000000000100000001010111
+#define RVOPC_VSUB_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VRSUB_VX_BITS    0b00001100000000000100000001010111
+#define RVOPC_VRSUB_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VRSUB_VI_BITS    0b00001100000000000011000001010111
+#define RVOPC_VRSUB_VI_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMINU_VV_BITS    0b00010000000000000000000001010111
+#define RVOPC_VMINU_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMINU_VX_BITS    0b00010000000000000100000001010111
+#define RVOPC_VMINU_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMIN_VV_BITS     0b00010100000000000000000001010111
+#define RVOPC_VMIN_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VMIN_VX_BITS     0b00010100000000000100000001010111
+#define RVOPC_VMIN_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VMAXU_VV_BITS    0b00011000000000000000000001010111
+#define RVOPC_VMAXU_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMAXU_VX_BITS    0b00011000000000000100000001010111
+#define RVOPC_VMAXU_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMAX_VV_BITS     0b00011100000000000000000001010111
+#define RVOPC_VMAX_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VMAX_VX_BITS     0b00011100000000000100000001010111
+#define RVOPC_VMAX_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VAND_VV_BITS     0b00100100000000000000000001010111
+#define RVOPC_VAND_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VAND_VX_BITS     0b00100100000000000100000001010111
+#define RVOPC_VAND_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VAND_VI_BITS     0b00100100000000000011000001010111
+#define RVOPC_VAND_VI_MASK     0b11111100000000000111000001111111
+#define RVOPC_VOR_VV_BITS      0b00101000000000000000000001010111
+#define RVOPC_VOR_VV_MASK      0b11111100000000000111000001111111
+#define RVOPC_VOR_VX_BITS      0b00101000000000000100000001010111
+#define RVOPC_VOR_VX_MASK      0b11111100000000000111000001111111
+#define RVOPC_VOR_VI_BITS      0b00101000000000000011000001010111
+#define RVOPC_VOR_VI_MASK      0b11111100000000000111000001111111
+#define RVOPC_VXOR_VV_BITS     0b00101100000000000000000001010111
+#define RVOPC_VXOR_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VXOR_VX_BITS     0b00101100000000000100000001010111
+#define RVOPC_VXOR_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VXOR_VI_BITS     0b00101100000000000011000001010111
+#define RVOPC_VXOR_VI_MASK     0b11111100000000000111000001111111
+#define RVOPC_VRGATHER_VV_BITS 0b00110000000000000000000001010111
+#define RVOPC_VRGATHER_VV_MASK 0b11111100000000000111000001111111
+#define RVOPC_VRGATHER_VX_BITS 0b00110000000000000100000001010111
+#define RVOPC_VRGATHER_VX_MASK 0b11111100000000000111000001111111
+#define RVOPC_VRGATHER_VI_BITS 0b00110000000000000011000001010111
+#define RVOPC_VRGATHER_VI_MASK 0b11111100000000000111000001111111
+#define RVOPC_VSLIDEUP_VX_BITS 0b00111000000000000100000001010111
+#define RVOPC_VSLIDEUP_VX_MASK 0b11111100000000000111000001111111
+#define RVOPC_VSLIDEUP_VI_BITS 0b00111000000000000011000001010111
+#define RVOPC_VSLIDEUP_VI_MASK 0b11111100000000000111000001111111
+#define RVOPC_VSLIDEDOWN_VX_BITS 0b00111100000000000100000001010111
+#define RVOPC_VSLIDEDOWN_VX_MASK 0b11111100000000000111000001111111
+#define RVOPC_VSLIDEDOWN_VI_BITS 0b00111100000000000011000001010111
+#define RVOPC_VSLIDEDOWN_VI_MASK 0b11111100000000000111000001111111
+#define RVOPC_VMSEQ_VV_BITS    0b01100000000000000000000001010111
+#define RVOPC_VMSEQ_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSEQ_VX_BITS    0b01100000000000000100000001010111
+#define RVOPC_VMSEQ_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSEQ_VI_BITS    0b01100000000000000011000001010111
+#define RVOPC_VMSEQ_VI_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSNE_VV_BITS    0b01100100000000000000000001010111
+#define RVOPC_VMSNE_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSNE_VX_BITS    0b01100100000000000100000001010111
+#define RVOPC_VMSNE_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSNE_VI_BITS    0b01100100000000000011000001010111
+#define RVOPC_VMSNE_VI_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSLTU_VV_BITS   0b01101000000000000000000001010111
+#define RVOPC_VMSLTU_VV_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMSLTU_VX_BITS   0b01101000000000000100000001010111
+#define RVOPC_VMSLTU_VX_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMSLT_VV_BITS    0b01101100000000000000000001010111
+#define RVOPC_VMSLT_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSLT_VX_BITS    0b01101100000000000100000001010111
+#define RVOPC_VMSLT_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSLEU_VV_BITS   0b01110000000000000000000001010111
+#define RVOPC_VMSLEU_VV_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMSLEU_VX_BITS   0b01110000000000000100000001010111
+#define RVOPC_VMSLEU_VX_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMSLEU_VI_BITS   0b01110000000000000011000001010111
+#define RVOPC_VMSLEU_VI_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMSLE_VV_BITS    0b01110100000000000000000001010111
+#define RVOPC_VMSLE_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSLE_VX_BITS    0b01110100000000000100000001010111
+#define RVOPC_VMSLE_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSLE_VI_BITS    0b01110100000000000011000001010111
+#define RVOPC_VMSLE_VI_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSGTU_VX_BITS   0b01111000000000000100000001010111
+#define RVOPC_VMSGTU_VX_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMSGTU_VI_BITS   0b01111000000000000011000001010111
+#define RVOPC_VMSGTU_VI_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMSGT_VX_BITS    0b01111100000000000100000001010111
+#define RVOPC_VMSGT_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMSGT_VI_BITS    0b01111100000000000011000001010111
+#define RVOPC_VMSGT_VI_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSADDU_VV_BITS   0b10000000000000000000000001010111
+#define RVOPC_VSADDU_VV_MASK   0b11111100000000000111000001111111
+#define RVOPC_VSADDU_VX_BITS   0b10000000000000000100000001010111
+#define RVOPC_VSADDU_VX_MASK   0b11111100000000000111000001111111
+#define RVOPC_VSADDU_VI_BITS   0b10000000000000000011000001010111
+#define RVOPC_VSADDU_VI_MASK   0b11111100000000000111000001111111
+#define RVOPC_VSADD_VV_BITS    0b10000100000000000000000001010111
+#define RVOPC_VSADD_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSADD_VX_BITS    0b10000100000000000100000001010111
+#define RVOPC_VSADD_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSADD_VI_BITS    0b10000100000000000011000001010111
+#define RVOPC_VSADD_VI_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSSUBU_VV_BITS   0b10001000000000000000000001010111
+#define RVOPC_VSSUBU_VV_MASK   0b11111100000000000111000001111111
+#define RVOPC_VSSUBU_VX_BITS   0b10001000000000000100000001010111
+#define RVOPC_VSSUBU_VX_MASK   0b11111100000000000111000001111111
+#define RVOPC_VSSUB_VV_BITS    0b10001100000000000000000001010111
+#define RVOPC_VSSUB_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSSUB_VX_BITS    0b10001100000000000100000001010111
+#define RVOPC_VSSUB_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VSLL_VV_BITS     0b10010100000000000000000001010111
+#define RVOPC_VSLL_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSLL_VX_BITS     0b10010100000000000100000001010111
+#define RVOPC_VSLL_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSLL_VI_BITS     0b10010100000000000011000001010111
+#define RVOPC_VSLL_VI_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSRL_VV_BITS     0b10100000000000000000000001010111
+#define RVOPC_VSRL_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSRL_VX_BITS     0b10100000000000000100000001010111
+#define RVOPC_VSRL_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSRL_VI_BITS     0b10100000000000000011000001010111
+#define RVOPC_VSRL_VI_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSRA_VV_BITS     0b10100100000000000000000001010111
+#define RVOPC_VSRA_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSRA_VX_BITS     0b10100100000000000100000001010111
+#define RVOPC_VSRA_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VSRA_VI_BITS     0b10100100000000000011000001010111
+#define RVOPC_VSRA_VI_MASK     0b11111100000000000111000001111111
+#define RVOPC_VMERGE_VVM_BITS  0b01011100000000000000000001010111
+#define RVOPC_VMERGE_VVM_MASK  0b11111110000000000111000001111111
+#define RVOPC_VMERGE_VXM_BITS  0b01011100000000000100000001010111
+#define RVOPC_VMERGE_VXM_MASK  0b11111110000000000111000001111111
+#define RVOPC_VMERGE_VIM_BITS  0b01011100000000000011000001010111
+#define RVOPC_VMERGE_VIM_MASK  0b11111110000000000111000001111111
+#define RVOPC_VMV_V_V_BITS     0b01011110000000000000000001010111
+#define RVOPC_VMV_V_V_MASK     0b11111111111100000111000001111111
+#define RVOPC_VMV_V_X_BITS     0b01011110000000000100000001010111
+#define RVOPC_VMV_V_X_MASK     0b11111111111100000111000001111111
+#define RVOPC_VMV_V_I_BITS     0b01011110000000000011000001010111
+#define RVOPC_VMV_V_I_MASK     0b11111111111100000111000001111111
+#define RVOPC_VMV1R_V_BITS     0b10011110000000000011000001010111
+#define RVOPC_VMV1R_V_MASK     0b11111110000011111111000001111111
+#define RVOPC_VMV2R_V_BITS     0b10011110000000001011000001010111
+#define RVOPC_VMV2R_V_MASK     0b11111110000011111111000001111111
+#define RVOPC_VMV4R_V_BITS     0b10011110000000011011000001010111
+#define RVOPC_VMV4R_V_MASK     0b11111110000011111111000001111111
+#define RVOPC_VMV8R_V_BITS     0b10011110000000111011000001010111
+#define RVOPC_VMV8R_V_MASK     0b11111110000011111111000001111111
+#define RVOPC_VREDSUM_VS_BITS  0b00000000000000000010000001010111
+#define RVOPC_VREDSUM_VS_MASK  0b11111100000000000111000001111111
+#define RVOPC_VREDAND_VS_BITS  0b00000100000000000010000001010111
+#define RVOPC_VREDAND_VS_MASK  0b11111100000000000111000001111111
+#define RVOPC_VREDOR_VS_BITS   0b00001000000000000010000001010111
+#define RVOPC_VREDOR_VS_MASK   0b11111100000000000111000001111111
+#define RVOPC_VREDXOR_VS_BITS  0b00001100000000000010000001010111
+#define RVOPC_VREDXOR_VS_MASK  0b11111100000000000111000001111111
+#define RVOPC_VREDMINU_VS_BITS 0b00010000000000000010000001010111
+#define RVOPC_VREDMINU_VS_MASK 0b11111100000000000111000001111111
+#define RVOPC_VREDMIN_VS_BITS  0b00010100000000000010000001010111
+#define RVOPC_VREDMIN_VS_MASK  0b11111100000000000111000001111111
+#define RVOPC_VREDMAXU_VS_BITS 0b00011000000000000010000001010111
+#define RVOPC_VREDMAXU_VS_MASK 0b11111100000000000111000001111111
+#define RVOPC_VREDMAX_VS_BITS  0b00011100000000000010000001010111
+#define RVOPC_VREDMAX_VS_MASK  0b11111100000000000111000001111111
+#define RVOPC_VSLIDE1UP_VX_BITS 0b00111000000000000110000001010111
+#define RVOPC_VSLIDE1UP_VX_MASK 0b11111100000000000111000001111111
+#define RVOPC_VSLIDE1DOWN_VX_BITS 0b00111100000000000110000001010111
+#define RVOPC_VSLIDE1DOWN_VX_MASK 0b11111100000000000111000001111111
+#define RVOPC_VMV_X_S_BITS     0b01000010000000000010000001010111
+#define RVOPC_VMV_X_S_MASK     0b11111110000011111111000001111111
+#define RVOPC_VCPOP_M_BITS     0b01000000000010000010000001010111
+#define RVOPC_VCPOP_M_MASK     0b11111100000011111111000001111111
+#define RVOPC_VFIRST_M_BITS    0b01000000000010001010000001010111
+#define RVOPC_VFIRST_M_MASK    0b11111100000011111111000001111111
+#define RVOPC_VMV_S_X_BITS     0b01000010000000000110000001010111
+#define RVOPC_VMV_S_X_MASK     0b11111111111100000111000001111111
+#define RVOPC_VMSBF_M_BITS     0b01010000000000001010000001010111
+#define RVOPC_VMSBF_M_MASK     0b11111100000011111111000001111111
+#define RVOPC_VMSOF_M_BITS     0b01010000000000010010000001010111
+#define RVOPC_VMSOF_M_MASK     0b11111100000011111111000001111111
+#define RVOPC_VMSIF_M_BITS     0b01010000000000011010000001010111
+#define RVOPC_VMSIF_M_MASK     0b11111100000011111111000001111111
+#define RVOPC_VIOTA_M_BITS     0b01010000000010000010000001010111
+#define RVOPC_VIOTA_M_MASK     0b11111100000011111111000001111111
+#define RVOPC_VID_V_BITS       0b01010000000010001010000001010111
+#define RVOPC_VID_V_MASK       0b11111101111111111111000001111111
+#define RVOPC_VMANDN_MM_BITS   0b01100010000000000010000001010111
+#define RVOPC_VMANDN_MM_MASK   0b11111110000000000111000001111111
+#define RVOPC_VMAND_MM_BITS    0b01100110000000000010000001010111
+#define RVOPC_VMAND_MM_MASK    0b11111110000000000111000001111111
+#define RVOPC_VMOR_MM_BITS     0b01101010000000000010000001010111
+#define RVOPC_VMOR_MM_MASK     0b11111110000000000111000001111111
+#define RVOPC_VMXOR_MM_BITS    0b01101110000000000010000001010111
+#define RVOPC_VMXOR_MM_MASK    0b11111110000000000111000001111111
+#define RVOPC_VMORN_MM_BITS    0b01110010000000000010000001010111
+#define RVOPC_VMORN_MM_MASK    0b11111110000000000111000001111111
+#define RVOPC_VMNAND_MM_BITS   0b01110110000000000010000001010111
+#define RVOPC_VMNAND_MM_MASK   0b11111110000000000111000001111111
+#define RVOPC_VMNOR_MM_BITS    0b01111010000000000010000001010111
+#define RVOPC_VMNOR_MM_MASK    0b11111110000000000111000001111111
+#define RVOPC_VMXNOR_MM_BITS   0b01111110000000000010000001010111
+#define RVOPC_VMXNOR_MM_MASK   0b11111110000000000111000001111111
+#define RVOPC_VDIVU_VV_BITS    0b10000000000000000010000001010111
+#define RVOPC_VDIVU_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VDIVU_VX_BITS    0b10000000000000000110000001010111
+#define RVOPC_VDIVU_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VDIV_VV_BITS     0b10000100000000000010000001010111
+#define RVOPC_VDIV_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VDIV_VX_BITS     0b10000100000000000110000001010111
+#define RVOPC_VDIV_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VREMU_VV_BITS    0b10001000000000000010000001010111
+#define RVOPC_VREMU_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VREMU_VX_BITS    0b10001000000000000110000001010111
+#define RVOPC_VREMU_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VREM_VV_BITS     0b10001100000000000010000001010111
+#define RVOPC_VREM_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VREM_VX_BITS     0b10001100000000000110000001010111
+#define RVOPC_VREM_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VMULHU_VV_BITS   0b10010000000000000010000001010111
+#define RVOPC_VMULHU_VV_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMULHU_VX_BITS   0b10010000000000000110000001010111
+#define RVOPC_VMULHU_VX_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMUL_VV_BITS     0b10010100000000000010000001010111
+#define RVOPC_VMUL_VV_MASK     0b11111100000000000111000001111111
+#define RVOPC_VMUL_VX_BITS     0b10010100000000000110000001010111
+#define RVOPC_VMUL_VX_MASK     0b11111100000000000111000001111111
+#define RVOPC_VMULHSU_VV_BITS  0b10011000000000000010000001010111
+#define RVOPC_VMULHSU_VV_MASK  0b11111100000000000111000001111111
+#define RVOPC_VMULHSU_VX_BITS  0b10011000000000000110000001010111
+#define RVOPC_VMULHSU_VX_MASK  0b11111100000000000111000001111111
+#define RVOPC_VMULH_VV_BITS    0b10011100000000000010000001010111
+#define RVOPC_VMULH_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMULH_VX_BITS    0b10011100000000000110000001010111
+#define RVOPC_VMULH_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMADD_VV_BITS    0b10100100000000000010000001010111
+#define RVOPC_VMADD_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMADD_VX_BITS    0b10100100000000000110000001010111
+#define RVOPC_VMADD_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VNMSUB_VV_BITS   0b10101100000000000010000001010111
+#define RVOPC_VNMSUB_VV_MASK   0b11111100000000000111000001111111
+#define RVOPC_VNMSUB_VX_BITS   0b10101100000000000110000001010111
+#define RVOPC_VNMSUB_VX_MASK   0b11111100000000000111000001111111
+#define RVOPC_VMACC_VV_BITS    0b10110100000000000010000001010111
+#define RVOPC_VMACC_VV_MASK    0b11111100000000000111000001111111
+#define RVOPC_VMACC_VX_BITS    0b10110100000000000110000001010111
+#define RVOPC_VMACC_VX_MASK    0b11111100000000000111000001111111
+#define RVOPC_VNMSAC_VV_BITS   0b10111100000000000010000001010111
+#define RVOPC_VNMSAC_VV_MASK   0b11111100000000000111000001111111
+#define RVOPC_VNMSAC_VX_BITS   0b10111100000000000110000001010111
+#define RVOPC_VNMSAC_VX_MASK   0b11111100000000000111000001111111
+
 // Zba (address generation)
 #define RVOPC_SH1ADD_BITS      0b00100000000000000010000000110011
 #define RVOPC_SH1ADD_MASK      0b11111110000000000111000001111111
@@ -302,6 +803,24 @@
 #define RVOPC_C_SWSP_BITS      0b1100000000000010
 #define RVOPC_C_SWSP_MASK      0b1110000000000011
 
+// C extension: floating point loads/stores (RV32 only for C.FLW/C.FSW)
+#define RVOPC_C_FLD_BITS       0b0010000000000000
+#define RVOPC_C_FLD_MASK       0b1110000000000011
+#define RVOPC_C_FLW_BITS       0b0110000000000000
+#define RVOPC_C_FLW_MASK       0b1110000000000011
+#define RVOPC_C_FSD_BITS       0b1010000000000000
+#define RVOPC_C_FSD_MASK       0b1110000000000011
+#define RVOPC_C_FSW_BITS       0b1110000000000000
+#define RVOPC_C_FSW_MASK       0b1110000000000011
+#define RVOPC_C_FLDSP_BITS     0b0010000000000010
+#define RVOPC_C_FLDSP_MASK     0b1110000000000011
+#define RVOPC_C_FLWSP_BITS     0b0110000000000010
+#define RVOPC_C_FLWSP_MASK     0b1110000000000011
+#define RVOPC_C_FSDSP_BITS     0b1010000000000010
+#define RVOPC_C_FSDSP_MASK     0b1110000000000011
+#define RVOPC_C_FSWSP_BITS     0b1110000000000010
+#define RVOPC_C_FSWSP_MASK     0b1110000000000011
+
 // Zcb simple additional compressed instructions
 #define RVOPC_C_LBU_BITS       0b1000000000000000
 #define RVOPC_C_LBU_MASK       0b1111110000000011
@@ -349,4 +868,10 @@ static const char *friendly_reg_names[32] = {
 	"s10", "s11", "t3", "t4", "t5", "t6"
 };
 
+static const char *friendly_freg_names[32] = {
+	"ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7", "fs0", "fs1", "fa0",
+	"fa1", "fa2", "fa3", "fa4", "fa5", "fa6", "fa7", "fs2", "fs3", "fs4", "fs5",
+	"fs6", "fs7", "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11"
+};
+
 #endif
@@ -0,0 +1,75 @@
+#ifndef _RV_AOT_H
+#define _RV_AOT_H
+
+#include "rv_types.h"
+
+// Interface between rvcpp and code translated ahead of time by
+// scripts/aot_translate.py, which turns the code it finds in a program image
+// into C++ and builds it as a shared object, loaded with --aot.
+//
+// Translated code is a set of blocks, each a run of instructions from the
+// fast path's set (rv_ops.h) at a fixed physical address. A block runs until
+// an unconditional jump, a trap, or the end of the run, and branches within
+// the run stay inside the block, so small loops run as host loops. Each
+// block holds a copy of the instructions it was translated from, and is
+// only used while memory still holds exactly those instructions (see
+// CodeCache). Everything else, including code the translator didn't find,
+// is interpreted as normal.
+//
+// Blocks are position-independent: they are called with the virtual
+// address they start at, so they work with address translation enabled.
+
+// Changes whenever this interface, or the semantics in rv_ops.h, change
+enum {RV_AOT_ABI_VERSION = 1};
+
+// Name of the AOTImage in a translated shared object
+#define RV_AOT_IMAGE_SYMBOL "rvcpp_aot_image"
+
+struct AOTContext {
+	ux_t *regs;
+	// Loads and stores, as RVCore::load() and store(), except that they
+	// return -1 on success and the exception cause otherwise
+	void *core;
+	int (*load)(void *core, ux_t vaddr, uint size, uint64_t &data, ux_t &fault_addr);
+	int (*store)(void *core, ux_t vaddr, uint size, uint64_t data, ux_t &fault_addr);
+	// Set when a write drops a block (possibly this one), so that a block
+	// stops after any store which sets it
+	const bool *code_written;
+	// Most instructions the block may retire. Blocks are only entered with
+	// budget for every instruction in them, and only branch back within
+	// themselves if there is still budget to run the whole block again.
+	uint budget;
+
+	// Set by the block: where execution continues, and the number of
+	// instructions retired (also kept up to date before every load or store,
+	// in case it throws). If trapped is set, pc is the instruction which
+	// trapped, which is not counted, and the core must take the trap.
+	ux_t pc;
+	uint retired;
+	bool trapped;
+	uint cause;
+	ux_t tval;
+};
+
+typedef void (*AOTBlockFn)(AOTContext *ctx, ux_t pc);
+
+struct AOTBlock {
+	// Physical address and size of the instructions translated, which
+	// never cross a page, and the number of instructions
+	ux_t paddr;
+	ux_t size;
+	uint n_instrs;
+	// The instructions which were translated
+	const uint8_t *code;
+	AOTBlockFn fn;
+};
+
+struct AOTImage {
+	uint abi_version;
+	// RV_DECODE_VERSION of the decoder the translator used
+	uint decode_version;
+	uint n_blocks;
+	const AOTBlock *blocks;
+};
+
+#endif
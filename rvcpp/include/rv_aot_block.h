@@ -0,0 +1,82 @@
+#ifndef _RV_AOT_BLOCK_H
+#define _RV_AOT_BLOCK_H
+
+#include "rv_aot.h"
+#include "rv_ops.h"
+
+// Included only by code generated by scripts/aot_translate.py. Each block is
+// a function like this, with one statement per instruction, and a label
+// before each instruction which a branch within the block can reach:
+//
+// static void block_80000000(AOTContext *ctx, ux_t pc) {
+// 	AOT_BLOCK_BEGIN
+// #define AOT_NEXT i1
+// 	{const uint32_t instr = 0x00150513u; RV_FAST_OP_ADDI}
+// #undef AOT_NEXT
+// i1:
+// 	...
+// 	AOT_BLOCK_END(n_instrs)
+// 	case 0x4: goto i1;
+// 	AOT_BLOCK_RETURN
+// }
+//
+// The cases map offsets from the start of the block to labels.
+
+#define AOT_BLOCK_BEGIN \
+	ux_t *regs = ctx->regs; \
+	const ux_t start = pc; \
+	uint n = 0; \
+	ctx->trapped = false;
+
+#define AOT_BLOCK_END(n_instrs) \
+	goto exit; \
+jump: \
+	if (n + (n_instrs) > ctx->budget) \
+		goto exit; \
+	switch (pc - start) {
+
+#define AOT_BLOCK_RETURN \
+	default: break; \
+	} \
+exit: \
+	ctx->pc = pc; \
+	ctx->retired = n;
+
+#define RD     (instr >> 7 & 0x1f)
+#define RS1    regs[instr >> 15 & 0x1f]
+#define RS2    regs[instr >> 20 & 0x1f]
+#define SHAMT  (instr >> 20 & 0x1f)
+#define WRITE_RD(rd, x) do {regs[rd] = (x); regs[0] = 0;} while (0)
+#define NEXT(len) do {pc += (len); ++n; goto AOT_NEXT;} while (0)
+#define JUMP(target) do {pc = (target); ++n; goto jump;} while (0)
+#define TRAP(c, t) do {ctx->trapped = true; ctx->cause = (c); ctx->tval = (t); goto exit;} while (0)
+#define OP(x) do {WRITE_RD(RD, x); NEXT(4);} while (0)
+#define C_OP(rd, x) do {WRITE_RD(rd, x); NEXT(2);} while (0)
+#define LOAD(rd, addr, size, ext, len) do { \
+	uint64_t load_data; \
+	ux_t fault_addr; \
+	ctx->retired = n; \
+	int cause = ctx->load(ctx->core, addr, size, load_data, fault_addr); \
+	if (cause >= 0) \
+		TRAP(cause, fault_addr); \
+	WRITE_RD(rd, ext); \
+	NEXT(len); \
+} while (0)
+// Stops after a store which drops translated code, which may be the rest of
+// this block
+#define STORE(addr, size, data, len) do { \
+	ux_t fault_addr; \
+	ctx->retired = n; \
+	int cause = ctx->store(ctx->core, addr, size, data, fault_addr); \
+	if (cause >= 0) \
+		TRAP(cause, fault_addr); \
+	if (*ctx->code_written) { \
+		pc += (len); \
+		++n; \
+		goto exit; \
+	} \
+	NEXT(len); \
+} while (0)
+#define SLOW() goto exit
+
+#endif
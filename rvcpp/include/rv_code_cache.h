@@ -0,0 +1,285 @@
+#ifndef _RV_CODE_CACHE_H
+#define _RV_CODE_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "rv_aot.h"
+#include "rv_types.h"
+
+// Predecoded instructions for the threaded fast path, one table per physical
+// page of the flat RAM which has been executed from. Entries are filled on
+// first execution and hold the instruction and its decoded op, so a hit
+// skips both the fetch and the decode.
+//
+// Stores can change code at any time (self-modifying code, or a loader
+// writing a program it then jumps to), so every write to the flat RAM goes
+// through write(). A bitmap marks the pages which have a table: a write to
+// any other page costs one bit test. A write to a code page empties only the
+// entries it overlaps, including one starting 2 bytes before it, which may
+// be a 32-bit instruction. The fast path rereads the entry before each
+// instruction, so a store which changes the next instruction takes effect
+// immediately, the same as on the slow path, which always fetches from
+// memory.
+//
+// FENCE.I drops everything. This is not needed for writes made by the hart,
+// but covers any which bypass write().
+//
+// Blocks translated to native code (rv_aot.h) are attached to a page when
+// its table is created, or when they are loaded if that is later, provided
+// memory holds the instructions they were translated from. A write which
+// overlaps an attached block drops it, and sets aot_written so that a
+// running block stops. FENCE.I drops them along with everything else, and
+// they are attached again, if still valid, when the page is next executed
+// from.
+//
+// Translations can also be kept in a directory, one shared object per page,
+// named by a hash of the page contents, so that hot code runs natively in
+// this run and from the start of later ones. A worker thread does all of
+// the work, so the simulation never waits for it: when a page is first
+// executed from, the worker looks for its translation and loads it. run()
+// samples where execution is each time it returns, and once a page with no
+// translation has enough samples, the worker runs scripts/aot_translate.py
+// on a copy of the page, with the sampled addresses as entry points, and
+// loads the result. Meanwhile the page is interpreted as normal, and loaded
+// blocks are attached at the start of a later run() call. The hash only
+// finds the file: blocks are checked against memory as usual, so a stale or
+// colliding translation is never used.
+
+struct DecodedInstr {
+	static const uint16_t EMPTY = 0xffffu;
+
+	uint32_t instr;
+	// RVOp, or EMPTY if not yet decoded
+	uint16_t op;
+};
+
+// Instruction at offset into a page, with the upper halfword cleared if it
+// is 16-bit. False if it is a 32-bit instruction which crosses the end of the
+// page.
+static inline bool code_page_instr(const uint8_t *page, ux_t offset, uint32_t &instr) {
+	if (offset == 0xffeu) {
+		uint16_t instr16;
+		memcpy(&instr16, page + offset, 2);
+		instr = instr16;
+		return (instr & 0x3) != 0x3;
+	}
+	memcpy(&instr, page + offset, 4);
+	if ((instr & 0x3) != 0x3)
+		instr &= 0xffffu;
+	return true;
+}
+
+struct AOTPage {
+	// Block starting at each halfword, or null
+	const AOTBlock *blocks[0x800];
+	// Every block attached, including dropped ones
+	std::vector<const AOTBlock*> attached;
+};
+
+struct CodePage {
+	// One entry per halfword. A 32-bit instruction at the last halfword
+	// crosses into the next page, and is never cached.
+	DecodedInstr instrs[0x800];
+	// Null if no translated blocks are attached
+	std::unique_ptr<AOTPage> aot;
+	// Number of times run() has returned with pc in this page, and the
+	// distinct offsets it returned at (up to CodeCache::MAX_HOT_OFFSETS)
+	uint samples;
+	std::vector<uint16_t> hot_offsets;
+	// Hash of the page contents when first executed from, which names its
+	// translation in CodeCache::persist_dir, once the worker has looked for
+	// it, and whether there is a translation, or one is being made
+	uint64_t hash;
+	bool looked_up;
+	bool translated;
+
+	CodePage() : samples(0), hash(0), looked_up(false), translated(false) {
+		for (DecodedInstr &d : instrs)
+			d.op = DecodedInstr::EMPTY;
+	}
+};
+
+struct CodeCache {
+	// Physical page number of the first page (possibly partial) of RAM
+	ux_t base_ppn;
+	std::vector<uint64_t> code_bitmap;
+	std::vector<std::unique_ptr<CodePage>> pages;
+	// Directory of translated pages, or empty if not used, and the
+	// translator to fill it with. Must not change once a page has been
+	// executed from.
+	std::string persist_dir;
+	std::string translator;
+	// Set by the worker when there are loaded translations to merge
+	std::atomic<bool> loads_ready;
+	// Set by write() when it drops a translated block
+	bool aot_written;
+
+	CodeCache(ux_t ram_base, ux_t ram_top) : loads_ready(false), aot_written(false) {
+		base_ppn = ram_base >> 12;
+		ux_t n_pages = ram_top > ram_base ? ((ram_top - 1) >> 12) - base_ppn + 1 : 0;
+		code_bitmap.resize((n_pages + 63) / 64);
+		pages.resize(n_pages);
+		loads_pending = 0;
+		loader_stop = false;
+		translate_failed = false;
+	}
+
+	~CodeCache() {
+		if (loader.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(load_mutex);
+				loader_stop = true;
+			}
+			load_cv.notify_all();
+			loader.join();
+		}
+	}
+
+	bool has_code(ux_t i) const {
+		return code_bitmap[i / 64] >> (i % 64) & 1u;
+	}
+
+	// Table for the page at paddr, which must be in RAM, with host address
+	// host. Created empty if the page has not been executed from, and a
+	// saved copy requested.
+	CodePage *page(ux_t paddr, const uint8_t *host) {
+		ux_t i = (paddr >> 12) - base_ppn;
+		if (!pages[i]) {
+			pages[i].reset(new CodePage());
+			code_bitmap[i / 64] |= 1ull << (i % 64);
+			if (!persist_dir.empty())
+				request_load(i, host);
+			auto blocks = aot_blocks.find(i);
+			if (blocks != aot_blocks.end())
+				attach_aot(i, host, blocks->second.data(), blocks->second.size());
+		}
+		return pages[i].get();
+	}
+
+	// Pages are translated for persist_dir once run() has returned in them
+	// this many times
+	static const uint HOT_SAMPLES = 16;
+	static const uint MAX_HOT_OFFSETS = 16;
+
+	// Record that run() returned at paddr, in a page which has a table, with
+	// host address host
+	void sample(ux_t paddr, const uint8_t *host) {
+		ux_t i = (paddr >> 12) - base_ppn;
+		CodePage &p = *pages[i];
+		++p.samples;
+		uint16_t offset = paddr & 0xfffu;
+		if (p.hot_offsets.size() < MAX_HOT_OFFSETS &&
+				std::find(p.hot_offsets.begin(), p.hot_offsets.end(), offset) == p.hot_offsets.end())
+			p.hot_offsets.push_back(offset);
+		if (p.samples >= HOT_SAMPLES && p.looked_up && !p.translated)
+			request_translate(i, host);
+	}
+
+	// Must be called for every write to [paddr, paddr + size), which must be
+	// in RAM, before the fast path next runs.
+	void write(ux_t paddr, ux_t size) {
+		if (size == 0)
+			return;
+		ux_t first = (paddr >> 12) - base_ppn;
+		ux_t last = ((paddr + (size - 1)) >> 12) - base_ppn;
+		if (first == last && !has_code(first))
+			return;
+		for (ux_t i = first; i <= last; ++i) {
+			if (!has_code(i))
+				continue;
+			ux_t page_base = (base_ppn + i) << 12;
+			ux_t start = std::max(paddr, page_base + 2) - 2;
+			ux_t end = std::min(paddr + (size - 1), page_base + 0xfffu);
+			DecodedInstr *instrs = pages[i]->instrs;
+			for (ux_t hw = (start & 0xfffu) >> 1; hw <= (end & 0xfffu) >> 1; ++hw)
+				instrs[hw].op = DecodedInstr::EMPTY;
+			if (AOTPage *aot = pages[i]->aot.get()) {
+				for (const AOTBlock *b : aot->attached) {
+					const AOTBlock *&entry = aot->blocks[(b->paddr & 0xfffu) >> 1];
+					if (entry == b && b->paddr <= end && start < b->paddr + b->size) {
+						entry = nullptr;
+						aot_written = true;
+					}
+				}
+			}
+		}
+	}
+
+	void flush_all() {
+		for (std::unique_ptr<CodePage> &p : pages)
+			p.reset();
+		std::fill(code_bitmap.begin(), code_bitmap.end(), 0);
+	}
+
+	// The rest are in rv_code_cache.cpp. ram is the host address of
+	// ram_base.
+
+	// Attach translations the worker has loaded
+	void merge_loaded(const uint8_t *ram, ux_t ram_base);
+
+	// Translate every hot page which has no translation yet, and wait for
+	// the worker to finish. Returns false if a page can't be translated,
+	// after the worker prints a message to stderr.
+	bool save(const uint8_t *ram, ux_t ram_base);
+
+	// In rv_aot.cpp. Load blocks from a shared object built by
+	// scripts/aot_translate.py. Prints a message to stderr and returns false
+	// on failure.
+	bool load_aot(const std::string &path, const uint8_t *ram, ux_t ram_base);
+
+private:
+	struct LoadRequest {
+		ux_t index;
+		// Look for a translation of contents, or translate them for hash
+		// with the given entry points
+		bool translate;
+		std::unique_ptr<uint8_t[]> contents;
+		uint64_t hash;
+		std::vector<uint16_t> entries;
+		// Result: the translation, if any, and whether translation failed
+		const AOTImage *image;
+		bool failed;
+	};
+
+	// Set by merge_loaded() if any translation failed
+	bool translate_failed;
+
+	std::thread loader;
+	// Protects everything below
+	std::mutex load_mutex;
+	std::condition_variable load_cv;
+	std::deque<LoadRequest> load_queue;
+	std::vector<LoadRequest> load_done;
+	// Requests queued or in progress
+	uint loads_pending;
+	bool loader_stop;
+
+	// Translated blocks by page index, not yet checked against memory
+	std::unordered_map<ux_t, std::vector<const AOTBlock*>> aot_blocks;
+
+	std::string page_path(uint64_t hash) const;
+	void request_load(ux_t index, const uint8_t *host);
+	void request_translate(ux_t index, const uint8_t *host);
+	void queue_request(LoadRequest &&req);
+	void loader_main();
+	bool translate(const LoadRequest &req) const;
+
+	// In rv_aot.cpp. open_aot() returns null, with a message in error, on
+	// failure. add_aot() can be called at any time, and attaches blocks to
+	// pages which already exist.
+	static const AOTImage *open_aot(const std::string &path, std::string &error);
+	void add_aot(const AOTImage *image, const uint8_t *ram, ux_t ram_base);
+	void attach_aot(ux_t index, const uint8_t *host, const AOTBlock *const *blocks, size_t n);
+};
+
+#endif
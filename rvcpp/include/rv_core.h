@@ -1,21 +1,56 @@
 #ifndef _RV_CORE_H
 #define _RV_CORE_H
 
+#include <array>
 #include <optional>
 #include <cassert>
 
+#include "rv_code_cache.h"
 #include "rv_csr.h"
 #include "rv_types.h"
 #include "rv_mem.h"
+#include "rv_tlb.h"
+#include "rv_vector.h"
 #include "encoding/rv_csr.h"
 
+struct RVCore;
+
+// Environment calls can be serviced by the simulator itself rather than by
+// guest software, e.g. SBI calls from an S-mode kernel when there is no M-mode
+// firmware. The handler reads arguments from, and writes results to, the
+// core's registers.
+struct ECallHandler {
+	// Return true if the call was handled, in which case execution continues
+	// after the ECALL. Otherwise the ECALL traps as normal.
+	virtual bool ecall(RVCore &core, uint priv) = 0;
+};
+
+// Same, for EBREAK, e.g. for semihosting, where an EBREAK with marker
+// instructions either side is a request to the debug host.
+struct EBreakHandler {
+	// Return true if handled, in which case execution continues after the
+	// EBREAK. Otherwise the EBREAK traps as normal.
+	virtual bool ebreak(RVCore &core, uint priv) = 0;
+};
+
 struct RVCore {
 	std::array<ux_t, 32> regs;
+	// Single-precision values are NaN-boxed in the upper 32 bits
+	std::array<uint64_t, 32> fregs;
+	VRegFile vregs;
 	ux_t pc;
 	RVCSR csr;
 	bool load_reserved;
 	MemBase32 &mem;
 
+	// Perform misaligned loads and stores directly, rather than raising an
+	// alignment exception for M-mode software to emulate
+	bool allow_misaligned;
+
+	// Optional simulator-side handling of ECALL and EBREAK (may be null)
+	ECallHandler *ecall_handler;
+	EBreakHandler *ebreak_handler;
+
 	// A single flat RAM is handled as a special case, in addition to whatever
 	// is in `mem`, because this avoids virtual calls for the majority of
 	// memory accesses. This RAM takes precedence over whatever is mapped at
@@ -25,10 +60,23 @@ struct RVCore {
 	ux_t ram_base;
 	ux_t ram_top;
 
-	RVCore(MemBase32 &_mem, ux_t reset_vector, ux_t ram_base_, ux_t ram_size_) : mem(_mem) {
+	// Sv32 translation cache
+	TLB tlb;
+
+	// Predecoded instructions for run(). Anything which writes to the flat
+	// RAM other than through w8/w16/w32 or store() must call code_cache.write().
+	CodeCache code_cache;
+
+	RVCore(MemBase32 &_mem, ux_t reset_vector, ux_t ram_base_, ux_t ram_size_) :
+			mem(_mem), code_cache(ram_base_, ram_base_ + ram_size_) {
 		std::fill(std::begin(regs), std::end(regs), 0);
+		std::fill(std::begin(fregs), std::end(fregs), 0);
+		std::fill(std::begin(vregs.e8), std::end(vregs.e8), 0);
 		pc = reset_vector;
 		load_reserved = false;
+		allow_misaligned = false;
+		ecall_handler = nullptr;
+		ebreak_handler = nullptr;
 		ram_base = ram_base_;
 		ram_top = ram_base_ + ram_size_;
 		ram = new ux_t[ram_size_ / sizeof(ux_t)];
@@ -46,13 +94,21 @@ struct RVCore {
 
 	enum {
 		OPC_LOAD     = 0b00'000,
+		OPC_LOAD_FP  = 0b00'001,
 		OPC_MISC_MEM = 0b00'011,
 		OPC_OP_IMM   = 0b00'100,
 		OPC_AUIPC    = 0b00'101,
 		OPC_STORE    = 0b01'000,
+		OPC_STORE_FP = 0b01'001,
 		OPC_AMO      = 0b01'011,
 		OPC_OP       = 0b01'100,
 		OPC_LUI      = 0b01'101,
+		OPC_MADD     = 0b10'000,
+		OPC_MSUB     = 0b10'001,
+		OPC_NMSUB    = 0b10'010,
+		OPC_NMADD    = 0b10'011,
+		OPC_OP_FP    = 0b10'100,
+		OPC_OP_V     = 0b10'101,
 		OPC_BRANCH   = 0b11'000,
 		OPC_JALR     = 0b11'001,
 		OPC_JAL      = 0b11'011,
@@ -62,6 +118,15 @@ struct RVCore {
 	// Fetch and execute one instruction from memory.
 	void step(bool trace=false);
 
+	// Execute up to max_instrs instructions without tracing, adding the
+	// number executed to retired (also if an exception such as a testbench
+	// exit escapes). Stops early at anything the threaded fast path does not
+	// handle, or after a trap, so a caller looping on run() sees each
+	// privilege change. Behaviour is the same as calling step() max_instrs
+	// times, provided IRQ inputs (e.g. the timer) are not changed until run()
+	// returns.
+	void run(uint max_instrs, uint &retired);
+
 	// Functions to read/write memory from this hart's point of view
 	std::optional<uint8_t> r8(ux_t addr) {
 		if (addr >= ram_base && addr < ram_top) {
@@ -75,6 +140,7 @@ struct RVCore {
 		if (addr >= ram_base && addr < ram_top) {
 			ram[(addr - ram_base) >> 2] &= ~(0xffu << 8 * (addr & 0x3));
 			ram[(addr - ram_base) >> 2] |= (uint32_t)data << 8 * (addr & 0x3);
+			code_cache.write(addr, 1);
 			return true;
 		} else {
 			return mem.w8(addr, data);
@@ -93,6 +159,7 @@ struct RVCore {
 		if (addr >= ram_base && addr < ram_top) {
 			ram[(addr - ram_base) >> 2] &= ~(0xffffu << 8 * (addr & 0x2));
 			ram[(addr - ram_base) >> 2] |= (uint32_t)data << 8 * (addr & 0x2);
+			code_cache.write(addr, 2);
 			return true;
 		} else {
 			return mem.w16(addr, data);
@@ -110,6 +177,7 @@ struct RVCore {
 	bool w32(ux_t addr, uint32_t data) {
 		if (addr >= ram_base && addr < ram_top) {
 			ram[(addr - ram_base) >> 2] = data;
+			code_cache.write(addr, 4);
 			return true;
 		} else {
 			return mem.w32(addr, data);
@@ -118,55 +186,107 @@ struct RVCore {
 
 private:
 
-	std::optional<ux_t> vmap_sv32(ux_t vaddr, ux_t atp, uint effective_priv, ux_t required_permissions) {
-		assert(effective_priv <= PRV_S);
-		// First translation stage: vaddr bits 31:22
-		ux_t addr_of_pte1 = atp + ((vaddr >> 20) & 0xffcu);
-		std::optional<ux_t> pte1 = r32(addr_of_pte1);
-		if (!(pte1 && *pte1 & PTE_V))
-			return std::nullopt;
-		if (*pte1 & (PTE_X | PTE_W | PTE_R)) {
-			// It's a leaf PTE. Permission check before touching A/D bits:
-			if (!csr.pte_permissions_ok(*pte1, required_permissions))
-				return std::nullopt;
-			// First-level leaf PTEs must have lower PPN bits cleared, so that
-			// they cover a 4 MiB-aligned range.
-			if (*pte1 & 0x000ffc00u)
-				return std::nullopt;
-			// Looks good, so update A/D and return the mapped address
-			ux_t pte1_a_d_update = *pte1 | PTE_A | (required_permissions & PTE_W ? PTE_D : 0);
-			if (pte1_a_d_update != *pte1) {
-				if (!w32(addr_of_pte1, pte1_a_d_update)) {
-					return std::nullopt;
-				}
-			}
-			return ((*pte1 << 2) & 0xffc00000u) | (vaddr & 0x003fffffu);
-		}
+	// Loads and stores of 1, 2, 4 or 8 bytes, shared between all integer and
+	// FP encodings. Misaligned accesses trap unless allow_misaligned is set.
+	// Return an exception cause on failure, with the address to report in
+	// xtval (for a page-crossing access, this is the part which faulted).
+	std::optional<uint> load(ux_t vaddr, uint size, uint64_t &data, ux_t &fault_addr);
+	std::optional<uint> store(ux_t vaddr, uint size, uint64_t data, ux_t &fault_addr);
 
-		// Second translation stage: vaddr bits 21:12
-		ux_t addr_of_pte0 = ((*pte1 << 2) & 0xfffff000u) | ((vaddr >> 10) & 0xffcu);
-		std::optional<ux_t> pte0 = r32(addr_of_pte0);
-		// Must be a valid leaf PTE.
-		if (!(pte0 && (*pte0 & PTE_V) && (*pte0 & (PTE_X | PTE_W | PTE_R))))
-			return std::nullopt;
-		// Permission check
-		if (!csr.pte_permissions_ok(*pte0, required_permissions))
+	// load() and store() for translated code (AOTContext)
+	static int aot_load(void *core, ux_t vaddr, uint size, uint64_t &data, ux_t &fault_addr);
+	static int aot_store(void *core, ux_t vaddr, uint size, uint64_t data, ux_t &fault_addr);
+
+	// As load(), but single-precision values are NaN-boxed
+	std::optional<uint> load_fp(ux_t vaddr, uint size, uint64_t &data, ux_t &fault_addr);
+
+	// Zicbom/Zicboz operation on the cache block containing vaddr. Return an
+	// exception cause on failure.
+	std::optional<uint> cache_block_op(ux_t vaddr, uint op);
+
+	// Vector instructions (rv_vector.cpp). OP-V, and the vector encodings of
+	// LOAD-FP/STORE-FP. Vector registers are written directly, since a vector
+	// instruction which traps part way through is restarted from vstart.
+	// Return an exception cause on failure.
+	std::optional<uint> vector_op(uint32_t instr, std::optional<ux_t> &rd_wdata);
+	std::optional<uint> vector_load_store(uint32_t instr, std::optional<ux_t> &xtval);
+	std::optional<uint> vector_access_element(ux_t vaddr, uint size, uint8_t *data, bool store);
+
+	// PMP check for a load/store/AMO whose translation has already succeeded
+	bool pmp_permits_ls(ux_t paddr, uint size, uint required) {
+		return csr.pmp_permits(paddr, size, required, csr.get_effective_priv_ls());
+	}
+
+	// Page table accesses are checked by PMP as S-mode accesses. Failing
+	// that check is reported as a page fault, as for any other failed PTE
+	// access.
+	std::optional<ux_t> pte_read(ux_t addr) {
+		if (!csr.pmp_permits(addr, 4, PMP_R, PRV_S))
 			return std::nullopt;
-		// PTE looks good, so update A/D bits before returning the mapped address
-		ux_t pte0_a_d_update = *pte0 | PTE_A | (required_permissions & PTE_W ? PTE_D : 0);
-		if (pte0_a_d_update != *pte0) {
-			if (!w32(addr_of_pte0, pte0_a_d_update)) {
+		return r32(addr);
+	}
+
+	bool pte_write(ux_t addr, ux_t pte) {
+		return csr.pmp_permits(addr, 4, PMP_W, PRV_S) && w32(addr, pte);
+	}
+
+	// Host address of [paddr, paddr + size) if it is entirely in the flat RAM
+	uint8_t *ram_host_ptr(ux_t paddr, ux_t size) {
+		if (paddr >= ram_base && paddr < ram_top && size <= ram_top - paddr)
+			return (uint8_t*)ram + (paddr - ram_base);
+		return nullptr;
+	}
+
+	// Set D in a cached leaf PTE which is in RAM, with a single host store.
+	// As with a walk, the update only happens if the PTE in memory still
+	// matches, and PMP permits the write.
+	bool tlb_set_dirty(TLBEntry &e) {
+		if (!(csr.pte_ad_update_enabled() && e.pte_host && *e.pte_host == e.pte &&
+				csr.pmp_permits(e.pte_addr, 4, PMP_W, PRV_S)))
+			return false;
+		e.pte |= PTE_D;
+		*e.pte_host = e.pte;
+		code_cache.write(e.pte_addr, 4);
+		return true;
+	}
+
+	// Page table walk, filling the TLB on success (rv_core.cpp)
+	TLBEntry *vmap_sv32_walk(ux_t vaddr, ux_t atp, ux_t required_permissions);
+
+	// Translate vaddr, via the TLB if possible. If host is non-null, it is set
+	// to the host address of vaddr if the page is backed by the flat RAM,
+	// else null. The host address is valid up to the end of the 4 KiB page.
+	std::optional<ux_t> vmap_sv32(ux_t vaddr, ux_t atp, uint effective_priv, ux_t required_permissions,
+			uint8_t **host = nullptr) {
+		assert(effective_priv <= PRV_S);
+		if (atp != tlb.atp) {
+			tlb.flush_all();
+			tlb.atp = atp;
+		}
+		// A hit which fails the permission check, or needs a D update which
+		// can't be done in place, is retried with a walk, which rereads the
+		// PTE.
+		TLBEntry *e = tlb.lookup(vaddr);
+		if (!(e && csr.pte_permissions_ok(e->pte, required_permissions) &&
+				(!(required_permissions & PTE_W) || e->pte & PTE_D || tlb_set_dirty(*e)))) {
+			e = vmap_sv32_walk(vaddr, atp, required_permissions);
+			if (!e)
 				return std::nullopt;
-			}
 		}
-		return ((*pte0 << 2) & 0xfffff000u) | (vaddr & 0xfffu);
+		ux_t offset = vaddr & e->offset_mask;
+		if (host)
+			*host = e->host ? e->host + offset : nullptr;
+		return e->pbase + offset;
 	}
 
-	std::optional<ux_t> vmap_ls(ux_t vaddr, ux_t required_permissions) {
+	std::optional<ux_t> vmap_ls(ux_t vaddr, ux_t required_permissions, uint8_t **host = nullptr) {
 		if (csr.translation_enabled_ls()) {
-			std::optional<ux_t> paddr = vmap_sv32(vaddr, csr.get_atp(), csr.get_effective_priv_ls(), required_permissions);
-			return paddr;
+			return vmap_sv32(vaddr, csr.get_atp(), csr.get_effective_priv_ls(), required_permissions, host);
 		} else {
+			if (host) {
+				uint8_t *page = ram_host_ptr(vaddr & ~0xfffu, 0x1000);
+				*host = page ? page + (vaddr & 0xfffu) : nullptr;
+			}
 			return vaddr;
 		}
 	}
@@ -179,6 +299,15 @@ private:
 		}
 	}
 
+	// Host address of the page containing vaddr, if it is entirely in RAM and
+	// PMP permits execution from all of it, otherwise null
+	const uint8_t *fetch_host_page(ux_t vaddr) {
+		std::optional<ux_t> paddr = vmap_fetch(vaddr & ~0xfffu);
+		if (!paddr || !csr.pmp_permits(*paddr, 0x1000, PMP_X, csr.get_true_priv()))
+			return nullptr;
+		return ram_host_ptr(*paddr, 0x1000);
+	}
+
 };
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef _RV_CSR_H
 #define _RV_CSR_H
 
+#include <algorithm>
+#include <array>
 #include <optional>
 #include <cassert>
 
@@ -27,6 +29,8 @@ class RVCSR {
 	ux_t mcause;
 	ux_t medeleg;
 	ux_t mideleg;
+	ux_t menvcfg;
+	ux_t menvcfgh;
 
 	// Machine counter
 	ux_t mcounteren;
@@ -44,19 +48,135 @@ class RVCSR {
 	ux_t sepc;
 	ux_t scause;
 	ux_t satp;
+	ux_t senvcfg;
+
+	// Sstc supervisor timer compare, against the platform timer's current
+	// value (which is also readable through the time CSR)
+	uint64_t stimecmp;
+	uint64_t time;
+
+	// Floating point control/status (fflags and frm are views of fcsr)
+	ux_t fcsr;
+
+	// Translation state derived from priv, mstatus and satp, which is needed
+	// on every memory access. Recalculated by update_translation_state()
+	// whenever one of those changes.
+	bool xlate_fetch;
+	bool xlate_ls;
+	uint priv_ls;
+	ux_t atp;
+
+	// Vector configuration and fixed-point state (vcsr is a view of vxrm
+	// and vxsat). vl and vtype are read-only to CSR instructions.
+	ux_t vstart;
+	ux_t vxsat;
+	ux_t vxrm;
+	ux_t vl;
+	ux_t vtype;
+
+	// Physical memory protection. pmpcfg0-3 are views of pmpcfg. The range
+	// matched by each entry is decoded into [pmp_lo, pmp_hi) whenever a PMP
+	// CSR is written; an entry which is off has an empty range.
+	static const uint PMP_N_REGIONS = 16;
+	uint8_t pmpcfg[PMP_N_REGIONS];
+	ux_t pmpaddr[PMP_N_REGIONS];
+	uint64_t pmp_lo[PMP_N_REGIONS];
+	uint64_t pmp_hi[PMP_N_REGIONS];
+
+	// Scanning all 16 entries in priority order on every access would be
+	// slow, so the outcome is cached per 4 kiB page, for M-mode and for
+	// S/U-mode. A page which is not entirely inside the matching entry is
+	// marked PMP_PAGE_SPLIT, and falls back to the scan. Entries are
+	// invalidated in bulk by bumping pmp_generation.
+	static const uint PMP_PAGE_CACHE_SIZE = 1024;
+	static const uint8_t PMP_PAGE_SPLIT = 0x80;
+	struct PMPPageCacheEntry {
+		uint32_t page;
+		uint32_t generation;
+		uint8_t perm_m;
+		uint8_t perm_su;
+	};
+	PMPPageCacheEntry pmp_page_cache[PMP_PAGE_CACHE_SIZE];
+	uint32_t pmp_generation;
+
+	void pmp_update();
+	const PMPPageCacheEntry &pmp_fill_page_cache(ux_t paddr);
+	bool pmp_permits_scan(ux_t paddr, uint size, uint required, uint check_priv);
+
+	bool stce_enabled() {
+		return menvcfgh & ENVCFGH_STCE;
+	}
 
 	// xip's read value is a combination of local read/write bits and external
-	// interrupt signals
+	// interrupt signals. When Sstc is enabled via menvcfg.STCE, STIP is driven
+	// solely by stimecmp, so S-mode can run its own timer without going via
+	// M-mode software.
 	ux_t get_effective_xip() {
-		return xip |
+		ux_t stip;
+		if (stce_enabled()) {
+			stip = time >= stimecmp ? MIP_STIP : 0;
+		} else {
+			stip = (xip & MIP_STIP) | (irq_t ? MIP_STIP : 0);
+		}
+		return (xip & ~MIP_STIP) | stip |
 			(irq_s ? MIP_MSIP | MIP_SSIP : 0) |
-			(irq_t ? MIP_MTIP | MIP_STIP : 0) |
+			(irq_t ? MIP_MTIP : 0) |
 			(irq_e ? MIP_MEIP | MIP_SEIP : 0);
 	}
 
+	// SD is a read-only summary bit for FS and VS (XS is hardwired to 0)
+	ux_t get_status_sd() {
+		bool dirty = (xstatus & MSTATUS_FS) == MSTATUS_FS_DIRTY ||
+			(xstatus & MSTATUS_VS) == MSTATUS_VS_DIRTY;
+		return dirty ? MSTATUS32_SD : 0;
+	}
+
+	// Counter access below M-mode is enabled by the given bit of mcounteren
+	// (and scounteren, for U-mode)
+	bool counter_permitted(ux_t bit) {
+		return (priv >= PRV_M || mcounteren & bit) && (priv >= PRV_S || scounteren & bit);
+	}
+
+	// Each CSR's access rules and handlers, indexed by CSR address, so that
+	// an access is a single lookup plus at most one extra permission check
+	// (csr_check_permitted). Built once, in rv_csr.cpp.
+	struct CSRDesc {
+		// Null if the CSR is not implemented
+		ux_t (*read)(RVCSR &csr, uint16_t addr);
+		// Null if writes are ignored
+		void (*write)(RVCSR &csr, uint16_t addr, ux_t data);
+		uint8_t min_priv;
+		bool read_only;
+		uint8_t check;
+	};
+	static const std::array<CSRDesc, 4096> csr_table;
+	static std::array<CSRDesc, 4096> make_csr_table();
+	bool csr_check_permitted(uint check);
+	ux_t mip_w_mask();
+
 	// Internal interface for updating trap state once a trap's target
-	// privilege has been calculated. Returns trap target pc.
-	ux_t trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv);
+	// privilege has been calculated. Returns trap target pc. xtval is only
+	// written if provided.
+	ux_t trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv,
+		std::optional<ux_t> xtval = std::nullopt);
+
+	// Must be called after any change to priv, MPRV, MPP or satp
+	void update_translation_state() {
+		// MPRV is cleared on any xRET to a lower privilege, so it only takes
+		// effect in M-mode
+		priv_ls = xstatus & MSTATUS_MPRV ? GETBITS(xstatus, 12, 11) : priv;
+		assert(priv == PRV_M || priv_ls == priv);
+		bool bare = !(satp & SATP32_MODE);
+		xlate_fetch = !bare && priv != PRV_M;
+		xlate_ls = !bare && priv_ls != PRV_M;
+		atp = (satp & SATP32_PPN) << 12;
+	}
+
+	// All privilege changes (traps and xRET) go through here
+	void set_priv(uint priv_) {
+		priv = priv_;
+		update_translation_state();
+	}
 
 public:
 
@@ -79,6 +199,8 @@ public:
 		mcause     = 0;
 		medeleg    = 0;
 		mideleg    = 0;
+		menvcfg    = 0;
+		menvcfgh   = ENVCFGH_ADUE;
 
 		mcounteren = 0;
 		mcycle     = 0;
@@ -93,9 +215,32 @@ public:
 		sepc       = 0;
 		scause     = 0;
 		satp       = 0;
+		senvcfg    = 0;
+
+		stimecmp   = -1ull;
+		time       = 0;
+
+		fcsr       = 0;
+
+		vstart     = 0;
+		vxsat      = 0;
+		vxrm       = 0;
+		vl         = 0;
+		vtype      = VTYPE_VILL;
+
+		for (uint i = 0; i < PMP_N_REGIONS; ++i) {
+			pmpcfg[i] = 0;
+			pmpaddr[i] = 0;
+		}
+		for (PMPPageCacheEntry &e : pmp_page_cache) {
+			e.generation = 0;
+		}
+		pmp_generation = 0;
+		pmp_update();
+		update_translation_state();
 	}
 
-	void step_counters();
+	void step_counters(uint n = 1);
 
 	// Returns None on permission/decode fail
 	std::optional<ux_t> read(uint16_t addr, bool side_effect=true);
@@ -104,8 +249,15 @@ public:
 	bool write(uint16_t addr, ux_t data, uint op=WRITE);
 
 	// Determine target privilege level of an exception, update trap state
-	// (including change of privilege level), return trap target PC
-	ux_t trap_enter_exception(uint xcause, ux_t xepc);
+	// (including change of privilege level and, if provided, the target
+	// mode's xtval), return trap target PC
+	ux_t trap_enter_exception(uint xcause, ux_t xepc, std::optional<ux_t> xtval = std::nullopt) {
+		assert(xcause < 32);
+		// Exceptions are never taken to a lower privilege, so only U and S
+		// traps can be delegated
+		uint target_priv = priv < PRV_M && (medeleg >> xcause & 1u) ? PRV_S : PRV_M;
+		return trap_enter_at_priv(xcause, xepc, target_priv, xtval);
+	}
 
 	// If there is currently a pending IRQ that must be entered, then
 	// determine its target privilege level, update trap state, and return
@@ -119,34 +271,42 @@ public:
 	// mstatus.tsr, in which case take trap)
 	ux_t trap_sret(ux_t pc);
 
-	// Set *tval syndrome register for the current privilege mode
-	void trap_set_xtval(ux_t xtval);
-
 	// True privilege is also the effective privilege for instruction fetch
 	// (fetch translation/protection is not affected by MPRV)
 	uint get_true_priv() {
 		return priv;
 	}
 
+	// The following are all precalculated, as they are needed for every
+	// load, store and fetch
+
 	uint get_effective_priv_ls() {
-		if (xstatus & MSTATUS_MPRV) {
-			assert(priv == PRV_M);
-			return GETBITS(xstatus, 12, 11); // MPP
-		} else {
-			return priv;
-		}
+		return priv_ls;
 	}
 
 	bool translation_enabled_fetch() {
-		return get_true_priv() != PRV_M && (satp & SATP32_MODE);
+		return xlate_fetch;
 	}
 
 	bool translation_enabled_ls() {
-		return get_effective_priv_ls() != PRV_M && (satp & SATP32_MODE);
+		return xlate_ls;
 	}
 
 	ux_t get_atp() {
-		return (satp & SATP32_PPN) << 12;
+		return atp;
+	}
+
+	// Check an access of size bytes at paddr against PMP, where required is
+	// some combination of PMP_R/W/X and check_priv is the effective
+	// privilege of the access.
+	bool pmp_permits(ux_t paddr, uint size, uint required, uint check_priv) {
+		const PMPPageCacheEntry *e = &pmp_page_cache[(paddr >> 12) % PMP_PAGE_CACHE_SIZE];
+		if (e->page != paddr >> 12 || e->generation != pmp_generation)
+			e = &pmp_fill_page_cache(paddr);
+		uint8_t perm = check_priv == PRV_M ? e->perm_m : e->perm_su;
+		if (!(perm & PMP_PAGE_SPLIT) && (paddr & 0xfffu) + size <= 0x1000u)
+			return (perm & required) == required;
+		return pmp_permits_scan(paddr, size, required, check_priv);
 	}
 
 	bool permit_sfence_vma() {
@@ -175,6 +335,103 @@ public:
 		return true;
 	}
 
+	// Svadu: hardware sets PTE A/D bits when menvcfgh.ADUE is set. Otherwise
+	// (Svade) an access to a page with A clear, or a store to a page with D
+	// clear, raises a page fault for software to handle.
+	bool pte_ad_update_enabled() {
+		return menvcfgh & ENVCFGH_ADUE;
+	}
+
+	// Zicbom/Zicboz enables for clean/flush (ENVCFG_CBCFE) and zero
+	// (ENVCFG_CBZE). M-mode is always permitted; lower privileges must be
+	// enabled at every level above them.
+	bool permit_cbo(ux_t envcfg_enable) {
+		return priv == PRV_M || ((menvcfg & envcfg_enable) &&
+			(priv == PRV_S || (senvcfg & envcfg_enable)));
+	}
+
+	// cbo.inval is illegal, performs a flush, or performs an invalidate,
+	// depending on the CBIE fields at each level above the current
+	// privilege. Returns the most restrictive of these.
+	ux_t get_effective_cbie() {
+		if (priv == PRV_M)
+			return ENVCFG_CBIE_INVAL;
+		ux_t cbie = menvcfg & ENVCFG_CBIE;
+		if (priv == PRV_U)
+			cbie = std::min(cbie, senvcfg & ENVCFG_CBIE);
+		return cbie;
+	}
+
+	// FP instructions and CSRs are illegal when mstatus.FS is Off
+	bool fp_enabled() {
+		return (xstatus & MSTATUS_FS) != MSTATUS_FS_OFF;
+	}
+
+	void fp_set_dirty() {
+		xstatus |= MSTATUS_FS_DIRTY;
+	}
+
+	uint get_frm() {
+		return GETBITS(fcsr, 7, 5);
+	}
+
+	// Accumulate exception flags raised by an FP instruction
+	void fp_accrue_fflags(uint fflags) {
+		if (fflags) {
+			fcsr |= fflags & FSR_AEXC;
+			fp_set_dirty();
+		}
+	}
+
+	// Vector instructions and CSRs are illegal when mstatus.VS is Off
+	bool vec_enabled() {
+		return (xstatus & MSTATUS_VS) != MSTATUS_VS_OFF;
+	}
+
+	void vec_set_dirty() {
+		xstatus |= MSTATUS_VS_DIRTY;
+	}
+
+	ux_t get_vl() {
+		return vl;
+	}
+
+	ux_t get_vtype() {
+		return vtype;
+	}
+
+	ux_t get_vstart() {
+		return vstart;
+	}
+
+	// Only vset{i}vl{i} can change vl and vtype
+	void vec_set_config(ux_t vl_, ux_t vtype_) {
+		vl = vl_;
+		vtype = vtype_;
+	}
+
+	// Vector loads which trap part way through record the index of the
+	// faulting element here, so that the instruction can be restarted.
+	// All other vector instructions reset vstart to 0.
+	void vec_set_vstart(ux_t vstart_) {
+		vstart = vstart_;
+	}
+
+	void vec_set_vxsat() {
+		vxsat = 1;
+	}
+
+	// Raise supervisor interrupts directly, for M-mode services which are
+	// implemented by the simulator rather than guest firmware (e.g. SBI IPIs)
+	void set_sip_bits(ux_t bits) {
+		xip |= bits & (MIP_SSIP | MIP_STIP | MIP_SEIP);
+	}
+
+	// Current value of the platform timer (mtime)
+	void set_time(uint64_t t) {
+		time = t;
+	}
+
 	void set_irq_t(bool irq) {
 		irq_t = irq;
 	}
@@ -0,0 +1,71 @@
+#ifndef _RV_FDT_H
+#define _RV_FDT_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "rv_types.h"
+
+// Flattened device tree (DTB) generation, so the tree handed to firmware and
+// kernels always matches the machine the simulator was configured with.
+
+// Serialises a tree in the order nodes and properties are added. Multi-byte
+// values are converted to big-endian.
+struct FDTWriter {
+	void begin_node(const std::string &name);
+	void end_node();
+
+	void prop(const std::string &name, const void *data, size_t len);
+	void prop_empty(const std::string &name);
+	void prop_u32(const std::string &name, uint32_t value);
+	void prop_cells(const std::string &name, const std::vector<uint32_t> &cells);
+	void prop_str(const std::string &name, const std::string &value);
+	void prop_strlist(const std::string &name, const std::vector<std::string> &values);
+
+	// Returns the complete blob: header, empty reservation map, structure
+	// block and strings block.
+	std::vector<uint8_t> finish();
+
+private:
+	std::vector<uint8_t> dt_struct;
+	std::vector<uint8_t> dt_strings;
+	std::map<std::string, uint32_t> string_offsets;
+
+	void push_u32(uint32_t x);
+	void push_bytes(const void *data, size_t len);
+};
+
+// Devices which the tree can describe. The type determines the node name
+// and compatible string.
+enum FDTDeviceType {
+	FDT_DEV_TBIO,
+	FDT_DEV_UART8250,
+	FDT_DEV_MTIMER
+};
+
+struct FDTDevice {
+	FDTDeviceType type;
+	ux_t base;
+	ux_t size;
+};
+
+struct FDTMachine {
+	ux_t ram_base;
+	ux_t ram_size;
+	uint n_harts;
+	// Frequency of mtime ticks, for the timebase-frequency property
+	uint32_t timebase_freq;
+	std::vector<FDTDevice> devices;
+	// Kernel command line for /chosen, omitted if empty
+	std::string bootargs;
+	// PTE A/D bits are managed by software (Svade) rather than hardware
+	// (Svadu)
+	bool svade;
+};
+
+// Describe the machine, including the extensions implemented by RVCore.
+std::vector<uint8_t> fdt_build_machine(const FDTMachine &m);
+
+#endif
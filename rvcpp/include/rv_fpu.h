@@ -0,0 +1,42 @@
+#ifndef _RV_FPU_H
+#define _RV_FPU_H
+
+#include <optional>
+
+#include "rv_types.h"
+
+// Floating point arithmetic for the F and D extensions. Operations use the
+// host FPU wherever its behaviour matches the RISC-V spec, and results are
+// patched up where it doesn't (NaN canonicalisation, min/max, comparisons,
+// float->int saturation, and ties in the RMM rounding mode, which has no
+// host equivalent).
+
+// Rounding modes as encoded in fcsr.frm and instr[14:12]
+enum {
+	FRM_RNE = 0,
+	FRM_RTZ = 1,
+	FRM_RDN = 2,
+	FRM_RUP = 3,
+	FRM_RMM = 4,
+	FRM_DYN = 7
+};
+
+struct FPUResult {
+	uint64_t wdata;
+	// Result goes to the integer register file, rather than the FP one
+	bool to_xreg;
+};
+
+// Execute an OP-FP or fused multiply-add instruction (loads and stores are
+// handled by the core). frm is the current dynamic rounding mode from fcsr.
+// Exception flags raised by the instruction are ORed into fflags. Single
+// precision values are NaN-boxed in the 64-bit FP registers. Returns None if
+// the instruction is illegal, including use of a reserved rounding mode.
+std::optional<FPUResult> fpu_execute(uint32_t instr, uint frm, ux_t xrs1,
+	uint64_t frs1, uint64_t frs2, uint64_t frs3, uint &fflags);
+
+static inline uint64_t fpu_nan_box(uint32_t x) {
+	return 0xffffffff00000000ull | x;
+}
+
+#endif
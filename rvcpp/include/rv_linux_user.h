@@ -0,0 +1,48 @@
+#ifndef _RV_LINUX_USER_H
+#define _RV_LINUX_USER_H
+
+#include <string>
+#include <vector>
+
+#include "rv_core.h"
+
+// User-mode emulation of statically linked RV32 Linux programs, similar to
+// qemu-user. The ELF is loaded into the core's flat RAM, which U-mode
+// addresses directly (no guest kernel, so satp stays Bare), and ECALLs from
+// U-mode are translated to host system calls. Only the calls needed for libc
+// startup, file I/O, memory allocation and timing are implemented; anything
+// else returns -ENOSYS.
+//
+// RAM layout, from the bottom up: ELF segments, heap (brk), mmap region
+// (growing down), stack (at the top of RAM).
+
+struct LinuxUser: ECallHandler {
+	// Load an ELF, build the initial stack with argv, envp and auxv, then
+	// enter the program in U-mode. Prints a message to stderr and returns
+	// false if the file can't be loaded.
+	bool load(RVCore &core, const std::string &path, const std::vector<std::string> &argv,
+		const std::vector<std::string> &envp);
+
+	// Only ECALLs from U-mode are handled.
+	virtual bool ecall(RVCore &core, uint priv);
+
+private:
+	ux_t brk_start;
+	ux_t brk_cur;
+	ux_t mmap_bottom;
+	ux_t mmap_top;
+
+	// Host pointer to guest memory, or null if [addr, addr + size) is not
+	// entirely in RAM. for_write must be set if the host will write through
+	// it, so that any decoded code there is dropped.
+	uint8_t *guest_ptr(RVCore &core, ux_t addr, ux_t size, bool for_write);
+	// Null if the string is not NUL-terminated within RAM
+	const char *guest_str(RVCore &core, ux_t addr);
+
+	sx_t syscall(RVCore &core, ux_t num, const ux_t *args);
+	sx_t sys_brk(RVCore &core, ux_t addr);
+	sx_t sys_mmap(RVCore &core, const ux_t *args);
+	sx_t sys_munmap(ux_t addr, ux_t len);
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef _RV_MACHINE_H
+#define _RV_MACHINE_H
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "rv_core.h"
+#include "rv_fdt.h"
+#include "rv_mem.h"
+#include "mmio/mtimer.h"
+
+// Machine description: memory map, devices and clocking. Either the built-in
+// default, or read from an INI-style file:
+//
+//   [machine]
+//   harts     = 1
+//   mtime_div = 4096       ; instructions per mtime tick (power of 2)
+//   clock_hz  = 50000000   ; nominal core clock, for the device tree
+//   reset     = 0x1000     ; reset vector, default is the base of main RAM
+//
+//   [ram]                  ; first RAM is the core's fast-path RAM
+//   base = 0x80000000
+//   size = 0x10000000
+//
+//   [rom bootrom]          ; optional name after the type
+//   base = 0x00001000
+//   size = 0x1000
+//   file = bootrom.bin     ; optional initial contents
+//
+//   [uart8250]
+//   base = 0xe0004000
+//
+// Region types are ram, rom, tbio, uart8250 and mtimer. Device sizes are
+// fixed by the type. Comments start with ; or #.
+
+enum MachineRegionType {
+	REGION_RAM,
+	REGION_ROM,
+	REGION_TBIO,
+	REGION_UART8250,
+	REGION_MTIMER
+};
+
+struct MachineRegion {
+	MachineRegionType type;
+	std::string name;
+	ux_t base;
+	ux_t size;
+	// Initial contents, for RAM and ROM
+	std::vector<uint8_t> contents;
+};
+
+struct MachineConfig {
+	uint n_harts;
+	uint mtime_div;
+	uint32_t clock_hz;
+	ux_t reset_vector;
+	// The first RAM region is the core's flat RAM, and must exist
+	std::vector<MachineRegion> regions;
+};
+
+// The memory map main.cpp has always used, with RAM at ram_base
+MachineConfig machine_config_default(ux_t ram_base, ux_t ram_size);
+
+// Parse and validate (no overlapping regions, a main RAM, supported hart
+// count). Prints a message to stderr and returns nullopt on error.
+std::optional<MachineConfig> machine_config_load(const std::string &path);
+
+// A machine instantiated from a config: devices are created and added to the
+// memory map, and the main RAM is handed to the core.
+struct Machine {
+	MachineConfig config;
+	MemMap32 mem;
+	std::vector<std::unique_ptr<MemBase32>> devices;
+	// Null if there is no timer
+	MTimer *mtimer;
+	RVCore core;
+
+	Machine(const MachineConfig &config_);
+
+	const MachineRegion &main_ram() const;
+	FDTMachine fdt_description() const;
+};
+
+#endif
@@ -2,12 +2,24 @@
 #define _RV_MEM_H
 
 #include "rv_types.h"
+#include <algorithm>
 #include <optional>
 #include <tuple>
 #include <cassert>
 #include <vector>
 #include <cstdio>
 
+// Zicbom/Zicboz cache-block operations. Values match the instruction's
+// imm[11:0] field.
+enum {
+	CBO_INVAL = 0,
+	CBO_CLEAN = 1,
+	CBO_FLUSH = 2,
+	CBO_ZERO  = 4
+};
+
+enum {CBO_BLOCK_SIZE = 64};
+
 struct MemBase32 {
 	virtual std::optional<uint8_t> r8(__attribute__((unused)) ux_t addr) {return std::nullopt;}
 	virtual bool w8(__attribute__((unused)) ux_t addr, __attribute__((unused)) uint8_t data) {return false;}
@@ -15,6 +27,9 @@ struct MemBase32 {
 	virtual bool w16(__attribute__((unused)) ux_t addr, __attribute__((unused)) uint16_t data) {return false;}
 	virtual std::optional<uint32_t> r32(__attribute__((unused)) ux_t addr) {return std::nullopt;}
 	virtual bool w32(__attribute__((unused)) ux_t addr, __attribute__((unused)) uint32_t data) {return false;}
+	// Hook for cache models: clean, flush or invalidate the block at addr.
+	// There are no caches by default, so this does nothing.
+	virtual bool cache_block_op(__attribute__((unused)) ux_t addr, __attribute__((unused)) uint op) {return true;}
 };
 
 struct FlatMem32: MemBase32 {
@@ -73,6 +88,15 @@ struct FlatMem32: MemBase32 {
 	}
 };
 
+// Contents are set up by the simulator, and writes from the hart fail
+struct ROM32: FlatMem32 {
+	ROM32(uint32_t size_): FlatMem32(size_) {}
+
+	virtual bool w8(__attribute__((unused)) ux_t addr, __attribute__((unused)) uint8_t data) {return false;}
+	virtual bool w16(__attribute__((unused)) ux_t addr, __attribute__((unused)) uint16_t data) {return false;}
+	virtual bool w32(__attribute__((unused)) ux_t addr, __attribute__((unused)) uint32_t data) {return false;}
+};
+
 struct TBExitException {
 	ux_t exitcode;
 	TBExitException(ux_t code): exitcode(code) {}
@@ -97,15 +121,25 @@ struct TBMemIO: MemBase32 {
 };
 
 struct MemMap32: MemBase32 {
+	// Sorted by base address, and non-overlapping, so lookup is a binary
+	// search.
 	std::vector<std::tuple<uint32_t, uint32_t, MemBase32*> > memmap;
 
 	void add(uint32_t base, uint32_t size, MemBase32 *mem) {
-		memmap.push_back(std::make_tuple(base, size, mem));
+		assert(size > 0 && base + (size - 1) >= base);
+		auto pos = std::upper_bound(memmap.begin(), memmap.end(), base,
+			[](uint32_t addr, const auto &region) {return addr < std::get<0>(region);});
+		assert(pos == memmap.end() || base + (size - 1) < std::get<0>(*pos));
+		assert(pos == memmap.begin() || std::get<0>(*(pos - 1)) + (std::get<1>(*(pos - 1)) - 1) < base);
+		memmap.insert(pos, std::make_tuple(base, size, mem));
 	}
 
 	std::tuple <uint32_t, MemBase32*> map_addr(uint32_t addr) {
-		for (auto&& [base, size, mem] : memmap) {
-			if (addr >= base && addr < base + size)
+		auto pos = std::upper_bound(memmap.begin(), memmap.end(), addr,
+			[](uint32_t addr, const auto &region) {return addr < std::get<0>(region);});
+		if (pos != memmap.begin()) {
+			auto &&[base, size, mem] = *(pos - 1);
+			if (addr - base < size)
 				return std::make_tuple(addr - base, mem);
 		}
 		return std::make_tuple(addr, nullptr);
@@ -158,6 +192,14 @@ struct MemMap32: MemBase32 {
 		else
 			return false;
 	}
+
+	virtual bool cache_block_op(ux_t addr, uint op) {
+		auto [offset, mem] = map_addr(addr);
+		if (mem)
+			return mem->cache_block_op(offset, op);
+		else
+			return false;
+	}
 };
 
 #endif
@@ -0,0 +1,310 @@
+#ifndef _RV_OPS_H
+#define _RV_OPS_H
+
+#include "rv_types.h"
+
+// Instruction field decoding, and the semantics of the instructions which
+// RVCore::run() executes on its threaded fast path. The semantics are shared
+// with ahead-of-time translated code (rv_aot.h), so that both always behave
+// the same as each other.
+
+// Use unsigned arithmetic everywhere, with explicit sign extension as required.
+static inline ux_t sext(ux_t bits, int sign_bit) {
+	if (sign_bit >= XLEN - 1)
+		return bits;
+	else
+		return (bits & ((1u << (sign_bit + 1)) - 1)) - ((bits & 1u << sign_bit) << 1);
+}
+
+static inline ux_t imm_i(uint32_t instr) {
+	return (instr >> 20) - (instr >> 19 & 0x1000);
+}
+
+static inline ux_t imm_s(uint32_t instr) {
+	return (instr >> 20 & 0xfe0u)
+		+ (instr >> 7 & 0x1fu)
+		- (instr >> 19 & 0x1000u);
+}
+
+static inline ux_t imm_u(uint32_t instr) {
+	return instr & 0xfffff000u;
+}
+
+static inline ux_t imm_b(uint32_t instr) {
+	return (instr >> 7 & 0x1e)
+		+ (instr >> 20 & 0x7e0)
+		+ (instr << 4 & 0x800)
+		- (instr >> 19 & 0x1000);
+}
+
+static inline ux_t imm_j(uint32_t instr) {
+	 return (instr >> 20 & 0x7fe)
+	 	+ (instr >> 9 & 0x800)
+	 	+ (instr & 0xff000)
+	 	- (instr >> 11 & 0x100000);
+}
+
+static inline ux_t imm_ci(uint32_t instr) {
+	return GETBITS(instr, 6, 2) - (GETBIT(instr, 12) << 5);
+}
+
+static inline ux_t imm_cj(uint32_t instr) {
+	return -(GETBIT(instr, 12) << 11)
+		+ (GETBIT(instr, 11) << 4)
+		+ (GETBITS(instr, 10, 9) << 8)
+		+ (GETBIT(instr, 8) << 10)
+		+ (GETBIT(instr, 7) << 6)
+		+ (GETBIT(instr, 6) << 7)
+		+ (GETBITS(instr, 5, 3) << 1)
+		+ (GETBIT(instr, 2) << 5);
+}
+
+static inline ux_t imm_cb(uint32_t instr) {
+	return -(GETBIT(instr, 12) << 8)
+		+ (GETBITS(instr, 11, 10) << 3)
+		+ (GETBITS(instr, 6, 5) << 6)
+		+ (GETBITS(instr, 4, 3) << 1)
+		+ (GETBIT(instr, 2) << 5);
+}
+
+// Bit manipulation helpers. GCC recognises the rotate idiom and emits a
+// single host rotate instruction.
+static inline ux_t rotl(ux_t x, uint shamt) {
+	return (x << (shamt & 0x1f)) | (x >> (-shamt & 0x1f));
+}
+
+static inline ux_t rotr(ux_t x, uint shamt) {
+	return (x >> (shamt & 0x1f)) | (x << (-shamt & 0x1f));
+}
+
+static inline ux_t orc_b(ux_t x) {
+	// MSB of each byte is set if any bit in that byte is set
+	ux_t nonzero = (((x & 0x7f7f7f7fu) + 0x7f7f7f7fu) | x) & 0x80808080u;
+	return (nonzero >> 7) * 0xffu;
+}
+
+static inline uint c_rs1_s(uint32_t instr) {
+	return GETBITS(instr, 9, 7) + 8;
+}
+
+static inline uint c_rs2_s(uint32_t instr) {
+	return GETBITS(instr, 4, 2) + 8;
+}
+
+static inline uint c_rs1_l(uint32_t instr) {
+	return GETBITS(instr, 11, 7);
+}
+
+static inline uint c_rs2_l(uint32_t instr) {
+	return GETBITS(instr, 6, 2);
+}
+
+// RV_FAST_OP_<op> is a statement executing the RVOP_<op> instruction in
+// `instr` at `pc`, with registers in `regs`. It uses these macros, which the
+// includer defines:
+//
+// - RD, RS1, RS2, SHAMT: fields of instr (RS1 and RS2 are register values)
+// - WRITE_RD(rd, x): write x to register rd, keeping x0 zero
+// - OP(x), C_OP(rd, x): write x to rd (RD for OP) and continue with the
+//   next 4-byte or 2-byte instruction
+// - NEXT(len): continue with the instruction len bytes on
+// - JUMP(target): continue at target
+// - LOAD(rd, addr, size, ext, len): load size bytes from addr into
+//   load_data, then OP with ext, or trap
+// - STORE(addr, size, data, len): store, then NEXT(len), or trap
+// - SLOW(): leave the instruction to the slow path
+//
+// None of these return to the statement which used them.
+
+#define RV_FAST_OP_LUI        OP(imm_u(instr));
+#define RV_FAST_OP_AUIPC      OP(pc + imm_u(instr));
+#define RV_FAST_OP_JAL \
+	{ \
+		ux_t target = pc + imm_j(instr); \
+		WRITE_RD(RD, pc + 4); \
+		JUMP(target); \
+	}
+#define RV_FAST_OP_JALR \
+	{ \
+		ux_t target = (RS1 + imm_i(instr)) & -2u; \
+		WRITE_RD(RD, pc + 4); \
+		JUMP(target); \
+	}
+
+#define RV_FAST_OP_BEQ        if (RS1 == RS2)             JUMP(pc + imm_b(instr)); NEXT(4);
+#define RV_FAST_OP_BNE        if (RS1 != RS2)             JUMP(pc + imm_b(instr)); NEXT(4);
+#define RV_FAST_OP_BLT        if ((sx_t)RS1 < (sx_t)RS2)  JUMP(pc + imm_b(instr)); NEXT(4);
+#define RV_FAST_OP_BGE        if ((sx_t)RS1 >= (sx_t)RS2) JUMP(pc + imm_b(instr)); NEXT(4);
+#define RV_FAST_OP_BLTU       if (RS1 < RS2)              JUMP(pc + imm_b(instr)); NEXT(4);
+#define RV_FAST_OP_BGEU       if (RS1 >= RS2)             JUMP(pc + imm_b(instr)); NEXT(4);
+
+#define RV_FAST_OP_LB         LOAD(RD, RS1 + imm_i(instr), 1, sext(load_data, 7), 4);
+#define RV_FAST_OP_LH         LOAD(RD, RS1 + imm_i(instr), 2, sext(load_data, 15), 4);
+#define RV_FAST_OP_LW         LOAD(RD, RS1 + imm_i(instr), 4, load_data, 4);
+#define RV_FAST_OP_LBU        LOAD(RD, RS1 + imm_i(instr), 1, load_data, 4);
+#define RV_FAST_OP_LHU        LOAD(RD, RS1 + imm_i(instr), 2, load_data, 4);
+#define RV_FAST_OP_SB         STORE(RS1 + imm_s(instr), 1, RS2, 4);
+#define RV_FAST_OP_SH         STORE(RS1 + imm_s(instr), 2, RS2, 4);
+#define RV_FAST_OP_SW         STORE(RS1 + imm_s(instr), 4, RS2, 4);
+
+#define RV_FAST_OP_ADDI       OP(RS1 + imm_i(instr));
+#define RV_FAST_OP_SLTI       OP((sx_t)RS1 < (sx_t)imm_i(instr));
+#define RV_FAST_OP_SLTIU      OP(RS1 < imm_i(instr));
+#define RV_FAST_OP_XORI       OP(RS1 ^ imm_i(instr));
+#define RV_FAST_OP_ORI        OP(RS1 | imm_i(instr));
+#define RV_FAST_OP_ANDI       OP(RS1 & imm_i(instr));
+#define RV_FAST_OP_SLLI       OP(RS1 << SHAMT);
+#define RV_FAST_OP_SRLI       OP(RS1 >> SHAMT);
+#define RV_FAST_OP_SRAI       OP((sx_t)RS1 >> SHAMT);
+
+#define RV_FAST_OP_ADD        OP(RS1 + RS2);
+#define RV_FAST_OP_SUB        OP(RS1 - RS2);
+#define RV_FAST_OP_SLL        OP(RS1 << (RS2 & 0x1f));
+#define RV_FAST_OP_SLT        OP((sx_t)RS1 < (sx_t)RS2);
+#define RV_FAST_OP_SLTU       OP(RS1 < RS2);
+#define RV_FAST_OP_XOR        OP(RS1 ^ RS2);
+#define RV_FAST_OP_SRL        OP(RS1 >> (RS2 & 0x1f));
+#define RV_FAST_OP_SRA        OP((sx_t)RS1 >> (RS2 & 0x1f));
+#define RV_FAST_OP_OR         OP(RS1 | RS2);
+#define RV_FAST_OP_AND        OP(RS1 & RS2);
+
+// M
+#define RV_FAST_OP_MUL        OP(RS1 * RS2);
+#define RV_FAST_OP_MULH       OP((sdx_t)(sx_t)RS1 * (sdx_t)(sx_t)RS2 >> XLEN);
+#define RV_FAST_OP_MULHSU     OP((sdx_t)(sx_t)RS1 * (sdx_t)RS2 >> XLEN);
+#define RV_FAST_OP_MULHU      OP((uint64_t)RS1 * RS2 >> XLEN);
+#define RV_FAST_OP_DIV        OP(RS2 == 0 ? -1u : RS2 == ~0u ? -RS1 : (sx_t)RS1 / (sx_t)RS2);
+#define RV_FAST_OP_DIVU       OP(RS2 ? RS1 / RS2 : ~0u);
+#define RV_FAST_OP_REM        OP(RS2 == 0 ? RS1 : RS2 == ~0u ? 0 : (sx_t)RS1 % (sx_t)RS2);
+#define RV_FAST_OP_REMU       OP(RS2 ? RS1 % RS2 : RS1);
+
+// Zba, Zbb, Zbs
+#define RV_FAST_OP_SH1ADD     OP((RS1 << 1) + RS2);
+#define RV_FAST_OP_SH2ADD     OP((RS1 << 2) + RS2);
+#define RV_FAST_OP_SH3ADD     OP((RS1 << 3) + RS2);
+#define RV_FAST_OP_ANDN       OP(RS1 & ~RS2);
+#define RV_FAST_OP_ORN        OP(RS1 | ~RS2);
+#define RV_FAST_OP_XNOR       OP(~(RS1 ^ RS2));
+#define RV_FAST_OP_MAX        OP((sx_t)RS1 > (sx_t)RS2 ? RS1 : RS2);
+#define RV_FAST_OP_MAXU       OP(RS1 > RS2 ? RS1 : RS2);
+#define RV_FAST_OP_MIN        OP((sx_t)RS1 < (sx_t)RS2 ? RS1 : RS2);
+#define RV_FAST_OP_MINU       OP(RS1 < RS2 ? RS1 : RS2);
+#define RV_FAST_OP_ROL        OP(rotl(RS1, RS2));
+#define RV_FAST_OP_ROR        OP(rotr(RS1, RS2));
+#define RV_FAST_OP_RORI       OP(rotr(RS1, SHAMT));
+#define RV_FAST_OP_CLZ        OP(RS1 ? __builtin_clz(RS1) : XLEN);
+#define RV_FAST_OP_CTZ        OP(RS1 ? __builtin_ctz(RS1) : XLEN);
+#define RV_FAST_OP_CPOP       OP(__builtin_popcount(RS1));
+#define RV_FAST_OP_SEXT_B     OP(sext(RS1, 7));
+#define RV_FAST_OP_SEXT_H     OP(sext(RS1, 15));
+#define RV_FAST_OP_ZEXT_H     OP(RS1 & 0xffffu);
+#define RV_FAST_OP_ORC_B      OP(orc_b(RS1));
+#define RV_FAST_OP_REV8       OP(__builtin_bswap32(RS1));
+#define RV_FAST_OP_BCLR       OP(RS1 & ~(1u << (RS2 & 0x1f)));
+#define RV_FAST_OP_BEXT       OP((RS1 >> (RS2 & 0x1f)) & 1u);
+#define RV_FAST_OP_BINV       OP(RS1 ^ (1u << (RS2 & 0x1f)));
+#define RV_FAST_OP_BSET       OP(RS1 | (1u << (RS2 & 0x1f)));
+#define RV_FAST_OP_BCLRI      OP(RS1 & ~(1u << SHAMT));
+#define RV_FAST_OP_BEXTI      OP((RS1 >> SHAMT) & 1u);
+#define RV_FAST_OP_BINVI      OP(RS1 ^ (1u << SHAMT));
+#define RV_FAST_OP_BSETI      OP(RS1 | (1u << SHAMT));
+
+// RVC Quadrant 00
+#define RV_FAST_OP_C_ADDI4SPN \
+	C_OP(c_rs2_s(instr), regs[2] \
+		+ (GETBITS(instr, 12, 11) << 4) \
+		+ (GETBITS(instr, 10, 7) << 6) \
+		+ (GETBIT(instr, 6) << 2) \
+		+ (GETBIT(instr, 5) << 3));
+#define RV_FAST_OP_C_LW \
+	LOAD(c_rs2_s(instr), regs[c_rs1_s(instr)] \
+		+ (GETBIT(instr, 6) << 2) \
+		+ (GETBITS(instr, 12, 10) << 3) \
+		+ (GETBIT(instr, 5) << 6), 4, load_data, 2);
+#define RV_FAST_OP_C_SW \
+	STORE(regs[c_rs1_s(instr)] \
+		+ (GETBIT(instr, 6) << 2) \
+		+ (GETBITS(instr, 12, 10) << 3) \
+		+ (GETBIT(instr, 5) << 6), 4, regs[c_rs2_s(instr)], 2);
+
+// RVC Quadrant 01
+#define RV_FAST_OP_C_ADDI     C_OP(c_rs1_l(instr), regs[c_rs1_l(instr)] + imm_ci(instr));
+#define RV_FAST_OP_C_JAL \
+	{ \
+		ux_t target = pc + imm_cj(instr); \
+		WRITE_RD(1, pc + 2); \
+		JUMP(target); \
+	}
+#define RV_FAST_OP_C_LI       C_OP(c_rs1_l(instr), imm_ci(instr));
+#define RV_FAST_OP_C_LUI \
+	if (c_rs1_l(instr) == 2) { \
+		/* c.addi16sp */ \
+		C_OP(2, regs[2] \
+			- (GETBIT(instr, 12) << 9) \
+			+ (GETBIT(instr, 6) << 4) \
+			+ (GETBIT(instr, 5) << 6) \
+			+ (GETBITS(instr, 4, 3) << 7) \
+			+ (GETBIT(instr, 2) << 5)); \
+	} \
+	C_OP(c_rs1_l(instr), -(GETBIT(instr, 12) << 17) + (GETBITS(instr, 6, 2) << 12));
+#define RV_FAST_OP_C_SRLI     C_OP(c_rs1_s(instr), regs[c_rs1_s(instr)] >> GETBITS(instr, 6, 2));
+#define RV_FAST_OP_C_SRAI     C_OP(c_rs1_s(instr), (sx_t)regs[c_rs1_s(instr)] >> GETBITS(instr, 6, 2));
+#define RV_FAST_OP_C_ANDI     C_OP(c_rs1_s(instr), regs[c_rs1_s(instr)] & imm_ci(instr));
+#define RV_FAST_OP_C_SUB      C_OP(c_rs1_s(instr), regs[c_rs1_s(instr)] - regs[c_rs2_s(instr)]);
+#define RV_FAST_OP_C_XOR      C_OP(c_rs1_s(instr), regs[c_rs1_s(instr)] ^ regs[c_rs2_s(instr)]);
+#define RV_FAST_OP_C_OR       C_OP(c_rs1_s(instr), regs[c_rs1_s(instr)] | regs[c_rs2_s(instr)]);
+#define RV_FAST_OP_C_AND      C_OP(c_rs1_s(instr), regs[c_rs1_s(instr)] & regs[c_rs2_s(instr)]);
+#define RV_FAST_OP_C_J        JUMP(pc + imm_cj(instr));
+#define RV_FAST_OP_C_BEQZ \
+	if (regs[c_rs1_s(instr)] == 0) \
+		JUMP(pc + imm_cb(instr)); \
+	NEXT(2);
+#define RV_FAST_OP_C_BNEZ \
+	if (regs[c_rs1_s(instr)] != 0) \
+		JUMP(pc + imm_cb(instr)); \
+	NEXT(2);
+
+// RVC Quadrant 10
+#define RV_FAST_OP_C_SLLI     C_OP(c_rs1_l(instr), regs[c_rs1_l(instr)] << GETBITS(instr, 6, 2));
+#define RV_FAST_OP_C_LWSP \
+	LOAD(c_rs1_l(instr), regs[2] \
+		+ (GETBIT(instr, 12) << 5) \
+		+ (GETBITS(instr, 6, 4) << 2) \
+		+ (GETBITS(instr, 3, 2) << 6), 4, load_data, 2);
+#define RV_FAST_OP_C_SWSP \
+	STORE(regs[2] \
+		+ (GETBITS(instr, 12, 9) << 2) \
+		+ (GETBITS(instr, 8, 7) << 6), 4, regs[c_rs2_l(instr)], 2);
+#define RV_FAST_OP_C_MV \
+	if (c_rs2_l(instr) == 0) { \
+		/* c.jr */ \
+		JUMP(regs[c_rs1_l(instr)] & -2u); \
+	} \
+	C_OP(c_rs1_l(instr), regs[c_rs2_l(instr)]);
+#define RV_FAST_OP_C_ADD \
+	if (c_rs2_l(instr) != 0) { \
+		C_OP(c_rs1_l(instr), regs[c_rs1_l(instr)] + regs[c_rs2_l(instr)]); \
+	} else if (c_rs1_l(instr) != 0) { \
+		/* c.jalr */ \
+		ux_t target = regs[c_rs1_l(instr)] & -2u; \
+		WRITE_RD(1, pc + 2); \
+		JUMP(target); \
+	} \
+	/* c.ebreak */ \
+	SLOW();
+
+// X(op) for every RV_FAST_OP_<op>
+#define RV_FAST_OPS(X) \
+	X(LUI) X(AUIPC) X(JAL) X(JALR) X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU) \
+	X(LB) X(LH) X(LW) X(LBU) X(LHU) X(SB) X(SH) X(SW) X(ADDI) X(SLTI) X(SLTIU) \
+	X(XORI) X(ORI) X(ANDI) X(SLLI) X(SRLI) X(SRAI) X(ADD) X(SUB) X(SLL) X(SLT) \
+	X(SLTU) X(XOR) X(SRL) X(SRA) X(OR) X(AND) X(MUL) X(MULH) X(MULHSU) \
+	X(MULHU) X(DIV) X(DIVU) X(REM) X(REMU) X(SH1ADD) X(SH2ADD) X(SH3ADD) \
+	X(ANDN) X(ORN) X(XNOR) X(MAX) X(MAXU) X(MIN) X(MINU) X(ROL) X(ROR) X(RORI) \
+	X(CLZ) X(CTZ) X(CPOP) X(SEXT_B) X(SEXT_H) X(ZEXT_H) X(ORC_B) X(REV8) \
+	X(BCLR) X(BEXT) X(BINV) X(BSET) X(BCLRI) X(BEXTI) X(BINVI) X(BSETI) \
+	X(C_ADDI4SPN) X(C_LW) X(C_SW) X(C_ADDI) X(C_JAL) X(C_LI) X(C_LUI) \
+	X(C_SRLI) X(C_SRAI) X(C_ANDI) X(C_SUB) X(C_XOR) X(C_OR) X(C_AND) X(C_J) \
+	X(C_BEQZ) X(C_BNEZ) X(C_SLLI) X(C_LWSP) X(C_SWSP) X(C_MV) X(C_ADD)
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _RV_SBI_H
+#define _RV_SBI_H
+
+#include <utility>
+
+#include "rv_core.h"
+
+// Minimal SBI implementation, handled in the simulator so that S-mode
+// payloads (e.g. Linux) can boot without M-mode firmware such as OpenSBI.
+// Each SBI call costs one host function call rather than a trap into M-mode
+// and back. Supports the base, TIME, IPI, RFENCE, HSM, SRST and DBCN
+// extensions, plus the legacy console and timer calls, for a single hart.
+
+enum {
+	SBI_SUCCESS               = 0,
+	SBI_ERR_FAILED            = -1,
+	SBI_ERR_NOT_SUPPORTED     = -2,
+	SBI_ERR_INVALID_PARAM     = -3,
+	SBI_ERR_DENIED            = -4,
+	SBI_ERR_INVALID_ADDRESS   = -5,
+	SBI_ERR_ALREADY_AVAILABLE = -6
+};
+
+enum {
+	SBI_EXT_LEGACY_SET_TIMER  = 0x00,
+	SBI_EXT_LEGACY_PUTCHAR    = 0x01,
+	SBI_EXT_LEGACY_GETCHAR    = 0x02,
+	SBI_EXT_LEGACY_SHUTDOWN   = 0x08,
+	SBI_EXT_BASE              = 0x10,
+	SBI_EXT_TIME              = 0x54494d45,
+	SBI_EXT_IPI               = 0x00735049,
+	SBI_EXT_RFENCE            = 0x52464e43,
+	SBI_EXT_HSM               = 0x0048534d,
+	SBI_EXT_SRST              = 0x53525354,
+	SBI_EXT_DBCN              = 0x4442434e
+};
+
+struct SBI: ECallHandler {
+	// Only ECALLs from S-mode are handled; U-mode ECALLs trap as usual.
+	virtual bool ecall(RVCore &core, uint priv);
+
+	// Put the core into the state M-mode firmware would leave it in (traps
+	// and interrupts delegated, counters enabled), then enter the S-mode
+	// payload at entry with a0 = hartid and a1 = the device tree address.
+	void boot(RVCore &core, ux_t entry, ux_t dtb_addr);
+
+private:
+	// Each returns an (error, value) pair for a0/a1
+	std::pair<sx_t, ux_t> call(RVCore &core, ux_t eid, ux_t fid, const ux_t *args);
+	void set_timer(RVCore &core, uint64_t stime_value);
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _RV_SEMIHOSTING_H
+#define _RV_SEMIHOSTING_H
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "rv_core.h"
+
+// RISC-V semihosting: an EBREAK, preceded by `slli x0, x0, 0x1f` and
+// followed by `srai x0, x0, 7`, asks the host to perform the operation
+// number in a0, with a1 pointing to a parameter block (or holding a single
+// argument). The result is returned in a0. Operation numbers and semantics
+// follow the Arm semihosting specification, which is what newlib and picolibc
+// implement. Buffers are transferred whole, directly to and from RAM where
+// possible, so firmware can load large datasets from host files.
+//
+// Only M-mode requests are handled. Addresses are physical.
+
+enum {
+	SEMIHOST_SYS_OPEN          = 0x01,
+	SEMIHOST_SYS_CLOSE         = 0x02,
+	SEMIHOST_SYS_WRITEC        = 0x03,
+	SEMIHOST_SYS_WRITE0        = 0x04,
+	SEMIHOST_SYS_WRITE         = 0x05,
+	SEMIHOST_SYS_READ          = 0x06,
+	SEMIHOST_SYS_READC         = 0x07,
+	SEMIHOST_SYS_ISERROR       = 0x08,
+	SEMIHOST_SYS_ISTTY         = 0x09,
+	SEMIHOST_SYS_SEEK          = 0x0a,
+	SEMIHOST_SYS_FLEN          = 0x0c,
+	SEMIHOST_SYS_REMOVE        = 0x0e,
+	SEMIHOST_SYS_CLOCK         = 0x10,
+	SEMIHOST_SYS_TIME          = 0x11,
+	SEMIHOST_SYS_ERRNO         = 0x13,
+	SEMIHOST_SYS_HEAPINFO      = 0x16,
+	SEMIHOST_SYS_EXIT          = 0x18,
+	SEMIHOST_SYS_EXIT_EXTENDED = 0x20
+};
+
+// Reason code for a normal exit
+#define SEMIHOST_ADP_STOPPED_APPLICATION_EXIT 0x20026u
+
+struct Semihosting: EBreakHandler {
+	Semihosting();
+	~Semihosting();
+
+	virtual bool ebreak(RVCore &core, uint priv);
+
+private:
+	// Indexed by semihosting handle. Null for closed handles.
+	std::vector<FILE*> files;
+	int last_errno;
+
+	sx_t call(RVCore &core, ux_t op, ux_t arg);
+
+	// Host pointer to [addr, addr + size) if it is entirely in RAM,
+	// otherwise null
+	uint8_t *ram_ptr(RVCore &core, ux_t addr, ux_t size);
+	// Whole-buffer copies between host and guest memory. Return false if
+	// any part of the guest range is not accessible.
+	bool copy_from_guest(RVCore &core, void *dst, ux_t src, ux_t size);
+	bool copy_to_guest(RVCore &core, ux_t dst, const void *src, ux_t size);
+	std::optional<std::vector<ux_t>> read_params(RVCore &core, ux_t addr, uint n);
+	// File name of the given length. Sets last_errno and returns false if
+	// it is longer than any host path, rather than allocating for it.
+	bool read_name(RVCore &core, ux_t addr, ux_t len, std::string &name);
+	FILE *get_file(ux_t handle);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef _RV_TLB_H
+#define _RV_TLB_H
+
+#include "rv_types.h"
+
+// Cache of Sv32 leaf translations. Sv32 has no Svnapot or Svpbmt bits, so the
+// large-page coverage comes from megapages: 4 KiB pages and 4 MiB megapages
+// are kept in separate direct-mapped arrays, and one entry covers a whole
+// megapage. Each entry also records whether the page is backed by the core's
+// flat RAM, so that loads and stores to it can skip the memory map.
+//
+// Entries hold the leaf PTE as it was after A/D update, and permissions are
+// rechecked on each hit (privilege, SUM and MXR may have changed since). The
+// location of the PTE is kept so that the first store to a clean page can set
+// D without another walk.
+//
+// First-level non-leaf PTEs are cached too, indexed by vaddr[31:22], so a
+// miss on a 4 KiB page only needs to read the second-level PTE.
+//
+// As on hardware, software must SFENCE.VMA after changing page tables. All
+// entries are also dropped when the root page table changes.
+
+struct TLBEntry {
+	// Virtual page number (vaddr >> 12, or vaddr >> 22 for a megapage), or
+	// TLB::INVALID_VPN if the entry is empty
+	ux_t vpn;
+	// Leaf PTE, its physical address, and its host address if it is in RAM
+	ux_t pte;
+	ux_t pte_addr;
+	ux_t *pte_host;
+	// Physical address of the start of the page, and the mask for the offset
+	// into it (0xfff or 0x3fffff)
+	ux_t pbase;
+	ux_t offset_mask;
+	// Host address of the start of the page, if it is entirely in RAM,
+	// otherwise null (MMIO, or RAM in the memory map)
+	uint8_t *host;
+};
+
+struct TLB {
+	static const uint N_PAGES = 1024;
+	static const uint N_MEGAPAGES = 64;
+	static const ux_t INVALID_VPN = -1u;
+
+	TLBEntry pages[N_PAGES];
+	TLBEntry megapages[N_MEGAPAGES];
+	// Pointers to second-level tables, one per vaddr[31:22], so there are no
+	// tags. Zero (not valid) if not cached.
+	ux_t table_ptes[1024];
+	// Root page table address which the entries were filled from
+	ux_t atp;
+
+	TLB() {
+		flush_all();
+		atp = 0;
+	}
+
+	TLBEntry &page_entry(ux_t vaddr) {
+		return pages[(vaddr >> 12) % N_PAGES];
+	}
+
+	TLBEntry &megapage_entry(ux_t vaddr) {
+		return megapages[(vaddr >> 22) % N_MEGAPAGES];
+	}
+
+	// Returns null on miss
+	TLBEntry *lookup(ux_t vaddr) {
+		TLBEntry &e = page_entry(vaddr);
+		if (e.vpn == vaddr >> 12)
+			return &e;
+		TLBEntry &m = megapage_entry(vaddr);
+		if (m.vpn == vaddr >> 22)
+			return &m;
+		return nullptr;
+	}
+
+	void flush_all() {
+		for (TLBEntry &e : pages)
+			e.vpn = INVALID_VPN;
+		for (TLBEntry &e : megapages)
+			e.vpn = INVALID_VPN;
+		for (ux_t &pte : table_ptes)
+			pte = 0;
+	}
+
+	// Megapage entries are never copied into the 4 KiB array, so only two
+	// entries can hold a translation for vaddr. The cached table pointer is
+	// dropped too, though the ISA only requires leaf entries to be flushed.
+	void flush(ux_t vaddr) {
+		table_ptes[vaddr >> 22] = 0;
+		TLBEntry &e = page_entry(vaddr);
+		if (e.vpn == vaddr >> 12)
+			e.vpn = INVALID_VPN;
+		TLBEntry &m = megapage_entry(vaddr);
+		if (m.vpn == vaddr >> 22)
+			m.vpn = INVALID_VPN;
+	}
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _RV_VECTOR_H
+#define _RV_VECTOR_H
+
+#include <optional>
+
+#include "rv_types.h"
+
+// Vector register file for the integer vector subset (Zve64x: SEW of 8 to 64
+// bits, no vector FP). Element-wise arithmetic is done by small loop kernels
+// which the host compiler vectorises, and where the host supports it (x86-64
+// AVX2) a wider clone of each kernel is selected once at startup.
+
+enum {
+	VLEN  = 128,
+	VLENB = VLEN / 8,
+	VELEN = 64
+};
+
+// A register group vN..vN+LMUL-1 is contiguous in this array, so a group
+// can be indexed as a single array of elements. Element layout is
+// little-endian, same as memory, which assumes a little-endian host.
+struct alignas(32) VRegFile {
+	union {
+		uint8_t  e8 [32 * VLENB];
+		uint16_t e16[32 * VLENB / 2];
+		uint32_t e32[32 * VLENB / 4];
+		uint64_t e64[32 * VLENB / 8];
+	};
+
+	template <typename T> T *reg(uint vreg);
+
+	uint8_t *bytes(uint vreg) {
+		return &e8[vreg * VLENB];
+	}
+
+	bool mask_bit(uint vreg, uint i) {
+		return GETBIT(e8[vreg * VLENB + i / 8], i % 8);
+	}
+
+	void set_mask_bit(uint vreg, uint i, bool x) {
+		uint8_t &b = e8[vreg * VLENB + i / 8];
+		b = (b & ~(1u << i % 8)) | (uint)x << i % 8;
+	}
+};
+
+template <> inline uint8_t  *VRegFile::reg<uint8_t >(uint vreg) {return &e8 [vreg * VLENB    ];}
+template <> inline uint16_t *VRegFile::reg<uint16_t>(uint vreg) {return &e16[vreg * VLENB / 2];}
+template <> inline uint32_t *VRegFile::reg<uint32_t>(uint vreg) {return &e32[vreg * VLENB / 4];}
+template <> inline uint64_t *VRegFile::reg<uint64_t>(uint vreg) {return &e64[vreg * VLENB / 8];}
+
+// Decoded vtype. lmul_log2 ranges from -3 to 3.
+struct VType {
+	uint sew;
+	int lmul_log2;
+	bool vill;
+
+	VType(ux_t vtype);
+
+	// Number of elements in a register group of this SEW/LMUL. Zero if vill.
+	uint vlmax() const {
+		if (vill)
+			return 0;
+		return lmul_log2 >= 0 ? (VLEN / sew) << lmul_log2 : (VLEN / sew) >> -lmul_log2;
+	}
+
+	// Number of architectural registers in a group (at least 1)
+	uint regs_per_group() const {
+		return lmul_log2 > 0 ? 1u << lmul_log2 : 1u;
+	}
+};
+
+#endif
@@ -1,30 +1,43 @@
 #include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <unistd.h>
 
 #include "rv_mem.h"
 #include "rv_core.h"
-#include "mmio/uart8250.h"
-#include "mmio/mtimer.h"
+#include "rv_fdt.h"
+#include "rv_machine.h"
+#include "rv_sbi.h"
+#include "rv_linux_user.h"
+#include "rv_semihosting.h"
 
 // Minimal RISC-V interpreter, supporting:
 // - RV32I
 // - M
 // - A
+// - F
+// - D
 // - C
+// - Zve64x (integer vector subset, VLEN=128)
+// - Zba, Zbb, Zbs
+// - Zicbom, Zicboz (64-byte blocks)
 // - Zicsr
 // - Zicntr
+// - Sstc
 // - M-mode and S-mode traps
 // - Sv32 virtual memory
+// - SBI (optional, built in)
+// - Linux user-mode syscall emulation (optional)
+// - Semihosting (optional)
 
+// Default machine, when no --config is given. The rest of the memory map is
+// in machine_config_default().
 #define RAM_SIZE_DEFAULT (256 * 1024 * 1024)
 #define RAM_BASE         0x80000000u
-#define IO_BASE          0xe0000000u
-#define TBIO_BASE        (IO_BASE + 0x0000)
-#define UART8250_BASE    (IO_BASE + 0x4000)
-#define MTIMER_BASE      (IO_BASE + 0x8000)
 
 const char *help_str =
 "Usage: rvcpp [--bin x.bin [@addr]] [--dump start end] [--cycles n] [--cpuret]\n"
+"       rvcpp [options] --user prog.elf [args...]\n"
 "    --bin x [@addr]  : Flat binary file loaded to absolute address addr.\n"
 "                       If no address is provided, load to the beginning of RAM.\n"
 "    --vcd x.vcd      : Dummy option for compatibility with CXXRTL tb\n"
@@ -32,6 +45,9 @@ const char *help_str =
 "                       after execution finishes. Can be passed multiple times.\n"
 "    --cycles n       : Maximum number of cycles to run before exiting.\n"
 "    --memsize n      : Memory size in units of 1024 bytes, default is 256 MB\n"
+"                       (for the default machine, not with --config)\n"
+"    --config x.ini   : Machine description: memory map, devices and clocking.\n"
+"                       See rv_machine.h for the format.\n"
 "    --trace          : Print out execution tracing info\n"
 "    --ton-pc pc      : Enable tracing upon reaching address pc\n"
 "                       (can be passed multiple times\n"
@@ -39,7 +55,31 @@ const char *help_str =
 "                       (can be passed multiple times\n"
 "    --ton-pc         : Enable tracing upon reaching address pc\n"
 "    --cpuret         : Testbench's return code is the return code written to\n"
-"                       IO_EXIT by the CPU, or -1 if timed out.\n";
+"                       IO_EXIT by the CPU, or -1 if timed out.\n"
+"    --misaligned     : Perform misaligned loads/stores in hardware, rather than\n"
+"                       raising an alignment exception.\n"
+"    --svade          : Raise page faults for PTE A/D updates, for software to\n"
+"                       handle, rather than updating them in hardware\n"
+"    --sbi [@addr]    : Provide SBI calls in the simulator, and boot directly into\n"
+"                       an S-mode payload at addr (default beginning of RAM)\n"
+"    --bootargs str   : Kernel command line, passed in the device tree\n"
+"    --dtb-addr addr  : Load the generated device tree at addr, rather than the\n"
+"                       top of RAM. Must not overlap any --bin file.\n"
+"    --dtb-out x.dtb  : Also write the generated device tree to a file\n"
+"    --semihosting    : Service semihosting requests (EBREAK between slli/srai\n"
+"                       markers) from M-mode, for host console and file I/O\n"
+"    --code-cache dir : Translate hot code to native code in the background,\n"
+"                       keeping it in dir, and use it in later runs wherever\n"
+"                       the code is unchanged. Needs python3 and a C++\n"
+"                       compiler.\n"
+"    --aot x.so       : Run code translated ahead of time by\n"
+"                       scripts/aot_translate.py, wherever memory still holds\n"
+"                       the code it was translated from\n"
+"    --user x.elf ... : Run a static RV32 Linux executable in U-mode, with system\n"
+"                       calls emulated by the host. RAM starts at address 0, and\n"
+"                       remaining arguments are passed to the program. There is\n"
+"                       no cycle limit unless --cycles is given, and the return\n"
+"                       code is the program's exit code.\n";
 
 void exit_help(const char *errtext) {
 	fputs(errtext, stderr);
@@ -47,21 +87,45 @@ void exit_help(const char *errtext) {
 	exit(-1);
 }
 
+// scripts/aot_translate.py, which is found relative to the executable
+std::string translator_path(const char *argv0) {
+	char exe[4096];
+	ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	std::string path = len > 0 ? std::string(exe, len) : std::string(argv0);
+	size_t slash = path.rfind('/');
+	std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+	return dir + "/scripts/aot_translate.py";
+}
+
 int main(int argc, char **argv) {
 	if (argc < 2)
 		exit_help("");
 
 	std::vector<std::tuple<uint32_t, uint32_t>> dump_ranges;
-	int64_t max_cycles = 100000;
+	int64_t max_cycles = -1;
 	uint32_t ram_size = RAM_SIZE_DEFAULT;
 	std::vector<std::string> bin_paths;
-	std::vector<ux_t> bin_addrs;
+	// Empty for the beginning of main RAM
+	std::vector<std::optional<ux_t>> bin_addrs;
 	bool trace_execution = false;
 	bool trace_on_pc = false;
 	std::vector<ux_t> trace_on_pc_val;
 	bool trace_off_pc = false;
 	std::vector<ux_t> trace_off_pc_val;
 	bool propagate_return_code = false;
+	bool allow_misaligned = false;
+	bool svade = false;
+	bool use_sbi = false;
+	std::optional<ux_t> sbi_entry;
+	bool use_semihosting = false;
+	std::string config_path;
+	std::string bootargs;
+	std::optional<ux_t> dtb_addr_arg;
+	std::string dtb_out_path;
+	std::string code_cache_dir;
+	std::string aot_path;
+	bool linux_user = false;
+	std::vector<std::string> user_argv;
 
 	for (int i = 1; i < argc; ++i) {
 		std::string s(argv[i]);
@@ -74,7 +138,7 @@ int main(int argc, char **argv) {
 				bin_addrs.push_back(std::stoul(&argv[i + 1][1], 0, 0));
 				i += 1;
 			} else {
-				bin_addrs.push_back(RAM_BASE);
+				bin_addrs.push_back(std::nullopt);
 			}
 		} else if (s == "--vcd") {
 			if (argc - i < 2)
@@ -115,49 +179,191 @@ int main(int argc, char **argv) {
 			i += 1;
 		} else if (s == "--cpuret") {
 			propagate_return_code = true;
+		} else if (s == "--misaligned") {
+			allow_misaligned = true;
+		} else if (s == "--svade") {
+			svade = true;
+		} else if (s == "--sbi") {
+			use_sbi = true;
+			if (argc - i >= 2 && argv[i + 1][0] == '@') {
+				sbi_entry = std::stoul(&argv[i + 1][1], 0, 0);
+				i += 1;
+			}
+		} else if (s == "--config") {
+			if (argc - i < 2)
+				exit_help("Option --config requires an argument\n");
+			config_path = argv[i + 1];
+			i += 1;
+		} else if (s == "--bootargs") {
+			if (argc - i < 2)
+				exit_help("Option --bootargs requires an argument\n");
+			bootargs = argv[i + 1];
+			i += 1;
+		} else if (s == "--dtb-addr") {
+			if (argc - i < 2)
+				exit_help("Option --dtb-addr requires an argument\n");
+			dtb_addr_arg = std::stoul(argv[i + 1], 0, 0);
+			i += 1;
+		} else if (s == "--dtb-out") {
+			if (argc - i < 2)
+				exit_help("Option --dtb-out requires an argument\n");
+			dtb_out_path = argv[i + 1];
+			i += 1;
+		} else if (s == "--code-cache") {
+			if (argc - i < 2)
+				exit_help("Option --code-cache requires an argument\n");
+			code_cache_dir = argv[i + 1];
+			i += 1;
+		} else if (s == "--aot") {
+			if (argc - i < 2)
+				exit_help("Option --aot requires an argument\n");
+			aot_path = argv[i + 1];
+			i += 1;
+		} else if (s == "--semihosting") {
+			use_semihosting = true;
+		} else if (s == "--user") {
+			if (argc - i < 2)
+				exit_help("Option --user requires an argument\n");
+			linux_user = true;
+			user_argv.assign(&argv[i + 1], &argv[argc]);
+			break;
 		} else {
 			fprintf(stderr, "Unrecognised argument %s\n", s.c_str());
 			exit_help("");
 		}
 	}
 
-	// Main RAM is handled inside of RVCore, but MMIO (and additional small
-	// memories like boot RAMs) go in the memmap.
-	TBMemIO io;
-	MemMap32 mem;
-	UART8250 uart;
-	MTimer mtimer;
-	mem.add(TBIO_BASE, 12, &io);
-	mem.add(UART8250_BASE, 8, &uart);
-	mem.add(MTIMER_BASE, 16, &mtimer);
+	if (linux_user && (use_sbi || !bin_paths.empty() || !config_path.empty()))
+		exit_help("Option --user can't be combined with --sbi, --bin or --config\n");
+	if (max_cycles < 0)
+		max_cycles = linux_user ? 0 : 100000;
 
-	RVCore core(mem, RAM_BASE, RAM_BASE, ram_size);
+	// Main RAM is handled inside of RVCore, but MMIO (and additional small
+	// memories like boot RAMs) go in the memmap. User-mode programs are
+	// linked to run from low addresses, so RAM starts at 0 in that case.
+	MachineConfig config = machine_config_default(linux_user ? 0 : RAM_BASE, ram_size);
+	if (!config_path.empty()) {
+		std::optional<MachineConfig> loaded = machine_config_load(config_path);
+		if (!loaded)
+			return -1;
+		config = *loaded;
+	}
+	Machine machine(config);
+	RVCore &core = machine.core;
+	core.allow_misaligned = allow_misaligned;
+	if (svade)
+		core.csr.write(CSR_MENVCFGH, ENVCFGH_ADUE, RVCSR::WRITE_CLEAR);
+	const MachineRegion &ram = machine.main_ram();
 
+	// Start and size of each file loaded, so the device tree can avoid them
+	std::vector<std::tuple<ux_t, ux_t>> loaded_ranges;
 	for (size_t i = 0; i < bin_paths.size(); ++i) {
+		ux_t bin_addr = bin_addrs[i].value_or(ram.base);
 		if (trace_execution || trace_on_pc) {
-			printf("Loading file \"%s\" at %08x\n", bin_paths[i].c_str(), bin_addrs[i]);
+			printf("Loading file \"%s\" at %08x\n", bin_paths[i].c_str(), bin_addr);
 		}
 		std::ifstream fd(bin_paths[i], std::ios::binary | std::ios::ate);
 		std::streamsize bin_size = fd.tellg();
-		if (bin_size + bin_addrs[i] - RAM_BASE > ram_size) {
-			fprintf(stderr, "Binary file (%ld bytes) loaded to %08x extends past end of memory (%08x through %08x)\n", bin_size, bin_addrs[i], RAM_BASE, RAM_BASE + ram_size - 1);
+		if (bin_size + bin_addr - ram.base > ram.size) {
+			fprintf(stderr, "Binary file (%ld bytes) loaded to %08x extends past end of memory (%08x through %08x)\n", bin_size, bin_addr, ram.base, ram.base + ram.size - 1);
 			return -1;
-		} else if (bin_addrs[i] < RAM_BASE) {
-			fprintf(stderr, "Binary file load address %08x is less than RAM base address %08x\n", bin_addrs[i], RAM_BASE);
+		} else if (bin_addr < ram.base) {
+			fprintf(stderr, "Binary file load address %08x is less than RAM base address %08x\n", bin_addr, ram.base);
 			return -1;
 		}
 		fd.seekg(0, std::ios::beg);
-		fd.read((char*)&core.ram[(bin_addrs[i] - RAM_BASE) >> 2], bin_size);
+		fd.read((char*)&core.ram[(bin_addr - ram.base) >> 2], bin_size);
+		loaded_ranges.push_back({bin_addr, bin_size});
 	}
 
+	// The device tree goes at the top of RAM unless --dtb-addr is given, and
+	// its address is passed to firmware in a1 (with the hart ID in a0) as on
+	// real platforms.
+	if (!linux_user) {
+		FDTMachine fdt_machine = machine.fdt_description();
+		fdt_machine.bootargs = bootargs;
+		fdt_machine.svade = svade;
+		std::vector<uint8_t> dtb = fdt_build_machine(fdt_machine);
+		if (dtb.size() > ram.size) {
+			fprintf(stderr, "Device tree (%zu bytes) does not fit in RAM\n", dtb.size());
+			return -1;
+		}
+		ux_t dtb_addr = dtb_addr_arg.value_or((ram.base + ram.size - dtb.size()) & -8u);
+		if (dtb_addr < ram.base || dtb_addr - ram.base > ram.size - dtb.size() || dtb_addr & 0x7u) {
+			fprintf(stderr, "Device tree (%zu bytes) at %08x is misaligned or not in RAM (%08x through %08x)\n",
+				dtb.size(), dtb_addr, ram.base, ram.base + ram.size - 1);
+			return -1;
+		}
+		for (auto [addr, size] : loaded_ranges) {
+			if ((uint64_t)dtb_addr < (uint64_t)addr + size && (uint64_t)addr < (uint64_t)dtb_addr + dtb.size()) {
+				fprintf(stderr, "Device tree (%zu bytes) at %08x overlaps binary file loaded at %08x "
+					"(%u bytes). Use --dtb-addr to place it elsewhere.\n", dtb.size(), dtb_addr, addr, size);
+				return -1;
+			}
+		}
+		memcpy((uint8_t*)core.ram + (dtb_addr - ram.base), dtb.data(), dtb.size());
+		core.regs[10] = 0;
+		core.regs[11] = dtb_addr;
+		if (!dtb_out_path.empty()) {
+			std::ofstream fd(dtb_out_path, std::ios::binary);
+			fd.write((const char*)dtb.data(), dtb.size());
+		}
+	}
+
+	SBI sbi;
+	if (use_sbi) {
+		core.ecall_handler = &sbi;
+		sbi.boot(core, sbi_entry.value_or(ram.base), core.regs[11]);
+	}
+	Semihosting semihosting;
+	if (use_semihosting) {
+		core.ebreak_handler = &semihosting;
+	}
+	LinuxUser user;
+	if (linux_user) {
+		std::vector<std::string> envp;
+		for (char **env = environ; *env; ++env)
+			envp.push_back(*env);
+		if (!user.load(core, user_argv[0], user_argv, envp))
+			return -1;
+		core.ecall_handler = &user;
+		propagate_return_code = true;
+	}
+
+	core.code_cache.persist_dir = code_cache_dir;
+	if (!code_cache_dir.empty())
+		core.code_cache.translator = translator_path(argv[0]);
+	if (!aot_path.empty() && !core.code_cache.load_aot(aot_path, (const uint8_t*)core.ram, core.ram_base))
+		return -1;
+
 	int64_t cyc;
+	uint retired = 0;
 	int rc = 0;
 	try {
-		for (cyc = 0; cyc < max_cycles || max_cycles == 0; ++cyc) {
-			core.step(trace_execution);
-			if (!(cyc & 0xfff)) {
-				mtimer.step_time();
-				core.csr.set_irq_t(mtimer.irq_status(0));
+		for (cyc = 0; cyc < max_cycles || max_cycles == 0; cyc += retired) {
+			// Instructions run in batches which end on an mtime tick, unless
+			// each pc has to be checked for tracing
+			retired = 0;
+			if (trace_execution || trace_on_pc) {
+				core.step(trace_execution);
+				retired = 1;
+			} else {
+				int64_t batch = ((cyc + config.mtime_div - 1) & -(int64_t)config.mtime_div) - cyc + 1;
+				if (max_cycles != 0)
+					batch = std::min(batch, max_cycles - cyc);
+				core.run(batch, retired);
+			}
+			if (linux_user && core.csr.get_true_priv() != PRV_U) {
+				// There's no kernel to handle exceptions other than syscalls
+				fprintf(stderr, "Unhandled trap: mcause %08x, mepc %08x, mtval %08x\n",
+					*core.csr.read(CSR_MCAUSE), *core.csr.read(CSR_MEPC), *core.csr.read(CSR_MTVAL));
+				rc = -1;
+				break;
+			}
+			if (!((cyc + retired - 1) & (config.mtime_div - 1)) && machine.mtimer) {
+				machine.mtimer->step_time();
+				core.csr.set_time(machine.mtimer->mtime);
+				core.csr.set_irq_t(machine.mtimer->irq_status(0));
 			}
 			if (!trace_execution && trace_on_pc) {
 				for (ux_t addr : trace_on_pc_val) {
@@ -176,19 +382,24 @@ int main(int argc, char **argv) {
 				}
 			}
 		}
-		if (cyc == max_cycles) {
+		if (max_cycles != 0 && cyc == max_cycles) {
 			printf("Timed out.\n");
 			if (propagate_return_code)
 				rc = -1;
 		}
 	}
 	catch (TBExitException e) {
-		printf("CPU requested halt. Exit code %d\n", e.exitcode);
-		printf("Ran for %ld cycles\n", cyc + 1);
+		if (!linux_user) {
+			printf("CPU requested halt. Exit code %d\n", e.exitcode);
+			printf("Ran for %ld cycles\n", cyc + retired + 1);
+		}
 		if (propagate_return_code)
 			rc = e.exitcode;
 	}
 
+	if (!code_cache_dir.empty())
+		core.code_cache.save((const uint8_t*)core.ram, core.ram_base);
+
 	for (auto [start, end] : dump_ranges) {
 		printf("Dumping memory from %08x to %08x:\n", start, end);
 		for (uint32_t i = 0; i < end - start; ++i)
@@ -0,0 +1,69 @@
+#include "rv_code_cache.h"
+#include "encoding/rv_decode.h"
+
+#include <cstdio>
+#include <dlfcn.h>
+
+const AOTImage *CodeCache::open_aot(const std::string &path, std::string &error) {
+	// The library stays loaded until exit, as pages point into it. A name
+	// without a slash is taken as a file, not searched for.
+	std::string file = path.find('/') == std::string::npos ? "./" + path : path;
+	void *lib = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		error = dlerror();
+		return nullptr;
+	}
+	const AOTImage *image = (const AOTImage*)dlsym(lib, RV_AOT_IMAGE_SYMBOL);
+	if (!image) {
+		error = "\"" + path + "\" is not translated code";
+		return nullptr;
+	}
+	if (image->abi_version != RV_AOT_ABI_VERSION || image->decode_version != RV_DECODE_VERSION) {
+		error = "\"" + path + "\" was translated for a different version of rvcpp";
+		return nullptr;
+	}
+	return image;
+}
+
+bool CodeCache::load_aot(const std::string &path, const uint8_t *ram, ux_t ram_base) {
+	std::string error;
+	const AOTImage *image = open_aot(path, error);
+	if (!image) {
+		fprintf(stderr, "Can't load translated code: %s\n", error.c_str());
+		return false;
+	}
+	add_aot(image, ram, ram_base);
+	return true;
+}
+
+void CodeCache::add_aot(const AOTImage *image, const uint8_t *ram, ux_t ram_base) {
+	for (uint i = 0; i < image->n_blocks; ++i) {
+		const AOTBlock *b = &image->blocks[i];
+		ux_t index = (b->paddr >> 12) - base_ppn;
+		// Blocks outside of RAM can never be executed from the fast path
+		if (b->paddr >> 12 < base_ppn || index >= pages.size() || b->size == 0 ||
+				(b->paddr & 0xfffu) + b->size > 0x1000 || b->paddr & 0x1u) {
+			continue;
+		}
+		aot_blocks[index].push_back(b);
+		if (pages[index]) {
+			attach_aot(index, ram + (((base_ppn + index) << 12) - ram_base), &b, 1);
+		}
+	}
+}
+
+void CodeCache::attach_aot(ux_t index, const uint8_t *host, const AOTBlock *const *blocks, size_t n) {
+	CodePage &p = *pages[index];
+	for (size_t i = 0; i < n; ++i) {
+		const AOTBlock *b = blocks[i];
+		ux_t offset = b->paddr & 0xfffu;
+		if (memcmp(host + offset, b->code, b->size)) {
+			continue;
+		}
+		if (!p.aot) {
+			p.aot.reset(new AOTPage());
+		}
+		p.aot->blocks[offset >> 1] = b;
+		p.aot->attached.push_back(b);
+	}
+}
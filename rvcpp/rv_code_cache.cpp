@@ -0,0 +1,187 @@
+#include "rv_code_cache.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static uint64_t page_hash(const uint8_t *page) {
+	// FNV-1a
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (uint i = 0; i < 0x1000; ++i)
+		h = (h ^ page[i]) * 0x100000001b3ull;
+	return h;
+}
+
+std::string CodeCache::page_path(uint64_t hash) const {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.so", (unsigned long long)hash);
+	return persist_dir + name;
+}
+
+void CodeCache::request_load(ux_t index, const uint8_t *host) {
+	LoadRequest req;
+	req.index = index;
+	req.translate = false;
+	req.contents.reset(new uint8_t[0x1000]);
+	memcpy(req.contents.get(), host, 0x1000);
+	req.hash = 0;
+	queue_request(std::move(req));
+}
+
+// The page is translated as it is now, but under the hash it had when first
+// executed from, which is what a later run will look for
+void CodeCache::request_translate(ux_t index, const uint8_t *host) {
+	CodePage &p = *pages[index];
+	p.translated = true;
+	LoadRequest req;
+	req.index = index;
+	req.translate = true;
+	req.contents.reset(new uint8_t[0x1000]);
+	memcpy(req.contents.get(), host, 0x1000);
+	req.hash = p.hash;
+	req.entries = p.hot_offsets;
+	queue_request(std::move(req));
+}
+
+void CodeCache::queue_request(LoadRequest &&req) {
+	req.image = nullptr;
+	req.failed = false;
+	{
+		std::lock_guard<std::mutex> lock(load_mutex);
+		load_queue.push_back(std::move(req));
+		++loads_pending;
+	}
+	if (!loader.joinable()) {
+		loader = std::thread(&CodeCache::loader_main, this);
+	}
+	load_cv.notify_all();
+}
+
+void CodeCache::loader_main() {
+	std::unique_lock<std::mutex> lock(load_mutex);
+	while (true) {
+		load_cv.wait(lock, [this] {return loader_stop || !load_queue.empty();});
+		if (loader_stop) {
+			return;
+		}
+		LoadRequest req = std::move(load_queue.front());
+		load_queue.pop_front();
+		lock.unlock();
+		std::string error;
+		if (req.translate) {
+			req.failed = !translate(req);
+			if (!req.failed) {
+				req.image = open_aot(page_path(req.hash), error);
+				if (!req.image) {
+					fprintf(stderr, "Can't load translated code: %s\n", error.c_str());
+				}
+			}
+		} else {
+			// A translation which can't be loaded (e.g. from another version
+			// of rvcpp) is replaced once the page is hot
+			req.hash = page_hash(req.contents.get());
+			std::string path = page_path(req.hash);
+			if (access(path.c_str(), F_OK) == 0) {
+				req.image = open_aot(path, error);
+			}
+		}
+		lock.lock();
+		load_done.push_back(std::move(req));
+		loads_ready = true;
+		--loads_pending;
+		load_cv.notify_all();
+	}
+}
+
+void CodeCache::merge_loaded(const uint8_t *ram, ux_t ram_base) {
+	std::vector<LoadRequest> done;
+	{
+		std::lock_guard<std::mutex> lock(load_mutex);
+		done.swap(load_done);
+		loads_ready = false;
+	}
+	for (LoadRequest &req : done) {
+		if (!req.translate && pages[req.index]) {
+			pages[req.index]->hash = req.hash;
+			pages[req.index]->looked_up = true;
+			pages[req.index]->translated = req.image;
+		}
+		translate_failed = translate_failed || req.failed;
+		// Blocks are checked against memory as they are attached, so it
+		// doesn't matter if the page has changed since the request
+		if (req.image) {
+			add_aot(req.image, ram, ram_base);
+		}
+	}
+}
+
+// Run the translator on a copy of a page, with the offsets run() returned at
+// as entry points. Called on the worker.
+bool CodeCache::translate(const LoadRequest &req) const {
+	std::string path = page_path(req.hash);
+	// Everything is written under temporary names, and the translation
+	// renamed into place, so that runs sharing the directory never see a
+	// partial file
+	std::string tmp_path = path + "." + std::to_string(getpid());
+	std::string bin_path = tmp_path + ".bin";
+	FILE *f = fopen(bin_path.c_str(), "wb");
+	bool ok = f && fwrite(req.contents.get(), 0x1000, 1, f) == 1;
+	if (f) {
+		ok = fclose(f) == 0 && ok;
+	}
+
+	ux_t page_base = (base_ppn + req.index) << 12;
+	char base[16];
+	snprintf(base, sizeof(base), "0x%08x", page_base);
+	std::vector<std::string> args = {"python3", translator, bin_path, tmp_path, "--base", base};
+	for (uint16_t offset : req.entries) {
+		char entry[16];
+		snprintf(entry, sizeof(entry), "0x%08x", page_base + offset);
+		args.push_back("--entry");
+		args.push_back(entry);
+	}
+	std::vector<char*> argv;
+	for (std::string &a : args)
+		argv.push_back(a.data());
+	argv.push_back(nullptr);
+
+	// The translator's report goes nowhere, but its errors are passed on
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	pid_t pid;
+	int status;
+	ok = ok && posix_spawnp(&pid, "python3", &actions, nullptr, argv.data(), environ) == 0 &&
+		waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	posix_spawn_file_actions_destroy(&actions);
+
+	remove(bin_path.c_str());
+	if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Can't translate code to \"%s\"\n", path.c_str());
+		remove(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool CodeCache::save(const uint8_t *ram, ux_t ram_base) {
+	auto wait_idle = [this] {
+		std::unique_lock<std::mutex> lock(load_mutex);
+		load_cv.wait(lock, [this] {return loads_pending == 0;});
+	};
+	// Pages may have become hot before their lookup finished
+	wait_idle();
+	merge_loaded(ram, ram_base);
+	for (ux_t i = 0; i < pages.size(); ++i) {
+		if (pages[i] && pages[i]->looked_up && !pages[i]->translated && pages[i]->samples >= HOT_SAMPLES) {
+			request_translate(i, ram + (((base_ppn + i) << 12) - ram_base));
+		}
+	}
+	wait_idle();
+	merge_loaded(ram, ram_base);
+	return !translate_failed;
+}
@@ -1,88 +1,230 @@
 #include "rv_core.h"
+#include "rv_fpu.h"
 #include "rv_types.h"
 #include "rv_mem.h"
+#include "rv_ops.h"
 #include "encoding/rv_opcodes.h"
+#include "encoding/rv_decode.h"
 
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 
-// Use unsigned arithmetic everywhere, with explicit sign extension as required.
-static inline ux_t sext(ux_t bits, int sign_bit) {
-	if (sign_bit >= XLEN - 1)
-		return bits;
-	else
-		return (bits & ((1u << (sign_bit + 1)) - 1)) - ((bits & 1u << sign_bit) << 1);
-}
-
-static inline ux_t imm_i(uint32_t instr) {
-	return (instr >> 20) - (instr >> 19 & 0x1000);
-}
-
-static inline ux_t imm_s(uint32_t instr) {
-	return (instr >> 20 & 0xfe0u)
-		+ (instr >> 7 & 0x1fu)
-		- (instr >> 19 & 0x1000u);
-}
-
-static inline ux_t imm_u(uint32_t instr) {
-	return instr & 0xfffff000u;
-}
-
-static inline ux_t imm_b(uint32_t instr) {
-	return (instr >> 7 & 0x1e)
-		+ (instr >> 20 & 0x7e0)
-		+ (instr << 4 & 0x800)
-		- (instr >> 19 & 0x1000);
-}
-
-static inline ux_t imm_j(uint32_t instr) {
-	 return (instr >> 20 & 0x7fe)
-	 	+ (instr >> 9 & 0x800)
-	 	+ (instr & 0xff000)
-	 	- (instr >> 11 & 0x100000);
-}
-
-static inline ux_t imm_ci(uint32_t instr) {
-	return GETBITS(instr, 6, 2) - (GETBIT(instr, 12) << 5);
-}
-
-static inline ux_t imm_cj(uint32_t instr) {
-	return -(GETBIT(instr, 12) << 11)
-		+ (GETBIT(instr, 11) << 4)
-		+ (GETBITS(instr, 10, 9) << 8)
-		+ (GETBIT(instr, 8) << 10)
-		+ (GETBIT(instr, 7) << 6)
-		+ (GETBIT(instr, 6) << 7)
-		+ (GETBITS(instr, 5, 3) << 1)
-		+ (GETBIT(instr, 2) << 5);
-}
-
-static inline ux_t imm_cb(uint32_t instr) {
-	return -(GETBIT(instr, 12) << 8)
-		+ (GETBITS(instr, 11, 10) << 3)
-		+ (GETBITS(instr, 6, 5) << 6)
-		+ (GETBITS(instr, 4, 3) << 1)
-		+ (GETBIT(instr, 2) << 5);
+std::optional<uint> RVCore::load(ux_t vaddr, uint size, uint64_t &data, ux_t &fault_addr) {
+	fault_addr = vaddr;
+	if (!(vaddr & (size - 1))) {
+		// Naturally aligned, so can't cross a page
+		uint8_t *host;
+		std::optional<ux_t> paddr = vmap_ls(vaddr, PTE_R, &host);
+		if (!paddr) {
+			return XCAUSE_LOAD_PAGEFAULT;
+		}
+		if (!pmp_permits_ls(*paddr, size, PMP_R)) {
+			return XCAUSE_LOAD_FAULT;
+		}
+		if (host) {
+			data = 0;
+			memcpy(&data, host, size);
+			return std::nullopt;
+		}
+		std::optional<uint32_t> lo;
+		std::optional<uint32_t> hi = 0;
+		switch (size) {
+			case 1:  lo = r8(*paddr);                         break;
+			case 2:  lo = r16(*paddr);                        break;
+			case 4:  lo = r32(*paddr);                        break;
+			default: lo = r32(*paddr); hi = r32(*paddr + 4);  break;
+		}
+		if (!(lo && hi)) {
+			return XCAUSE_LOAD_FAULT;
+		}
+		data = (uint64_t)*hi << 32 | *lo;
+		return std::nullopt;
+	}
+	if (!allow_misaligned) {
+		return XCAUSE_LOAD_ALIGN;
+	}
+	// Misaligned: translate both pages (if the access crosses a page) before
+	// accessing anything, then access a byte at a time. xtval points to the
+	// part of the access which failed translation.
+	std::optional<ux_t> paddr[2];
+	ux_t page_split = std::min<ux_t>(size, 0x1000u - (vaddr & 0xfffu));
+	paddr[0] = vmap_ls(vaddr, PTE_R);
+	if (!paddr[0]) {
+		return XCAUSE_LOAD_PAGEFAULT;
+	}
+	paddr[1] = page_split < size ? vmap_ls(vaddr + page_split, PTE_R) : *paddr[0] + page_split;
+	if (!paddr[1]) {
+		fault_addr = vaddr + page_split;
+		return XCAUSE_LOAD_PAGEFAULT;
+	}
+	if (!pmp_permits_ls(*paddr[0], page_split, PMP_R)) {
+		return XCAUSE_LOAD_FAULT;
+	}
+	if (page_split < size && !pmp_permits_ls(*paddr[1], size - page_split, PMP_R)) {
+		fault_addr = vaddr + page_split;
+		return XCAUSE_LOAD_FAULT;
+	}
+	data = 0;
+	for (uint i = 0; i < size; ++i) {
+		std::optional<uint8_t> rdata = i < page_split ? r8(*paddr[0] + i) : r8(*paddr[1] + (i - page_split));
+		if (!rdata) {
+			return XCAUSE_LOAD_FAULT;
+		}
+		data |= (uint64_t)*rdata << 8 * i;
+	}
+	return std::nullopt;
 }
 
-static inline uint c_rs1_s(uint32_t instr) {
-	return GETBITS(instr, 9, 7) + 8;
+std::optional<uint> RVCore::store(ux_t vaddr, uint size, uint64_t data, ux_t &fault_addr) {
+	fault_addr = vaddr;
+	if (!(vaddr & (size - 1))) {
+		uint8_t *host;
+		std::optional<ux_t> paddr = vmap_ls(vaddr, PTE_W, &host);
+		if (!paddr) {
+			return XCAUSE_STORE_PAGEFAULT;
+		}
+		if (!pmp_permits_ls(*paddr, size, PMP_W)) {
+			return XCAUSE_STORE_FAULT;
+		}
+		if (host) {
+			memcpy(host, &data, size);
+			code_cache.write(*paddr, size);
+			return std::nullopt;
+		}
+		bool ok;
+		switch (size) {
+			case 1:  ok = w8(*paddr, data & 0xffu);                                    break;
+			case 2:  ok = w16(*paddr, data & 0xffffu);                                 break;
+			case 4:  ok = w32(*paddr, data & 0xffffffffu);                             break;
+			default: ok = w32(*paddr, data & 0xffffffffu) && w32(*paddr + 4, data >> 32); break;
+		}
+		return ok ? std::nullopt : std::optional<uint>(XCAUSE_STORE_FAULT);
+	}
+	if (!allow_misaligned) {
+		return XCAUSE_STORE_ALIGN;
+	}
+	// As for loads, both pages are translated before any data is written, so
+	// a page fault on the second page leaves memory untouched.
+	std::optional<ux_t> paddr[2];
+	ux_t page_split = std::min<ux_t>(size, 0x1000u - (vaddr & 0xfffu));
+	paddr[0] = vmap_ls(vaddr, PTE_W);
+	if (!paddr[0]) {
+		return XCAUSE_STORE_PAGEFAULT;
+	}
+	paddr[1] = page_split < size ? vmap_ls(vaddr + page_split, PTE_W) : *paddr[0] + page_split;
+	if (!paddr[1]) {
+		fault_addr = vaddr + page_split;
+		return XCAUSE_STORE_PAGEFAULT;
+	}
+	if (!pmp_permits_ls(*paddr[0], page_split, PMP_W)) {
+		return XCAUSE_STORE_FAULT;
+	}
+	if (page_split < size && !pmp_permits_ls(*paddr[1], size - page_split, PMP_W)) {
+		fault_addr = vaddr + page_split;
+		return XCAUSE_STORE_FAULT;
+	}
+	for (uint i = 0; i < size; ++i) {
+		uint8_t wdata = data >> 8 * i;
+		bool ok = i < page_split ? w8(*paddr[0] + i, wdata) : w8(*paddr[1] + (i - page_split), wdata);
+		if (!ok) {
+			return XCAUSE_STORE_FAULT;
+		}
+	}
+	return std::nullopt;
 }
 
-static inline uint c_rs2_s(uint32_t instr) {
-	return GETBITS(instr, 4, 2) + 8;
+std::optional<uint> RVCore::load_fp(ux_t vaddr, uint size, uint64_t &data, ux_t &fault_addr) {
+	std::optional<uint> cause = load(vaddr, size, data, fault_addr);
+	if (!cause && size == 4) {
+		data = fpu_nan_box(data);
+	}
+	return cause;
 }
 
-static inline uint c_rs1_l(uint32_t instr) {
-	return GETBITS(instr, 11, 7);
+std::optional<uint> RVCore::cache_block_op(ux_t vaddr, uint op) {
+	// Blocks are naturally aligned, so never cross a page. cbo.zero needs
+	// write permission. The others are permitted wherever a load or a store
+	// would be: a leaf PTE with W but not R is reserved (and must fault), so
+	// checking R covers both, and doesn't set D. All CBO faults are reported
+	// as store faults.
+	ux_t block_vaddr = vaddr & -(ux_t)CBO_BLOCK_SIZE;
+	std::optional<ux_t> paddr = vmap_ls(block_vaddr, op == CBO_ZERO ? PTE_W : PTE_R);
+	if (!paddr) {
+		return XCAUSE_STORE_PAGEFAULT;
+	}
+	bool pmp_ok = op == CBO_ZERO ? pmp_permits_ls(*paddr, CBO_BLOCK_SIZE, PMP_W) :
+		pmp_permits_ls(*paddr, CBO_BLOCK_SIZE, PMP_R) || pmp_permits_ls(*paddr, CBO_BLOCK_SIZE, PMP_W);
+	if (!pmp_ok) {
+		return XCAUSE_STORE_FAULT;
+	}
+	bool in_ram = *paddr >= ram_base && *paddr < ram_top;
+	if (op == CBO_ZERO && in_ram) {
+		memset(&ram[(*paddr - ram_base) >> 2], 0, CBO_BLOCK_SIZE);
+		code_cache.write(*paddr, CBO_BLOCK_SIZE);
+	} else if (op == CBO_ZERO) {
+		for (ux_t offset = 0; offset < CBO_BLOCK_SIZE; offset += 4) {
+			if (!mem.w32(*paddr + offset, 0)) {
+				return XCAUSE_STORE_FAULT;
+			}
+		}
+	} else if (!in_ram && !mem.cache_block_op(*paddr, op)) {
+		return XCAUSE_STORE_FAULT;
+	}
+	return std::nullopt;
 }
 
-static inline uint c_rs2_l(uint32_t instr) {
-	return GETBITS(instr, 6, 2);
+TLBEntry *RVCore::vmap_sv32_walk(ux_t vaddr, ux_t atp, ux_t required_permissions) {
+	// First translation stage: vaddr bits 31:22. Skipped if the pointer to
+	// the second-level table is cached.
+	ux_t addr_of_pte1 = atp + ((vaddr >> 20) & 0xffcu);
+	ux_t &cached_pte1 = tlb.table_ptes[vaddr >> 22];
+	std::optional<ux_t> pte1 = cached_pte1 ? cached_pte1 : pte_read(addr_of_pte1);
+	if (!(pte1 && *pte1 & PTE_V))
+		return nullptr;
+	if (PTE_TABLE(*pte1))
+		cached_pte1 = *pte1;
+	ux_t addr_of_leaf = addr_of_pte1;
+	std::optional<ux_t> leaf = pte1;
+	bool megapage = *pte1 & (PTE_X | PTE_W | PTE_R);
+	if (megapage) {
+		// First-level leaf PTEs must have lower PPN bits cleared, so that
+		// they cover a 4 MiB-aligned range.
+		if (*pte1 & 0x000ffc00u)
+			return nullptr;
+	} else {
+		// Second translation stage: vaddr bits 21:12
+		addr_of_leaf = ((*pte1 << 2) & 0xfffff000u) | ((vaddr >> 10) & 0xffcu);
+		leaf = pte_read(addr_of_leaf);
+		// Must be a valid leaf PTE.
+		if (!(leaf && (*leaf & PTE_V) && (*leaf & (PTE_X | PTE_W | PTE_R))))
+			return nullptr;
+	}
+	// Permission check before touching A/D bits
+	if (!csr.pte_permissions_ok(*leaf, required_permissions))
+		return nullptr;
+	// PTE looks good, so update A/D bits (or fault, for Svade) before
+	// filling the TLB
+	ux_t leaf_a_d_update = *leaf | PTE_A | (required_permissions & PTE_W ? PTE_D : 0);
+	if (leaf_a_d_update != *leaf) {
+		if (!csr.pte_ad_update_enabled() || !pte_write(addr_of_leaf, leaf_a_d_update)) {
+			return nullptr;
+		}
+	}
+	TLBEntry &e = megapage ? tlb.megapage_entry(vaddr) : tlb.page_entry(vaddr);
+	e.vpn = megapage ? vaddr >> 22 : vaddr >> 12;
+	e.pte = leaf_a_d_update;
+	e.pte_addr = addr_of_leaf;
+	e.pte_host = (ux_t*)ram_host_ptr(addr_of_leaf, 4);
+	e.offset_mask = megapage ? 0x003fffffu : 0xfffu;
+	e.pbase = (leaf_a_d_update << 2) & ~e.offset_mask;
+	e.host = ram_host_ptr(e.pbase, e.offset_mask + 1);
+	return &e;
 }
 
 void RVCore::step(bool trace) {
 	std::optional<ux_t> rd_wdata;
+	std::optional<uint64_t> frd_wdata;
 	std::optional<ux_t> pc_wdata;
 	std::optional<uint> exception_cause;
 	std::optional<ux_t> xtval_wdata;
@@ -93,12 +235,16 @@ void RVCore::step(bool trace) {
 	std::optional<uint> trace_priv;
 
 	std::optional<uint16_t> fetch0, fetch1;
+	// A fetch which fails PMP is treated like a bus error
 	std::optional<ux_t> fetch_paddr0 = vmap_fetch(pc);
-	if (fetch_paddr0) {
+	if (fetch_paddr0 && csr.pmp_permits(*fetch_paddr0, 2, PMP_X, csr.get_true_priv())) {
 		fetch0 = r16(*fetch_paddr0);
 	}
-	std::optional<ux_t> fetch_paddr1 = vmap_fetch(pc + 2);
-	if (fetch_paddr1) {
+	// The second halfword only needs its own translation if it is on the
+	// next page
+	std::optional<ux_t> fetch_paddr1 = (pc & 0xfffu) != 0xffeu && fetch_paddr0 ?
+		std::optional<ux_t>(*fetch_paddr0 + 2) : vmap_fetch(pc + 2);
+	if (fetch_paddr1 && csr.pmp_permits(*fetch_paddr1, 2, PMP_X, csr.get_true_priv())) {
 		fetch1 = r16(*fetch_paddr1);
 	}
 	uint32_t instr = *fetch0 | (*fetch1 << 16);
@@ -110,7 +256,7 @@ void RVCore::step(bool trace) {
 		xtval_wdata = fetch_paddr0 ? pc + 2 : pc;
 	} else if (!fetch0 || ((*fetch0 & 0x3) == 0x3 && !fetch1)) {
 		exception_cause = XCAUSE_INSTR_FAULT;
-		xtval_wdata = *fetch0 ? pc + 2 : pc;
+		xtval_wdata = fetch0 ? pc + 2 : pc;
 	} else if ((instr & 0x3) == 0x3) {
 		// 32-bit instruction
 		uint opc        = instr >> 2 & 0x1f;
@@ -149,6 +295,12 @@ void RVCore::step(bool trace) {
 					rd_wdata = rs1 - rs2;
 				else if (funct3 == 0b101)
 					rd_wdata = (sx_t)rs1 >> (rs2 & 0x1f);
+				else if (funct3 == 0b100)
+					rd_wdata = ~(rs1 ^ rs2);
+				else if (funct3 == 0b110)
+					rd_wdata = rs1 | ~rs2;
+				else if (funct3 == 0b111)
+					rd_wdata = rs1 & ~rs2;
 				else
 					exception_cause = XCAUSE_INSTR_ILLEGAL;
 			}
@@ -191,6 +343,37 @@ void RVCore::step(bool trace) {
 					}
 				}
 			}
+			// Zba
+			else if (RVOPC_MATCH(instr, SH1ADD))
+				rd_wdata = (rs1 << 1) + rs2;
+			else if (RVOPC_MATCH(instr, SH2ADD))
+				rd_wdata = (rs1 << 2) + rs2;
+			else if (RVOPC_MATCH(instr, SH3ADD))
+				rd_wdata = (rs1 << 3) + rs2;
+			// Zbb
+			else if (RVOPC_MATCH(instr, MAX))
+				rd_wdata = (sx_t)rs1 > (sx_t)rs2 ? rs1 : rs2;
+			else if (RVOPC_MATCH(instr, MAXU))
+				rd_wdata = rs1 > rs2 ? rs1 : rs2;
+			else if (RVOPC_MATCH(instr, MIN))
+				rd_wdata = (sx_t)rs1 < (sx_t)rs2 ? rs1 : rs2;
+			else if (RVOPC_MATCH(instr, MINU))
+				rd_wdata = rs1 < rs2 ? rs1 : rs2;
+			else if (RVOPC_MATCH(instr, ROL))
+				rd_wdata = rotl(rs1, rs2);
+			else if (RVOPC_MATCH(instr, ROR))
+				rd_wdata = rotr(rs1, rs2);
+			else if (RVOPC_MATCH(instr, ZEXT_H))
+				rd_wdata = rs1 & 0xffffu;
+			// Zbs
+			else if (RVOPC_MATCH(instr, BCLR))
+				rd_wdata = rs1 & ~(1u << (rs2 & 0x1f));
+			else if (RVOPC_MATCH(instr, BEXT))
+				rd_wdata = (rs1 >> (rs2 & 0x1f)) & 1u;
+			else if (RVOPC_MATCH(instr, BINV))
+				rd_wdata = rs1 ^ (1u << (rs2 & 0x1f));
+			else if (RVOPC_MATCH(instr, BSET))
+				rd_wdata = rs1 | (1u << (rs2 & 0x1f));
 			else {
 				exception_cause = XCAUSE_INSTR_ILLEGAL;
 			}
@@ -222,6 +405,44 @@ void RVCore::step(bool trace) {
 				else if (funct7 == 0b01'00000 && funct3 == 0b101) {
 					rd_wdata = (sx_t)rs1 >> regnum_rs2;
 				}
+				// Zbb
+				else if (RVOPC_MATCH(instr, CLZ)) {
+					rd_wdata = rs1 ? __builtin_clz(rs1) : XLEN;
+				}
+				else if (RVOPC_MATCH(instr, CTZ)) {
+					rd_wdata = rs1 ? __builtin_ctz(rs1) : XLEN;
+				}
+				else if (RVOPC_MATCH(instr, CPOP)) {
+					rd_wdata = __builtin_popcount(rs1);
+				}
+				else if (RVOPC_MATCH(instr, SEXT_B)) {
+					rd_wdata = sext(rs1, 7);
+				}
+				else if (RVOPC_MATCH(instr, SEXT_H)) {
+					rd_wdata = sext(rs1, 15);
+				}
+				else if (RVOPC_MATCH(instr, RORI)) {
+					rd_wdata = rotr(rs1, regnum_rs2);
+				}
+				else if (RVOPC_MATCH(instr, ORC_B)) {
+					rd_wdata = orc_b(rs1);
+				}
+				else if (RVOPC_MATCH(instr, REV8)) {
+					rd_wdata = __builtin_bswap32(rs1);
+				}
+				// Zbs
+				else if (RVOPC_MATCH(instr, BCLRI)) {
+					rd_wdata = rs1 & ~(1u << regnum_rs2);
+				}
+				else if (RVOPC_MATCH(instr, BEXTI)) {
+					rd_wdata = (rs1 >> regnum_rs2) & 1u;
+				}
+				else if (RVOPC_MATCH(instr, BINVI)) {
+					rd_wdata = rs1 ^ (1u << regnum_rs2);
+				}
+				else if (RVOPC_MATCH(instr, BSETI)) {
+					rd_wdata = rs1 | (1u << regnum_rs2);
+				}
 				else {
 					exception_cause = XCAUSE_INSTR_ILLEGAL;
 				}
@@ -252,49 +473,20 @@ void RVCore::step(bool trace) {
 
 		case OPC_LOAD: {
 			ux_t load_addr_v = rs1 + imm_i(instr);
-			ux_t align_mask = ~(-1u << (funct3 & 0x3));
-			bool misalign = load_addr_v & align_mask;
+			uint64_t load_data;
+			ux_t fault_addr;
 			if (funct3 == 0b011 || funct3 > 0b101) {
 				exception_cause = XCAUSE_INSTR_ILLEGAL;
-			} else if (misalign) {
-				exception_cause = XCAUSE_LOAD_ALIGN;
-				xtval_wdata = load_addr_v;
 			} else {
-				std::optional<ux_t> load_addr_p = vmap_ls(load_addr_v, PTE_R);
-				if (!load_addr_p) {
-					exception_cause = XCAUSE_LOAD_PAGEFAULT;
+				exception_cause = load(load_addr_v, 1u << (funct3 & 0x3), load_data, fault_addr);
+				if (exception_cause) {
+					xtval_wdata = fault_addr;
 				} else if (funct3 == 0b000) {
-					rd_wdata = r8(*load_addr_p);
-					if (rd_wdata) {
-						rd_wdata = sext(*rd_wdata, 7);
-					} else {
-						exception_cause = XCAUSE_LOAD_FAULT;
-					}
+					rd_wdata = sext(load_data, 7);
 				} else if (funct3 == 0b001) {
-					rd_wdata = r16(*load_addr_p);
-					if (rd_wdata) {
-						rd_wdata = sext(*rd_wdata, 15);
-					} else {
-						exception_cause = XCAUSE_LOAD_FAULT;
-					}
-				} else if (funct3 == 0b010) {
-					rd_wdata = r32(*load_addr_p);
-					if (!rd_wdata) {
-						exception_cause = XCAUSE_LOAD_FAULT;
-					}
-				} else if (funct3 == 0b100) {
-					rd_wdata = r8(*load_addr_p);
-					if (!rd_wdata) {
-						exception_cause = XCAUSE_LOAD_FAULT;
-					}
-				} else if (funct3 == 0b101) {
-					rd_wdata = r16(*load_addr_p);
-					if (!rd_wdata) {
-						exception_cause = XCAUSE_LOAD_FAULT;
-					}
-				}
-				if (exception_cause) {
-					xtval_wdata = load_addr_v;
+					rd_wdata = sext(load_data, 15);
+				} else {
+					rd_wdata = load_data;
 				}
 			}
 			break;
@@ -302,37 +494,83 @@ void RVCore::step(bool trace) {
 
 		case OPC_STORE: {
 			ux_t store_addr_v = rs1 + imm_s(instr);
-			ux_t align_mask = ~(-1u << (funct3 & 0x3));
-			bool misalign = store_addr_v & align_mask;
+			ux_t fault_addr;
 			if (funct3 > 0b010) {
 				exception_cause = XCAUSE_INSTR_ILLEGAL;
-			} else if (misalign) {
-				exception_cause = XCAUSE_STORE_ALIGN;
-				xtval_wdata = store_addr_v;
 			} else {
-				std::optional<ux_t> store_addr_p = vmap_ls(store_addr_v, PTE_W);
-				if (!store_addr_p) {
-					exception_cause = XCAUSE_STORE_PAGEFAULT;
-				} else if (funct3 == 0b000) {
-					if (!w8(*store_addr_p, rs2 & 0xffu)) {
-						exception_cause = XCAUSE_STORE_FAULT;
-					}
-				} else if (funct3 == 0b001) {
-					if (!w16(*store_addr_p, rs2 & 0xffffu)) {
-						exception_cause = XCAUSE_STORE_FAULT;
-					}
-				} else if (funct3 == 0b010) {
-					if (!w32(*store_addr_p, rs2)) {
-						exception_cause = XCAUSE_STORE_FAULT;
-					}
+				exception_cause = store(store_addr_v, 1u << funct3, rs2, fault_addr);
+				if (exception_cause) {
+					xtval_wdata = fault_addr;
 				}
+			}
+			break;
+		}
+
+		case OPC_LOAD_FP: {
+			ux_t load_addr_v = rs1 + imm_i(instr);
+			uint64_t load_data;
+			if (funct3 == 0b000 || funct3 >= 0b101) {
+				exception_cause = vector_load_store(instr, xtval_wdata);
+			} else if (!csr.fp_enabled() || (funct3 != 0b010 && funct3 != 0b011)) {
+				exception_cause = XCAUSE_INSTR_ILLEGAL;
+			} else {
+				ux_t fault_addr;
+				exception_cause = load_fp(load_addr_v, funct3 == 0b011 ? 8 : 4, load_data, fault_addr);
 				if (exception_cause) {
-					xtval_wdata = store_addr_v;
+					xtval_wdata = fault_addr;
+				} else {
+					frd_wdata = load_data;
 				}
 			}
 			break;
 		}
 
+		case OPC_STORE_FP: {
+			ux_t store_addr_v = rs1 + imm_s(instr);
+			if (funct3 == 0b000 || funct3 >= 0b101) {
+				exception_cause = vector_load_store(instr, xtval_wdata);
+			} else if (!csr.fp_enabled() || (funct3 != 0b010 && funct3 != 0b011)) {
+				exception_cause = XCAUSE_INSTR_ILLEGAL;
+			} else {
+				ux_t fault_addr;
+				exception_cause = store(store_addr_v, funct3 == 0b011 ? 8 : 4, fregs[regnum_rs2], fault_addr);
+				if (exception_cause) {
+					xtval_wdata = fault_addr;
+				}
+			}
+			break;
+		}
+
+		case OPC_MADD:
+		case OPC_MSUB:
+		case OPC_NMSUB:
+		case OPC_NMADD:
+		case OPC_OP_FP: {
+			std::optional<FPUResult> result;
+			uint fflags = 0;
+			if (csr.fp_enabled()) {
+				uint regnum_rs3 = instr >> 27;
+				result = fpu_execute(instr, csr.get_frm(), rs1,
+					fregs[regnum_rs1], fregs[regnum_rs2], fregs[regnum_rs3], fflags);
+			}
+			if (!result) {
+				exception_cause = XCAUSE_INSTR_ILLEGAL;
+			} else {
+				if (result->to_xreg) {
+					rd_wdata = result->wdata;
+				} else {
+					frd_wdata = result->wdata;
+				}
+				csr.fp_accrue_fflags(fflags);
+			}
+			break;
+		}
+
+		case OPC_OP_V: {
+			exception_cause = vector_op(instr, rd_wdata);
+			break;
+		}
+
 		case OPC_AMO: {
 			if (RVOPC_MATCH(instr, LR_W)) {
 				if (rs1 & 0x3) {
@@ -341,6 +579,8 @@ void RVCore::step(bool trace) {
 					std::optional<ux_t> lr_addr_p = vmap_ls(rs1, PTE_R);
 					if (!lr_addr_p) {
 						exception_cause = XCAUSE_LOAD_PAGEFAULT;
+					} else if (!pmp_permits_ls(*lr_addr_p, 4, PMP_R)) {
+						exception_cause = XCAUSE_LOAD_FAULT;
 					} else {
 						rd_wdata = r32(*lr_addr_p);
 						if (rd_wdata) {
@@ -361,6 +601,8 @@ void RVCore::step(bool trace) {
 						std::optional<ux_t> sc_addr_p = vmap_ls(rs1, PTE_W);
 						if (!sc_addr_p) {
 							exception_cause = XCAUSE_STORE_PAGEFAULT;
+						} else if (!pmp_permits_ls(*sc_addr_p, 4, PMP_W)) {
+							exception_cause = XCAUSE_STORE_FAULT;
 						} else {
 							load_reserved = false;
 							if (w32(*sc_addr_p, rs2)) {
@@ -392,6 +634,8 @@ void RVCore::step(bool trace) {
 					std::optional<ux_t> amo_addr_p = vmap_ls(rs1, PTE_W | PTE_R);
 					if (!amo_addr_p) {
 						exception_cause = XCAUSE_STORE_PAGEFAULT;
+					} else if (!pmp_permits_ls(*amo_addr_p, 4, PMP_R | PMP_W)) {
+						exception_cause = XCAUSE_STORE_FAULT;
 					} else {
 						rd_wdata = r32(*amo_addr_p);
 						if (!rd_wdata) {
@@ -429,7 +673,27 @@ void RVCore::step(bool trace) {
 			if (RVOPC_MATCH(instr, FENCE)) {
 				// implement as nop
 			} else if (RVOPC_MATCH(instr, FENCE_I)) {
-				// implement as nop
+				code_cache.flush_all();
+			} else if (RVOPC_MATCH(instr, CBO_ZERO) || RVOPC_MATCH(instr, CBO_CLEAN) || RVOPC_MATCH(instr, CBO_FLUSH)) {
+				uint op = instr >> 20;
+				if (!csr.permit_cbo(op == CBO_ZERO ? ENVCFG_CBZE : ENVCFG_CBCFE)) {
+					exception_cause = XCAUSE_INSTR_ILLEGAL;
+				} else {
+					exception_cause = cache_block_op(rs1, op);
+				}
+				if (exception_cause && *exception_cause != XCAUSE_INSTR_ILLEGAL) {
+					xtval_wdata = rs1;
+				}
+			} else if (RVOPC_MATCH(instr, CBO_INVAL)) {
+				ux_t cbie = csr.get_effective_cbie();
+				if (cbie == 0) {
+					exception_cause = XCAUSE_INSTR_ILLEGAL;
+				} else {
+					exception_cause = cache_block_op(rs1, cbie == ENVCFG_CBIE_INVAL ? CBO_INVAL : CBO_FLUSH);
+				}
+				if (exception_cause && *exception_cause != XCAUSE_INSTR_ILLEGAL) {
+					xtval_wdata = rs1;
+				}
 			} else {
 				exception_cause = XCAUSE_INSTR_ILLEGAL;
 			}
@@ -501,14 +765,21 @@ void RVCore::step(bool trace) {
 			} else if (RVOPC_MATCH(instr, SFENCE_VMA)) {
 				if (!csr.permit_sfence_vma()) {
 					exception_cause = XCAUSE_INSTR_ILLEGAL;
+				} else if (regnum_rs1 != 0) {
+					tlb.flush(rs1);
+				} else {
+					tlb.flush_all();
 				}
-				// Otherwise nop.
 			} else if (RVOPC_MATCH(instr, ECALL)) {
-				exception_cause = XCAUSE_ECALL_U + csr.get_true_priv();
-				xtval_wdata = 0;
+				if (!(ecall_handler && ecall_handler->ecall(*this, csr.get_true_priv()))) {
+					exception_cause = XCAUSE_ECALL_U + csr.get_true_priv();
+					xtval_wdata = 0;
+				}
 			} else if (RVOPC_MATCH(instr, EBREAK)) {
-				exception_cause = XCAUSE_EBREAK;
-				xtval_wdata = 0;
+				if (!(ebreak_handler && ebreak_handler->ebreak(*this, csr.get_true_priv()))) {
+					exception_cause = XCAUSE_EBREAK;
+					xtval_wdata = 0;
+				}
 			} else if (RVOPC_MATCH(instr, WFI)) {
 				// implement as nop
 			} else {
@@ -538,41 +809,55 @@ void RVCore::step(bool trace) {
 				+ (GETBIT(instr, 6) << 2)
 				+ (GETBITS(instr, 12, 10) << 3)
 				+ (GETBIT(instr, 5) << 6);
-			if (addr_v & 0x3) {
-				exception_cause = XCAUSE_LOAD_ALIGN;
+			uint64_t load_data;
+			ux_t fault_addr;
+			exception_cause = load(addr_v, 4, load_data, fault_addr);
+			if (exception_cause) {
+				xtval_wdata = fault_addr;
 			} else {
-				std::optional<ux_t> addr_p = vmap_ls(addr_v, PTE_R);
-				if (addr_p) {
-					rd_wdata = r32(*addr_p);
-					if (!rd_wdata) {
-						exception_cause = XCAUSE_LOAD_FAULT;
-					}
+				rd_wdata = load_data;
+			}
+		} else if (RVOPC_MATCH(instr, C_FLW) || RVOPC_MATCH(instr, C_FLD)) {
+			regnum_rd = c_rs2_s(instr);
+			bool dbl = RVOPC_MATCH(instr, C_FLD);
+			ux_t addr_v = regs[c_rs1_s(instr)]
+				+ (GETBITS(instr, 12, 10) << 3)
+				+ (dbl ? GETBITS(instr, 6, 5) << 6 : (GETBIT(instr, 6) << 2) + (GETBIT(instr, 5) << 6));
+			uint64_t load_data;
+			if (!csr.fp_enabled()) {
+				exception_cause = XCAUSE_INSTR_ILLEGAL;
+			} else {
+				ux_t fault_addr;
+				exception_cause = load_fp(addr_v, dbl ? 8 : 4, load_data, fault_addr);
+				if (exception_cause) {
+					xtval_wdata = fault_addr;
 				} else {
-					exception_cause = XCAUSE_LOAD_PAGEFAULT;
+					frd_wdata = load_data;
 				}
 			}
-			if (exception_cause) {
-				xtval_wdata = addr_v;
+		} else if (RVOPC_MATCH(instr, C_FSW) || RVOPC_MATCH(instr, C_FSD)) {
+			bool dbl = RVOPC_MATCH(instr, C_FSD);
+			ux_t addr_v = regs[c_rs1_s(instr)]
+				+ (GETBITS(instr, 12, 10) << 3)
+				+ (dbl ? GETBITS(instr, 6, 5) << 6 : (GETBIT(instr, 6) << 2) + (GETBIT(instr, 5) << 6));
+			if (!csr.fp_enabled()) {
+				exception_cause = XCAUSE_INSTR_ILLEGAL;
+			} else {
+				ux_t fault_addr;
+				exception_cause = store(addr_v, dbl ? 8 : 4, fregs[c_rs2_s(instr)], fault_addr);
+				if (exception_cause) {
+					xtval_wdata = fault_addr;
+				}
 			}
 		} else if (RVOPC_MATCH(instr, C_SW)) {
 			ux_t addr_v = regs[c_rs1_s(instr)]
 				+ (GETBIT(instr, 6) << 2)
 				+ (GETBITS(instr, 12, 10) << 3)
 				+ (GETBIT(instr, 5) << 6);
-			if (addr_v & 0x3) {
-				exception_cause = XCAUSE_STORE_ALIGN;
-			} else {
-				std::optional<ux_t> addr_p = vmap_ls(addr_v, PTE_W);
-				if (addr_p) {
-					if (!w32(*addr_p, regs[c_rs2_s(instr)])) {
-						exception_cause = XCAUSE_STORE_FAULT;
-					}
-				} else {
-					exception_cause = XCAUSE_STORE_PAGEFAULT;
-				}
-			}
+			ux_t fault_addr;
+			exception_cause = store(addr_v, 4, regs[c_rs2_s(instr)], fault_addr);
 			if (exception_cause) {
-				xtval_wdata = addr_v;
+				xtval_wdata = fault_addr;
 			}
 		} else {
 			exception_cause = XCAUSE_INSTR_ILLEGAL;
@@ -672,40 +957,54 @@ void RVCore::step(bool trace) {
 				+ (GETBIT(instr, 12) << 5)
 				+ (GETBITS(instr, 6, 4) << 2)
 				+ (GETBITS(instr, 3, 2) << 6);
-			if (addr_v & 0x3) {
-				exception_cause = XCAUSE_LOAD_ALIGN;
+			uint64_t load_data;
+			ux_t fault_addr;
+			exception_cause = load(addr_v, 4, load_data, fault_addr);
+			if (exception_cause) {
+				xtval_wdata = fault_addr;
 			} else {
-				std::optional<ux_t> addr_p = vmap_ls(addr_v, PTE_R);
-				if (addr_p) {
-					rd_wdata = r32(*addr_p);
-					if (!rd_wdata) {
-						exception_cause = XCAUSE_LOAD_FAULT;
-					}
+				rd_wdata = load_data;
+			}
+		} else if (RVOPC_MATCH(instr, C_FLWSP) || RVOPC_MATCH(instr, C_FLDSP)) {
+			regnum_rd = c_rs1_l(instr);
+			bool dbl = RVOPC_MATCH(instr, C_FLDSP);
+			ux_t addr_v = regs[2] + (GETBIT(instr, 12) << 5) + (dbl ?
+				(GETBITS(instr, 6, 5) << 3) + (GETBITS(instr, 4, 2) << 6) :
+				(GETBITS(instr, 6, 4) << 2) + (GETBITS(instr, 3, 2) << 6));
+			uint64_t load_data;
+			if (!csr.fp_enabled()) {
+				exception_cause = XCAUSE_INSTR_ILLEGAL;
+			} else {
+				ux_t fault_addr;
+				exception_cause = load_fp(addr_v, dbl ? 8 : 4, load_data, fault_addr);
+				if (exception_cause) {
+					xtval_wdata = fault_addr;
 				} else {
-					exception_cause = XCAUSE_LOAD_PAGEFAULT;
+					frd_wdata = load_data;
 				}
 			}
-			if (exception_cause) {
-				xtval_wdata = addr_v;
+		} else if (RVOPC_MATCH(instr, C_FSWSP) || RVOPC_MATCH(instr, C_FSDSP)) {
+			bool dbl = RVOPC_MATCH(instr, C_FSDSP);
+			ux_t addr_v = regs[2] + (dbl ?
+				(GETBITS(instr, 12, 10) << 3) + (GETBITS(instr, 9, 7) << 6) :
+				(GETBITS(instr, 12, 9) << 2) + (GETBITS(instr, 8, 7) << 6));
+			if (!csr.fp_enabled()) {
+				exception_cause = XCAUSE_INSTR_ILLEGAL;
+			} else {
+				ux_t fault_addr;
+				exception_cause = store(addr_v, dbl ? 8 : 4, fregs[c_rs2_l(instr)], fault_addr);
+				if (exception_cause) {
+					xtval_wdata = fault_addr;
+				}
 			}
 		} else if (RVOPC_MATCH(instr, C_SWSP)) {
 			ux_t addr_v = regs[2]
 				+ (GETBITS(instr, 12, 9) << 2)
 				+ (GETBITS(instr, 8, 7) << 6);
-			if (addr_v & 0x3) {
-				exception_cause = XCAUSE_STORE_ALIGN;
-			} else {
-				std::optional<ux_t> addr_p = vmap_ls(addr_v, PTE_W);
-				if (addr_p) {
-					if (!w32(*addr_p, regs[c_rs2_l(instr)])) {
-						exception_cause = XCAUSE_STORE_FAULT;
-					}
-				} else {
-					exception_cause = XCAUSE_STORE_PAGEFAULT;
-				}
-			}
+			ux_t fault_addr;
+			exception_cause = store(addr_v, 4, regs[c_rs2_l(instr)], fault_addr);
 			if (exception_cause) {
-				xtval_wdata = addr_v;
+				xtval_wdata = fault_addr;
 			}
 		} else {
 			exception_cause = XCAUSE_INSTR_ILLEGAL;
@@ -723,6 +1022,10 @@ void RVCore::step(bool trace) {
 		bool gpr_writeback = regnum_rd != 0 && rd_wdata;
 		if (gpr_writeback) {
 			printf("%-3s   <- %08x :\n", friendly_reg_names[regnum_rd], *rd_wdata);
+		} else if (frd_wdata && *frd_wdata >> 32 == 0xffffffffu) {
+			printf("%-4s  <- %08x :\n", friendly_freg_names[regnum_rd], (uint32_t)*frd_wdata);
+		} else if (frd_wdata) {
+			printf("%-4s  <- %016llx :\n", friendly_freg_names[regnum_rd], (unsigned long long)*frd_wdata);
 		} else if (pc_wdata) {
 			printf("pc    <- %08x <\n", *pc_wdata);
 		} else {
@@ -740,10 +1043,7 @@ void RVCore::step(bool trace) {
 		if (*exception_cause == XCAUSE_INSTR_ILLEGAL && !xtval_wdata) {
 			xtval_wdata = instr & ((instr & 0x3) == 0x3 ? 0xffffffffu : 0x0000ffffu);
 		}
-		pc_wdata = csr.trap_enter_exception(*exception_cause, pc);
-		if (xtval_wdata) {
-			csr.trap_set_xtval(*xtval_wdata);
-		}
+		pc_wdata = csr.trap_enter_exception(*exception_cause, pc, xtval_wdata);
 		if (trace) {
 			printf("^^^ Trap           : cause <- %-2u       :\n", *exception_cause);
 			printf("|||                : pc    <- %08x <\n", *pc_wdata);
@@ -774,6 +1074,212 @@ void RVCore::step(bool trace) {
 		pc = pc + ((instr & 0x3) == 0x3 ? 4 : 2);
 	if (rd_wdata && regnum_rd != 0)
 		regs[regnum_rd] = *rd_wdata;
+	if (frd_wdata) {
+		fregs[regnum_rd] = *frd_wdata;
+		csr.fp_set_dirty();
+	}
 
 	csr.step_counters();
 }
+
+int RVCore::aot_load(void *core, ux_t vaddr, uint size, uint64_t &data, ux_t &fault_addr) {
+	std::optional<uint> cause = ((RVCore*)core)->load(vaddr, size, data, fault_addr);
+	return cause ? (int)*cause : -1;
+}
+
+int RVCore::aot_store(void *core, ux_t vaddr, uint size, uint64_t data, ux_t &fault_addr) {
+	std::optional<uint> cause = ((RVCore*)core)->store(vaddr, size, data, fault_addr);
+	return cause ? (int)*cause : -1;
+}
+
+// Direct-threaded interpreter for the common RV32IMC and bitmanip
+// instructions. Each handler ends by fetching and decoding the next
+// instruction and jumping straight to its handler, so each has its own
+// indirect branch for the host to predict. Anything else (CSRs, FP, vector,
+// AMOs, system instructions, illegal encodings, fetches which are not from
+// RAM or cross a page) leaves the loop without side effects, and is executed
+// by step() on the next call.
+//
+// IRQs only become pending or enabled through instructions run by step() or
+// through the caller changing inputs between calls, and step() checks for
+// IRQs after every instruction, so the fast path does not need to. Likewise
+// the fetch page is only looked up again when pc leaves it, as translation
+// and PMP can't change without step().
+//
+// Where code translated ahead of time (rv_aot.h) starts at pc, the handler
+// calls it instead, and carries on with whatever follows it.
+
+void RVCore::run(uint max_instrs, uint &retired) {
+	// Handler for each decoded op, by default the slow path
+	static const void *dispatch[RVOP_COUNT];
+	static bool dispatch_init = false;
+	if (!dispatch_init) {
+		for (const void *&label : dispatch)
+			label = &&slow;
+#define X(op) dispatch[RVOP_##op] = &&op_##op;
+		RV_FAST_OPS(X)
+#undef X
+		dispatch_init = true;
+	}
+	if (max_instrs == 0)
+		return;
+
+	if (code_cache.loads_ready)
+		code_cache.merge_loaded((const uint8_t*)ram, ram_base);
+
+	// The first instruction goes through step(), which checks for IRQs made
+	// pending by the caller since the last call
+	uint start_priv = csr.get_true_priv();
+	step();
+	++retired;
+	if (csr.get_true_priv() != start_priv)
+		return;
+
+	uint n = 0;
+	uint32_t instr;
+
+	// Pages fetched from during this call, direct-mapped by virtual page, so
+	// that returns and other jumps back to a page skip translation and the
+	// PMP check. Nothing which can change either (CSR writes, SFENCE.VMA,
+	// traps) is handled by the fast path, so entries stay valid until run()
+	// returns.
+	struct FetchPage {
+		ux_t vpage;
+		// Null if the page can't be executed from in the fast path
+		const uint8_t *host;
+		CodePage *code;
+		AOTPage *aot;
+	};
+	FetchPage fetch_pages[16];
+	for (FetchPage &p : fetch_pages)
+		p.vpage = -1u;
+	FetchPage *fetch = &fetch_pages[0];
+
+	AOTContext aot_ctx;
+	aot_ctx.regs = regs.data();
+	aot_ctx.core = this;
+	aot_ctx.load = aot_load;
+	aot_ctx.store = aot_store;
+	aot_ctx.code_written = &code_cache.aot_written;
+	aot_ctx.retired = 0;
+
+#define RD     (instr >> 7 & 0x1f)
+#define RS1    regs[instr >> 15 & 0x1f]
+#define RS2    regs[instr >> 20 & 0x1f]
+#define SHAMT  (instr >> 20 & 0x1f)
+#define WRITE_RD(rd, x) do {regs[rd] = (x); regs[0] = 0;} while (0)
+#define DISPATCH() do { \
+	if (n + 1 >= max_instrs) \
+		goto done; \
+	if ((pc & ~0xfffu) != fetch->vpage) { \
+		fetch = &fetch_pages[pc >> 12 & 0xf]; \
+		if ((pc & ~0xfffu) != fetch->vpage) { \
+			fetch->vpage = pc & ~0xfffu; \
+			fetch->host = fetch_host_page(pc); \
+			fetch->code = fetch->host ? \
+				code_cache.page(ram_base + (fetch->host - (const uint8_t*)ram), fetch->host) : nullptr; \
+			fetch->aot = fetch->code ? fetch->code->aot.get() : nullptr; \
+		} \
+	} \
+	if (!fetch->host) \
+		goto done; \
+	if (fetch->aot && fetch->aot->blocks[(pc & 0xfffu) >> 1]) \
+		goto aot; \
+	DECODE(); \
+} while (0)
+#define DECODE() do { \
+	ux_t offset = pc & 0xfffu; \
+	DecodedInstr &decoded = fetch->code->instrs[offset >> 1]; \
+	if (decoded.op == DecodedInstr::EMPTY) { \
+		if (!code_page_instr(fetch->host, offset, instr)) \
+			goto done; \
+		decoded.instr = instr; \
+		decoded.op = rv_decode(instr); \
+	} \
+	instr = decoded.instr; \
+	goto *dispatch[decoded.op]; \
+} while (0)
+#define NEXT(len) do {pc += (len); ++n; DISPATCH();} while (0)
+#define JUMP(target) do {pc = (target); ++n; DISPATCH();} while (0)
+#define TRAP(cause, tval) do {pc = csr.trap_enter_exception(cause, pc, tval); ++n; goto done;} while (0)
+#define OP(x) do {WRITE_RD(RD, x); NEXT(4);} while (0)
+#define C_OP(rd, x) do {WRITE_RD(rd, x); NEXT(2);} while (0)
+#define LOAD(rd, addr, size, ext, len) do { \
+	uint64_t load_data; \
+	ux_t fault_addr; \
+	std::optional<uint> cause = load(addr, size, load_data, fault_addr); \
+	if (cause) \
+		TRAP(*cause, fault_addr); \
+	WRITE_RD(rd, ext); \
+	NEXT(len); \
+} while (0)
+#define STORE(addr, size, data, len) do { \
+	ux_t fault_addr; \
+	std::optional<uint> cause = store(addr, size, data, fault_addr); \
+	if (cause) \
+		TRAP(*cause, fault_addr); \
+	NEXT(len); \
+} while (0)
+#define SLOW() goto done
+
+	try {
+		DISPATCH();
+
+#define X(op) op_##op: RV_FAST_OP_##op
+	RV_FAST_OPS(X)
+#undef X
+
+	aot: {
+		// Translated block, if the batch has room for all of it
+		const AOTBlock *b = fetch->aot->blocks[(pc & 0xfffu) >> 1];
+		aot_ctx.budget = max_instrs - 1 - n;
+		if (b->n_instrs > aot_ctx.budget)
+			DECODE();
+		code_cache.aot_written = false;
+		b->fn(&aot_ctx, pc);
+		uint block_n = aot_ctx.retired;
+		aot_ctx.retired = 0;
+		n += block_n;
+		pc = aot_ctx.pc;
+		if (aot_ctx.trapped)
+			TRAP(aot_ctx.cause, aot_ctx.tval);
+		// Stopping before retiring anything means the block starts with an
+		// instruction it leaves to the slow path, so don't enter it again
+		if (block_n == 0)
+			DECODE();
+		DISPATCH();
+	}
+
+	slow:
+		goto done;
+	} catch (...) {
+		n += aot_ctx.retired;
+		retired += n;
+		csr.step_counters(n);
+		throw;
+	}
+
+#undef RD
+#undef RS1
+#undef RS2
+#undef SHAMT
+#undef WRITE_RD
+#undef DISPATCH
+#undef DECODE
+#undef NEXT
+#undef JUMP
+#undef TRAP
+#undef OP
+#undef C_OP
+#undef LOAD
+#undef STORE
+#undef SLOW
+
+done:
+	// Where execution is when a call returns is a sample of where the hot
+	// code is, for the translator
+	if (!code_cache.persist_dir.empty() && fetch->code && fetch->vpage == (pc & ~0xfffu))
+		code_cache.sample(ram_base + (fetch->host - (const uint8_t*)ram) + (pc & 0xfffu), fetch->host);
+	retired += n;
+	csr.step_counters(n);
+}
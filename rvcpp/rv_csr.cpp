@@ -1,12 +1,13 @@
 #include "rv_csr.h"
+#include "rv_vector.h"
 #include <optional>
 #include <cassert>
 
-void RVCSR::step_counters() {
-	uint64_t mcycle_next = ((uint64_t)mcycleh << 32) + mcycle + 1u;
+void RVCSR::step_counters(uint n) {
+	uint64_t mcycle_next = ((uint64_t)mcycleh << 32) + mcycle + n;
 	mcycle = mcycle_next & 0xffffffffu;
 	mcycleh = mcycle_next >> 32;
-	uint64_t minstret_next = ((uint64_t)minstreth << 32) + minstret + 1u;
+	uint64_t minstret_next = ((uint64_t)minstreth << 32) + minstret + n;
 	minstret = minstret_next & 0xffffffffu;
 	minstreth = minstret_next >> 32;
 }
@@ -15,6 +16,8 @@ static const ux_t SSTATUS_MASK =
 	SSTATUS_SIE |
 	SSTATUS_SPIE |
 	SSTATUS_SPP |
+	SSTATUS_VS |
+	SSTATUS_FS |
 	SSTATUS_SUM |
 	SSTATUS_MXR;
 
@@ -28,6 +31,20 @@ static const ux_t MSTATUS_MASK =
 	MSTATUS_TW |
 	MSTATUS_TSR;
 
+// CBIE is WARL, with the reserved value 0b10 read back as 0b00 (illegal)
+static const ux_t ENVCFG_MASK =
+	ENVCFG_FIOM |
+	ENVCFG_CBIE |
+	ENVCFG_CBCFE |
+	ENVCFG_CBZE;
+
+static ux_t envcfg_legalise(ux_t data) {
+	data &= ENVCFG_MASK;
+	if ((data & ENVCFG_CBIE) == 0x20u)
+		data &= ~ENVCFG_CBIE;
+	return data;
+}
+
 static const ux_t SIP_MASK =
 	MIP_SSIP |
 	MIP_STIP |
@@ -44,142 +61,307 @@ static const ux_t MIP_W_MASK = SIP_MASK;
 static const ux_t MIE_R_MASK = ALL_MIP_BITS;
 static const ux_t MIE_W_MASK = ALL_MIP_BITS;
 
-// Returns None on permission/decode fail
-std::optional<ux_t> RVCSR::read(uint16_t addr, __attribute__((unused)) bool side_effect) {
-	// Minimum privilege check
-	if (addr >= 1u << 12 || GETBITS(addr, 9, 8) > priv)
-		return std::nullopt;
-	// Additional privilege checks
-	bool permit_cycle =
-		(priv >= PRV_M || mcounteren & 0x1) &&
-		(priv >= PRV_S || scounteren & 0x1);
-	bool permit_instret =
-		(priv >= PRV_M || mcounteren & 0x4) &&
-		(priv >= PRV_S || scounteren & 0x4);
-	bool permit_satp = priv >= PRV_M || !(xstatus & MSTATUS_TVM);
-
-	switch (addr) {
-		// Machine ID
-		case CSR_MISA:       return 0x40141105; // RV32IMAC + SU
-		case CSR_MHARTID:    return 0;
-		case CSR_MARCHID:    return 0;
-		case CSR_MIMPID:     return 0;
-		case CSR_MVENDORID:  return 0;
-
-		// Machine trap handling
-		case CSR_MSTATUS:    return xstatus & MSTATUS_MASK;
-		case CSR_MIE:        return xie & MIE_R_MASK;
-		case CSR_MIP:        return get_effective_xip() & MIP_R_MASK;
-		case CSR_MTVEC:      return mtvec;
-		case CSR_MSCRATCH:   return mscratch;
-		case CSR_MEPC:       return mepc;
-		case CSR_MCAUSE:     return mcause;
-		case CSR_MTVAL:      return mtval;
-		case CSR_MEDELEG:    return medeleg;
-		case CSR_MIDELEG:    return mideleg;
-
-		// Machine counter
-		case CSR_MCOUNTEREN: return mcounteren;
-		case CSR_MCYCLE:     return mcycle;
-		case CSR_MCYCLEH:    return mcycleh;
-		case CSR_MINSTRET:   return minstreth;
-		case CSR_MINSTRETH:  return minstreth;
-
-		// Supervisor trap handling
-		case CSR_SSTATUS:    return xstatus & SSTATUS_MASK;
-		case CSR_SIE:        return xie & SIP_MASK;
-		case CSR_SIP:        return get_effective_xip() & SIP_MASK & mideleg;
-		case CSR_STVEC:      return stvec;
-		case CSR_SCOUNTEREN: return scounteren;
-		case CSR_SSCRATCH:   return sscratch;
-		case CSR_SEPC:       return sepc;
-		case CSR_SCAUSE:     return scause;
-		case CSR_STVAL:      return stval;
-		case CSR_SATP:       if (permit_satp)        return satp;       else return std::nullopt;
-
-		// Unprivileged
-		case CSR_CYCLE:      if (permit_cycle)       return mcycle;     else return std::nullopt;
-		case CSR_CYCLEH:     if (permit_cycle)       return mcycleh;    else return std::nullopt;
-		case CSR_INSTRET:    if (permit_instret)     return minstreth;  else return std::nullopt;
-		case CSR_INSTRETH:   if (permit_instret)     return minstreth;  else return std::nullopt;
-
-		default:             return std::nullopt;
+// Only the L, A and RWX fields are implemented. RW=01 is reserved, and is
+// read back as RW=00.
+static uint8_t pmpcfg_legalise(ux_t data) {
+	data &= PMP_L | PMP_A | PMP_X | PMP_W | PMP_R;
+	if (!(data & PMP_R))
+		data &= ~PMP_W;
+	return data;
+}
+
+// Recalculate the address range of each entry, and invalidate the
+// permission cache
+void RVCSR::pmp_update() {
+	for (uint i = 0; i < PMP_N_REGIONS; ++i) {
+		uint64_t lo = 0;
+		uint64_t hi = 0;
+		switch (pmpcfg[i] & PMP_A) {
+			case PMP_TOR:
+				lo = i == 0 ? 0 : (uint64_t)pmpaddr[i - 1] << PMP_SHIFT;
+				hi = (uint64_t)pmpaddr[i] << PMP_SHIFT;
+				break;
+			case PMP_NA4:
+				lo = (uint64_t)pmpaddr[i] << PMP_SHIFT;
+				hi = lo + 4;
+				break;
+			case PMP_NAPOT: {
+				// Trailing ones give the size, starting from 8 bytes
+				uint trailing_ones = ~pmpaddr[i] ? __builtin_ctz(~pmpaddr[i]) : 32;
+				uint64_t size = 8ull << trailing_ones;
+				lo = ((uint64_t)pmpaddr[i] << PMP_SHIFT) & ~(size - 1);
+				hi = lo + size;
+				break;
+			}
+			default:
+				break;
+		}
+		if (hi <= lo) {
+			lo = 0;
+			hi = 0;
+		}
+		pmp_lo[i] = lo;
+		pmp_hi[i] = hi;
+	}
+	if (++pmp_generation == 0) {
+		for (PMPPageCacheEntry &e : pmp_page_cache) {
+			e.generation = 0;
+		}
+		pmp_generation = 1;
 	}
 }
 
-// Returns false on permission/decode fail
-bool RVCSR::write(uint16_t addr, ux_t data, uint op) {
-	// Check minimum privilege + !RO
-	if (addr >= 1u << 12 || GETBITS(addr, 9, 8) > priv || GETBITS(addr, 11, 10) == 0x3)
-		return false;
+// The lowest-numbered entry which overlaps the page decides the permissions
+// for the whole page, if it covers the whole page. An M-mode access is
+// only checked against locked entries. When no entry matches, M-mode
+// accesses succeed and S/U-mode accesses fail.
+const RVCSR::PMPPageCacheEntry &RVCSR::pmp_fill_page_cache(ux_t paddr) {
+	PMPPageCacheEntry &e = pmp_page_cache[(paddr >> 12) % PMP_PAGE_CACHE_SIZE];
+	uint64_t page_lo = paddr & ~0xfffu;
+	uint64_t page_hi = page_lo + 0x1000;
+	e.page = paddr >> 12;
+	e.generation = pmp_generation;
+	e.perm_m = PMP_R | PMP_W | PMP_X;
+	e.perm_su = 0;
+	for (uint i = 0; i < PMP_N_REGIONS; ++i) {
+		if (pmp_lo[i] >= page_hi || pmp_hi[i] <= page_lo)
+			continue;
+		if (pmp_lo[i] <= page_lo && pmp_hi[i] >= page_hi) {
+			uint8_t perm = pmpcfg[i] & (PMP_R | PMP_W | PMP_X);
+			e.perm_su = perm;
+			if (pmpcfg[i] & PMP_L)
+				e.perm_m = perm;
+		} else {
+			e.perm_m = PMP_PAGE_SPLIT;
+			e.perm_su = PMP_PAGE_SPLIT;
+		}
+		break;
+	}
+	return e;
+}
 
-	// Apply read-modify-write behaviour
-	if (op == WRITE_CLEAR || op == WRITE_SET) {
-		std::optional<ux_t> rdata = read(addr, false);
-		if (!rdata)
+// An access must be entirely inside the lowest-numbered entry which matches
+// any of its bytes.
+bool RVCSR::pmp_permits_scan(ux_t paddr, uint size, uint required, uint check_priv) {
+	uint64_t lo = paddr;
+	uint64_t hi = lo + size;
+	for (uint i = 0; i < PMP_N_REGIONS; ++i) {
+		if (pmp_lo[i] >= hi || pmp_hi[i] <= lo)
+			continue;
+		if (pmp_lo[i] > lo || pmp_hi[i] < hi)
 			return false;
-		if (op == WRITE_CLEAR)
-			data = *rdata & ~data;
-		else
-			data = *rdata |  data;
+		if (check_priv == PRV_M && !(pmpcfg[i] & PMP_L))
+			return true;
+		return (pmpcfg[i] & required) == required;
 	}
+	return check_priv == PRV_M;
+}
+
+// Additional permission checks, beyond the minimum privilege encoded in the
+// CSR address
+enum {
+	CSR_CHECK_NONE,
+	CSR_CHECK_CYCLE,
+	CSR_CHECK_TIME,
+	CSR_CHECK_INSTRET,
+	CSR_CHECK_SATP,
+	CSR_CHECK_STIMECMP,
+	CSR_CHECK_FP,
+	CSR_CHECK_VEC
+};
+
+// STIP is read-only when driven by stimecmp
+ux_t RVCSR::mip_w_mask() {
+	return stce_enabled() ? MIP_W_MASK & ~MIP_STIP : MIP_W_MASK;
+}
 
-	bool permit_satp = priv >= PRV_M || !(xstatus & MSTATUS_TVM);
-
-	ux_t sip_mask_deleg = SIP_MASK & mideleg;
-
-	switch (addr) {
-		case CSR_MISA:                                                                       break;
-		case CSR_MHARTID:                                                                    break;
-		case CSR_MARCHID:                                                                    break;
-		case CSR_MIMPID:                                                                     break;
-		case CSR_MVENDORID:                                                                  break;
-
-		case CSR_MSTATUS:    xstatus    = (data & MSTATUS_MASK) | (xstatus & ~MSTATUS_MASK); break;
-		case CSR_MIE:        xie        = (data & MIE_W_MASK) | (xie & ~MIE_W_MASK);         break;
-		case CSR_MIP:        xip        = (data & MIP_W_MASK) | (xip & ~MIP_W_MASK);         break;
-		case CSR_MTVEC:      mtvec      = data & 0xfffffffdu;                                break;
-		case CSR_MSCRATCH:   mscratch   = data;                                              break;
-		case CSR_MEPC:       mepc       = data & 0xfffffffeu;                                break;
-		case CSR_MCAUSE:     mcause     = data & 0x800000ffu;                                break;
-		case CSR_MTVAL:      mtval      = data;                                              break;
-		case CSR_MEDELEG:    medeleg    = data;                                              break;
-		case CSR_MIDELEG:    mideleg    = data;                                              break;
-
-		case CSR_MCOUNTEREN: mcounteren = data & 0x7u;                                       break;
-		case CSR_MCYCLE:     mcycle     = data;                                              break;
-		case CSR_MCYCLEH:    mcycleh    = data;                                              break;
-		case CSR_MINSTRET:   minstret   = data;                                              break;
-		case CSR_MINSTRETH:  minstreth  = data;                                              break;
-
-		case CSR_SSTATUS:    xstatus    = (data & SSTATUS_MASK) | (xstatus & ~SSTATUS_MASK); break;
-		case CSR_SIE:        xie        = (data & SIP_MASK) | (xie & ~SIP_MASK);             break;
-		case CSR_SIP:        xip        = (data & sip_mask_deleg) | (xip & ~sip_mask_deleg); break;
-		case CSR_STVEC:      stvec      = data & 0xfffffffdu;                                break;
-		case CSR_SCOUNTEREN: scounteren = data & 0x7u;                                       break;
-		case CSR_SSCRATCH:   sscratch   = data;                                              break;
-		case CSR_SEPC:       sepc       = data & 0xfffffffeu;                                break;
-		case CSR_SCAUSE:     scause     = data & 0x800000ffu;                                break;
-		case CSR_STVAL:      stval      = data;                                              break;
-		case CSR_SATP:       if (permit_satp) satp = data & ~SATP32_ASID; else return false; break;
-
-		default:             return false;
+bool RVCSR::csr_check_permitted(uint check) {
+	switch (check) {
+		case CSR_CHECK_CYCLE:    return counter_permitted(0x1);
+		case CSR_CHECK_TIME:     return counter_permitted(0x2);
+		case CSR_CHECK_INSTRET:  return counter_permitted(0x4);
+		case CSR_CHECK_SATP:     return priv >= PRV_M || !(xstatus & MSTATUS_TVM);
+		case CSR_CHECK_STIMECMP: return priv >= PRV_M || (mcounteren & 0x2 && stce_enabled());
+		case CSR_CHECK_FP:       return fp_enabled();
+		case CSR_CHECK_VEC:      return vec_enabled();
+		default:                 return true;
 	}
-	return true;
 }
 
-ux_t RVCSR::trap_enter_exception(uint xcause, ux_t xepc) {
-	assert(xcause < 32);
-	uint target_priv = medeleg & (1u << xcause) ? PRV_S : PRV_M;
-	if (target_priv < priv) {
-		target_priv = priv;
+// Handlers are non-capturing lambdas, so they can go in a plain table. The
+// CSR address is passed so that one handler can serve a range of CSRs.
+#define R [](__attribute__((unused)) RVCSR &c, __attribute__((unused)) uint16_t addr) -> ux_t
+#define W [](__attribute__((unused)) RVCSR &c, __attribute__((unused)) uint16_t addr, ux_t d)
+
+const std::array<RVCSR::CSRDesc, 4096> RVCSR::csr_table = RVCSR::make_csr_table();
+
+std::array<RVCSR::CSRDesc, 4096> RVCSR::make_csr_table() {
+	std::array<CSRDesc, 4096> table;
+	for (CSRDesc &desc : table) {
+		desc = {nullptr, nullptr, 0, false, CSR_CHECK_NONE};
+	}
+	auto add = [&](uint16_t addr, ux_t (*read)(RVCSR&, uint16_t), void (*write)(RVCSR&, uint16_t, ux_t),
+			uint check = CSR_CHECK_NONE) {
+		table[addr] = {read, write, (uint8_t)GETBITS(addr, 9, 8), GETBITS(addr, 11, 10) == 0x3, (uint8_t)check};
+	};
+
+	// Machine ID
+	add(CSR_MISA,       R {return 0x4014112f;}, nullptr); // RV32IMAFDCB + SU
+	add(CSR_MHARTID,    R {return 0;},          nullptr);
+	add(CSR_MARCHID,    R {return 0;},          nullptr);
+	add(CSR_MIMPID,     R {return 0;},          nullptr);
+	add(CSR_MVENDORID,  R {return 0;},          nullptr);
+
+	// Machine trap handling
+	add(CSR_MSTATUS,    R {return (c.xstatus & MSTATUS_MASK) | c.get_status_sd();},
+	                    W {c.xstatus = (d & MSTATUS_MASK) | (c.xstatus & ~MSTATUS_MASK);
+	                       c.update_translation_state();});
+	add(CSR_MIE,        R {return c.xie & MIE_R_MASK;},
+	                    W {c.xie = (d & MIE_W_MASK) | (c.xie & ~MIE_W_MASK);});
+	add(CSR_MIP,        R {return c.get_effective_xip() & MIP_R_MASK;},
+	                    W {ux_t mask = c.mip_w_mask(); c.xip = (d & mask) | (c.xip & ~mask);});
+	add(CSR_MTVEC,      R {return c.mtvec;},    W {c.mtvec = d & 0xfffffffdu;});
+	add(CSR_MSCRATCH,   R {return c.mscratch;}, W {c.mscratch = d;});
+	add(CSR_MEPC,       R {return c.mepc;},     W {c.mepc = d & 0xfffffffeu;});
+	add(CSR_MCAUSE,     R {return c.mcause;},   W {c.mcause = d & 0x800000ffu;});
+	add(CSR_MTVAL,      R {return c.mtval;},    W {c.mtval = d;});
+	add(CSR_MEDELEG,    R {return c.medeleg;},  W {c.medeleg = d;});
+	add(CSR_MIDELEG,    R {return c.mideleg;},  W {c.mideleg = d;});
+	add(CSR_MENVCFG,    R {return c.menvcfg;},  W {c.menvcfg = envcfg_legalise(d);});
+	add(CSR_MENVCFGH,   R {return c.menvcfgh;}, W {c.menvcfgh = d & (ENVCFGH_STCE | ENVCFGH_ADUE);});
+
+	// Machine memory protection. Locked PMP entries ignore writes, and so
+	// does the address of an entry below a locked TOR entry, since it is that
+	// entry's base.
+	for (uint16_t addr = CSR_PMPCFG0; addr <= CSR_PMPCFG3; ++addr) {
+		add(addr, R {
+			const uint8_t *cfg = &c.pmpcfg[(addr - CSR_PMPCFG0) * 4];
+			return (ux_t)cfg[0] | (ux_t)cfg[1] << 8 | (ux_t)cfg[2] << 16 | (ux_t)cfg[3] << 24;
+		}, W {
+			for (uint i = 0; i < 4; ++i) {
+				uint8_t &cfg = c.pmpcfg[(addr - CSR_PMPCFG0) * 4 + i];
+				if (!(cfg & PMP_L))
+					cfg = pmpcfg_legalise(d >> 8 * i);
+			}
+			c.pmp_update();
+		});
+	}
+	for (uint16_t addr = CSR_PMPADDR0; addr <= CSR_PMPADDR15; ++addr) {
+		add(addr, R {return c.pmpaddr[addr - CSR_PMPADDR0];}, W {
+			uint i = addr - CSR_PMPADDR0;
+			bool locked = (c.pmpcfg[i] & PMP_L) || (i + 1 < PMP_N_REGIONS &&
+				(c.pmpcfg[i + 1] & (PMP_L | PMP_A)) == (PMP_L | PMP_TOR));
+			if (!locked)
+				c.pmpaddr[i] = d;
+			c.pmp_update();
+		});
 	}
-	return trap_enter_at_priv(xcause, xepc, target_priv);
+
+	// Machine counter
+	add(CSR_MCOUNTEREN, R {return c.mcounteren;}, W {c.mcounteren = d & 0x7u;});
+	add(CSR_MCYCLE,     R {return c.mcycle;},     W {c.mcycle = d;});
+	add(CSR_MCYCLEH,    R {return c.mcycleh;},    W {c.mcycleh = d;});
+	add(CSR_MINSTRET,   R {return c.minstret;},   W {c.minstret = d;});
+	add(CSR_MINSTRETH,  R {return c.minstreth;},  W {c.minstreth = d;});
+
+	// Supervisor trap handling
+	add(CSR_SSTATUS,    R {return (c.xstatus & SSTATUS_MASK) | c.get_status_sd();},
+	                    W {c.xstatus = (d & SSTATUS_MASK) | (c.xstatus & ~SSTATUS_MASK);});
+	add(CSR_SIE,        R {return c.xie & SIP_MASK;},
+	                    W {c.xie = (d & SIP_MASK) | (c.xie & ~SIP_MASK);});
+	add(CSR_SIP,        R {return c.get_effective_xip() & SIP_MASK & c.mideleg;},
+	                    W {ux_t mask = SIP_MASK & c.mideleg & c.mip_w_mask(); c.xip = (d & mask) | (c.xip & ~mask);});
+	add(CSR_STVEC,      R {return c.stvec;},      W {c.stvec = d & 0xfffffffdu;});
+	add(CSR_SCOUNTEREN, R {return c.scounteren;}, W {c.scounteren = d & 0x7u;});
+	add(CSR_SSCRATCH,   R {return c.sscratch;},   W {c.sscratch = d;});
+	add(CSR_SEPC,       R {return c.sepc;},       W {c.sepc = d & 0xfffffffeu;});
+	add(CSR_SCAUSE,     R {return c.scause;},     W {c.scause = d & 0x800000ffu;});
+	add(CSR_STVAL,      R {return c.stval;},      W {c.stval = d;});
+	add(CSR_SATP,       R {return c.satp;},       W {c.satp = d & ~SATP32_ASID; c.update_translation_state();},
+	                    CSR_CHECK_SATP);
+	add(CSR_SENVCFG,    R {return c.senvcfg;},    W {c.senvcfg = envcfg_legalise(d);});
+	add(CSR_STIMECMP,   R {return c.stimecmp & 0xffffffffu;},
+	                    W {c.stimecmp = (c.stimecmp & ~0xffffffffull) | d;}, CSR_CHECK_STIMECMP);
+	add(CSR_STIMECMPH,  R {return c.stimecmp >> 32;},
+	                    W {c.stimecmp = (c.stimecmp & 0xffffffffull) | (uint64_t)d << 32;}, CSR_CHECK_STIMECMP);
+
+	// Unprivileged counters
+	add(CSR_CYCLE,      R {return c.mcycle;},             nullptr, CSR_CHECK_CYCLE);
+	add(CSR_CYCLEH,     R {return c.mcycleh;},            nullptr, CSR_CHECK_CYCLE);
+	add(CSR_TIME,       R {return c.time & 0xffffffffu;}, nullptr, CSR_CHECK_TIME);
+	add(CSR_TIMEH,      R {return c.time >> 32;},         nullptr, CSR_CHECK_TIME);
+	add(CSR_INSTRET,    R {return c.minstret;},           nullptr, CSR_CHECK_INSTRET);
+	add(CSR_INSTRETH,   R {return c.minstreth;},          nullptr, CSR_CHECK_INSTRET);
+
+	// Floating point
+	add(CSR_FFLAGS,     R {return c.fcsr & FSR_AEXC;},
+	                    W {c.fcsr = (d & FSR_AEXC) | (c.fcsr & ~FSR_AEXC);}, CSR_CHECK_FP);
+	add(CSR_FRM,        R {return GETBITS(c.fcsr, 7, 5);},
+	                    W {c.fcsr = ((d << FSR_RD_SHIFT) & FSR_RD) | (c.fcsr & ~FSR_RD);}, CSR_CHECK_FP);
+	add(CSR_FCSR,       R {return c.fcsr & (FSR_RD | FSR_AEXC);},
+	                    W {c.fcsr = d & (FSR_RD | FSR_AEXC);}, CSR_CHECK_FP);
+
+	// Vector
+	add(CSR_VSTART,     R {return c.vstart;}, W {c.vstart = d & (VLEN - 1);}, CSR_CHECK_VEC);
+	add(CSR_VXSAT,      R {return c.vxsat;},  W {c.vxsat = d & VCSR_VXSAT;},  CSR_CHECK_VEC);
+	add(CSR_VXRM,       R {return c.vxrm;},   W {c.vxrm = d & 0x3u;},         CSR_CHECK_VEC);
+	add(CSR_VCSR,       R {return c.vxrm << VCSR_VXRM_SHIFT | c.vxsat;},
+	                    W {c.vxrm = GETBITS(d, 2, 1); c.vxsat = d & VCSR_VXSAT;}, CSR_CHECK_VEC);
+	add(CSR_VL,         R {return c.vl;},     nullptr, CSR_CHECK_VEC);
+	add(CSR_VTYPE,      R {return c.vtype;},  nullptr, CSR_CHECK_VEC);
+	add(CSR_VLENB,      R {return VLENB;},    nullptr, CSR_CHECK_VEC);
+
+	return table;
+}
+
+#undef R
+#undef W
+
+// Returns None on permission/decode fail
+std::optional<ux_t> RVCSR::read(uint16_t addr, __attribute__((unused)) bool side_effect) {
+	if (addr >= csr_table.size())
+		return std::nullopt;
+	const CSRDesc &desc = csr_table[addr];
+	if (!desc.read || desc.min_priv > priv || !csr_check_permitted(desc.check))
+		return std::nullopt;
+	return desc.read(*this, addr);
+}
+
+// Returns false on permission/decode fail
+bool RVCSR::write(uint16_t addr, ux_t data, uint op) {
+	if (addr >= csr_table.size())
+		return false;
+	const CSRDesc &desc = csr_table[addr];
+	if (!desc.read || desc.read_only || desc.min_priv > priv || !csr_check_permitted(desc.check))
+		return false;
+
+	// Apply read-modify-write behaviour. The checks are the same as for a
+	// read, so the read handler is called directly.
+	if (op == WRITE_CLEAR)
+		data = desc.read(*this, addr) & ~data;
+	else if (op == WRITE_SET)
+		data = desc.read(*this, addr) | data;
+
+	// Writing FP or vector CSRs dirties that state
+	if (desc.check == CSR_CHECK_FP)
+		fp_set_dirty();
+	else if (desc.check == CSR_CHECK_VEC)
+		vec_set_dirty();
+
+	// Null write handler: writes are ignored
+	if (desc.write)
+		desc.write(*this, addr, data);
+	return true;
 }
 
 std::optional<ux_t> RVCSR::trap_check_enter_irq(ux_t xepc) {
-	ux_t m_targeted_irqs = get_effective_xip() & xie & MIP_R_MASK & ~mideleg;
-	ux_t s_targeted_irqs = get_effective_xip() & xie & SIP_MASK   &  mideleg;
+	// This runs after every instruction, so get out early when nothing is
+	// both pending and enabled
+	ux_t pending_enabled = xie ? get_effective_xip() & xie : 0;
+	if (!pending_enabled)
+		return std::nullopt;
+	ux_t m_targeted_irqs = pending_enabled & MIP_R_MASK & ~mideleg;
+	ux_t s_targeted_irqs = pending_enabled & SIP_MASK   &  mideleg;
 	bool take_m_irq = m_targeted_irqs && ((xstatus & MSTATUS_MIE) || priv < PRV_M);
 	bool take_s_irq = s_targeted_irqs && ((xstatus & SSTATUS_SIE) || priv < PRV_S) && priv <= PRV_S ;
 	if (take_m_irq) {
@@ -193,11 +375,11 @@ std::optional<ux_t> RVCSR::trap_check_enter_irq(ux_t xepc) {
 	}
 }
 
-ux_t RVCSR::trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv) {
+ux_t RVCSR::trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv, std::optional<ux_t> xtval) {
 	if (target_priv == PRV_M) {
 		// Trap to M-mode
 		xstatus = (xstatus & ~MSTATUS_MPP) | (priv << 11);
-		priv = PRV_M;
+		set_priv(PRV_M);
 
 		if (xstatus & MSTATUS_MIE)
 			xstatus |= MSTATUS_MPIE;
@@ -205,6 +387,8 @@ ux_t RVCSR::trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv) {
 
 		mcause = xcause;
 		mepc = xepc;
+		if (xtval)
+			mtval = *xtval;
 		if ((mtvec & 0x1) && (xcause & (1u << 31))) {
 			return (mtvec & -2) + 4 * (xcause & ~(1u << 31));
 		} else {
@@ -214,7 +398,7 @@ ux_t RVCSR::trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv) {
 		// Trap to S-mode
 		assert(target_priv == PRV_S);
 		xstatus = (xstatus & ~SSTATUS_SPP) | (priv << 8);
-		priv = PRV_S;
+		set_priv(PRV_S);
 
 		if (xstatus & SSTATUS_SIE)
 			xstatus |= SSTATUS_SPIE;
@@ -222,6 +406,8 @@ ux_t RVCSR::trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv) {
 
 		scause = xcause;
 		sepc = xepc;
+		if (xtval)
+			stval = *xtval;
 
 		if ((stvec & 0x1) && (xcause & (1u << 31))) {
 			return (stvec & -2) + 4 * (xcause & ~(1u << 31));
@@ -232,15 +418,16 @@ ux_t RVCSR::trap_enter_at_priv(uint xcause, ux_t xepc, uint target_priv) {
 }
 
 ux_t RVCSR::trap_mret() {
-	priv = GETBITS(xstatus, 12, 11);
+	uint mpp = GETBITS(xstatus, 12, 11);
 	xstatus &= ~MSTATUS_MPP;
-	if (priv != PRV_M)
+	if (mpp != PRV_M)
 		xstatus &= ~MSTATUS_MPRV;
 
 	if (xstatus & MSTATUS_MPIE)
 		xstatus |= MSTATUS_MIE;
 	xstatus &= ~MSTATUS_MPIE;
 
+	set_priv(mpp);
 	return mepc;
 }
 
@@ -250,22 +437,15 @@ ux_t RVCSR::trap_sret(ux_t pc) {
 		// unwise, but we have to respect its decisions
 		return trap_enter_exception(XCAUSE_INSTR_ILLEGAL, pc);
 	} else {
-		priv = GETBIT(xstatus, 8);
+		uint spp = GETBIT(xstatus, 8);
 		xstatus &= ~SSTATUS_SPP;
 		if (xstatus & SSTATUS_SPIE)
 			xstatus |= SSTATUS_SIE;
 		xstatus &= ~SSTATUS_SPIE;
 		// Note target of sret is never M, so MPRV always cleared.
 		xstatus &= ~MSTATUS_MPRV;
+		set_priv(spp);
 		return sepc;
 	}
 }
 
-void RVCSR::trap_set_xtval(ux_t xtval) {
-	assert(priv >= PRV_S);
-	if (priv == PRV_S) {
-		stval = xtval;
-	} else {
-		mtval = xtval;
-	}
-}
@@ -0,0 +1,242 @@
+#include "rv_fdt.h"
+
+#include <cassert>
+#include <cstdio>
+
+enum {
+	FDT_MAGIC             = 0xd00dfeed,
+	FDT_VERSION           = 17,
+	FDT_LAST_COMP_VERSION = 16,
+	FDT_HEADER_SIZE       = 40,
+	FDT_RSVMAP_SIZE       = 16
+};
+
+enum {
+	FDT_BEGIN_NODE = 1,
+	FDT_END_NODE   = 2,
+	FDT_PROP       = 3,
+	FDT_END        = 9
+};
+
+// Extensions implemented by RVCore, beyond the single-letter ones in the
+// base ISA string
+static const char *isa_base = "rv32i";
+static const char *isa_single_letter = "imafdc";
+static const std::vector<std::string> isa_multi_letter = {
+	"zicbom", "zicboz", "zicntr", "zicsr", "zifencei",
+	"zba", "zbb", "zbs", "zve32x", "zve64x", "sstc"
+};
+static const uint32_t cbo_block_size = 64;
+
+void FDTWriter::push_u32(uint32_t x) {
+	uint8_t be[4] = {(uint8_t)(x >> 24), (uint8_t)(x >> 16), (uint8_t)(x >> 8), (uint8_t)x};
+	push_bytes(be, 4);
+}
+
+void FDTWriter::push_bytes(const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t*)data;
+	dt_struct.insert(dt_struct.end(), p, p + len);
+	while (dt_struct.size() % 4) {
+		dt_struct.push_back(0);
+	}
+}
+
+void FDTWriter::begin_node(const std::string &name) {
+	push_u32(FDT_BEGIN_NODE);
+	push_bytes(name.c_str(), name.size() + 1);
+}
+
+void FDTWriter::end_node() {
+	push_u32(FDT_END_NODE);
+}
+
+void FDTWriter::prop(const std::string &name, const void *data, size_t len) {
+	auto it = string_offsets.find(name);
+	uint32_t nameoff;
+	if (it != string_offsets.end()) {
+		nameoff = it->second;
+	} else {
+		nameoff = dt_strings.size();
+		string_offsets[name] = nameoff;
+		dt_strings.insert(dt_strings.end(), name.begin(), name.end());
+		dt_strings.push_back(0);
+	}
+	push_u32(FDT_PROP);
+	push_u32(len);
+	push_u32(nameoff);
+	push_bytes(data, len);
+}
+
+void FDTWriter::prop_empty(const std::string &name) {
+	prop(name, nullptr, 0);
+}
+
+void FDTWriter::prop_u32(const std::string &name, uint32_t value) {
+	prop_cells(name, {value});
+}
+
+void FDTWriter::prop_cells(const std::string &name, const std::vector<uint32_t> &cells) {
+	std::vector<uint8_t> be;
+	for (uint32_t x : cells) {
+		be.insert(be.end(), {(uint8_t)(x >> 24), (uint8_t)(x >> 16), (uint8_t)(x >> 8), (uint8_t)x});
+	}
+	prop(name, be.data(), be.size());
+}
+
+void FDTWriter::prop_str(const std::string &name, const std::string &value) {
+	prop(name, value.c_str(), value.size() + 1);
+}
+
+void FDTWriter::prop_strlist(const std::string &name, const std::vector<std::string> &values) {
+	std::string list;
+	for (const std::string &s : values) {
+		list += s;
+		list.push_back('\0');
+	}
+	prop(name, list.data(), list.size());
+}
+
+std::vector<uint8_t> FDTWriter::finish() {
+	push_u32(FDT_END);
+	uint32_t off_rsvmap = FDT_HEADER_SIZE;
+	uint32_t off_struct = off_rsvmap + FDT_RSVMAP_SIZE;
+	uint32_t off_strings = off_struct + dt_struct.size();
+	uint32_t total_size = off_strings + dt_strings.size();
+	uint32_t header[FDT_HEADER_SIZE / 4] = {
+		FDT_MAGIC,
+		total_size,
+		off_struct,
+		off_strings,
+		off_rsvmap,
+		FDT_VERSION,
+		FDT_LAST_COMP_VERSION,
+		0, // boot_cpuid_phys
+		(uint32_t)dt_strings.size(),
+		(uint32_t)dt_struct.size()
+	};
+	std::vector<uint8_t> blob;
+	for (uint32_t x : header) {
+		blob.insert(blob.end(), {(uint8_t)(x >> 24), (uint8_t)(x >> 16), (uint8_t)(x >> 8), (uint8_t)x});
+	}
+	blob.insert(blob.end(), FDT_RSVMAP_SIZE, 0);
+	blob.insert(blob.end(), dt_struct.begin(), dt_struct.end());
+	blob.insert(blob.end(), dt_strings.begin(), dt_strings.end());
+	assert(blob.size() == total_size);
+	return blob;
+}
+
+static std::string unit_name(const char *name, ux_t addr) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s@%x", name, addr);
+	return buf;
+}
+
+std::vector<uint8_t> fdt_build_machine(const FDTMachine &m) {
+	FDTWriter w;
+	// Phandles for each hart's interrupt controller are 1 through n_harts
+	const uint32_t intc_phandle_base = 1;
+
+	w.begin_node("");
+	w.prop_u32("#address-cells", 1);
+	w.prop_u32("#size-cells", 1);
+	w.prop_str("compatible", "rvcpp");
+	w.prop_str("model", "rvcpp");
+
+	w.begin_node("chosen");
+	for (const FDTDevice &dev : m.devices) {
+		if (dev.type == FDT_DEV_UART8250) {
+			w.prop_str("stdout-path", "/soc/" + unit_name("serial", dev.base));
+			break;
+		}
+	}
+	if (!m.bootargs.empty()) {
+		w.prop_str("bootargs", m.bootargs);
+	}
+	w.end_node();
+
+	w.begin_node("cpus");
+	w.prop_u32("#address-cells", 1);
+	w.prop_u32("#size-cells", 0);
+	w.prop_u32("timebase-frequency", m.timebase_freq);
+	std::vector<std::string> multi_letter = isa_multi_letter;
+	multi_letter.push_back(m.svade ? "svade" : "svadu");
+	std::string isa = std::string("rv32") + isa_single_letter;
+	for (const std::string &ext : multi_letter) {
+		isa += "_" + ext;
+	}
+	std::vector<std::string> isa_extensions;
+	for (const char *c = isa_single_letter; *c; ++c) {
+		isa_extensions.push_back(std::string(1, *c));
+	}
+	isa_extensions.insert(isa_extensions.end(), multi_letter.begin(), multi_letter.end());
+	for (uint hart = 0; hart < m.n_harts; ++hart) {
+		w.begin_node(unit_name("cpu", hart));
+		w.prop_str("device_type", "cpu");
+		w.prop_u32("reg", hart);
+		w.prop_str("status", "okay");
+		w.prop_str("compatible", "riscv");
+		w.prop_str("riscv,isa", isa);
+		w.prop_str("riscv,isa-base", isa_base);
+		w.prop_strlist("riscv,isa-extensions", isa_extensions);
+		w.prop_str("mmu-type", "riscv,sv32");
+		w.prop_u32("riscv,cbom-block-size", cbo_block_size);
+		w.prop_u32("riscv,cboz-block-size", cbo_block_size);
+		w.begin_node("interrupt-controller");
+		w.prop_u32("#interrupt-cells", 1);
+		w.prop_empty("interrupt-controller");
+		w.prop_str("compatible", "riscv,cpu-intc");
+		w.prop_u32("phandle", intc_phandle_base + hart);
+		w.end_node();
+		w.end_node();
+	}
+	w.end_node();
+
+	w.begin_node(unit_name("memory", m.ram_base));
+	w.prop_str("device_type", "memory");
+	w.prop_cells("reg", {m.ram_base, m.ram_size});
+	w.end_node();
+
+	w.begin_node("soc");
+	w.prop_u32("#address-cells", 1);
+	w.prop_u32("#size-cells", 1);
+	w.prop_str("compatible", "simple-bus");
+	w.prop_empty("ranges");
+	for (const FDTDevice &dev : m.devices) {
+		switch (dev.type) {
+		case FDT_DEV_TBIO:
+			w.begin_node(unit_name("testbench", dev.base));
+			w.prop_str("compatible", "rvcpp,tbio");
+			w.prop_cells("reg", {dev.base, dev.size});
+			w.end_node();
+			break;
+		case FDT_DEV_UART8250:
+			w.begin_node(unit_name("serial", dev.base));
+			w.prop_str("compatible", "ns16550a");
+			w.prop_cells("reg", {dev.base, dev.size});
+			w.prop_u32("reg-shift", 0);
+			w.prop_u32("reg-io-width", 1);
+			w.prop_u32("clock-frequency", 1843200);
+			w.end_node();
+			break;
+		case FDT_DEV_MTIMER: {
+			// mtime at +0, then one mtimecmp per hart. Not the CLINT or ACLINT
+			// layout, hence the simulator-specific compatible string.
+			w.begin_node(unit_name("timer", dev.base));
+			w.prop_str("compatible", "rvcpp,mtimer");
+			w.prop_cells("reg", {dev.base, dev.size});
+			std::vector<uint32_t> irqs;
+			for (uint hart = 0; hart < m.n_harts; ++hart) {
+				irqs.push_back(intc_phandle_base + hart);
+				irqs.push_back(7); // MTI
+			}
+			w.prop_cells("interrupts-extended", irqs);
+			w.end_node();
+			break;
+		}
+		}
+	}
+	w.end_node();
+
+	w.end_node();
+	return w.finish();
+}
@@ -0,0 +1,455 @@
+#include "rv_fpu.h"
+#include "encoding/rv_csr.h"
+
+#include <cfenv>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+
+template <typename F> struct FPFormat;
+
+template <> struct FPFormat<float> {
+	typedef uint32_t bits_t;
+	static constexpr bits_t SIGN          = 0x80000000u;
+	static constexpr bits_t EXP           = 0x7f800000u;
+	static constexpr bits_t QUIET         = 0x00400000u;
+	static constexpr bits_t CANONICAL_NAN = 0x7fc00000u;
+
+	// Improperly NaN-boxed values are treated as the canonical NaN
+	static bits_t unbox(uint64_t x) {
+		return x >> 32 == 0xffffffffu ? (bits_t)x : CANONICAL_NAN;
+	}
+
+	static uint64_t box(bits_t x) {
+		return fpu_nan_box(x);
+	}
+};
+
+template <> struct FPFormat<double> {
+	typedef uint64_t bits_t;
+	static constexpr bits_t SIGN          = 0x8000000000000000ull;
+	static constexpr bits_t EXP           = 0x7ff0000000000000ull;
+	static constexpr bits_t QUIET         = 0x0008000000000000ull;
+	static constexpr bits_t CANONICAL_NAN = 0x7ff8000000000000ull;
+
+	static bits_t unbox(uint64_t x) {
+		return x;
+	}
+
+	static uint64_t box(bits_t x) {
+		return x;
+	}
+};
+
+template <typename F>
+static F from_bits(typename FPFormat<F>::bits_t x) {
+	F f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+template <typename F>
+static typename FPFormat<F>::bits_t to_bits(F f) {
+	typename FPFormat<F>::bits_t x;
+	memcpy(&x, &f, sizeof(x));
+	return x;
+}
+
+template <typename F>
+static bool is_nan(typename FPFormat<F>::bits_t x) {
+	return (x & ~FPFormat<F>::SIGN) > FPFormat<F>::EXP;
+}
+
+template <typename F>
+static bool is_snan(typename FPFormat<F>::bits_t x) {
+	return is_nan<F>(x) && !(x & FPFormat<F>::QUIET);
+}
+
+// RISC-V never propagates NaN payloads, but the host does.
+template <typename F>
+static typename FPFormat<F>::bits_t canonicalise(F x) {
+	return std::isnan(x) ? FPFormat<F>::CANONICAL_NAN : to_bits<F>(x);
+}
+
+// ----------------------------------------------------------------------------
+// Host FPU state
+
+// The host rounding mode is left as the last-used mode, since most guest
+// code runs with a single static rounding mode. RMM runs as RNE on the host,
+// and is then fixed up in software.
+static int host_rounding_mode = FE_TONEAREST;
+
+static void host_begin(uint rm) {
+	int mode =
+		rm == FRM_RTZ ? FE_TOWARDZERO :
+		rm == FRM_RDN ? FE_DOWNWARD :
+		rm == FRM_RUP ? FE_UPWARD : FE_TONEAREST;
+	if (mode != host_rounding_mode) {
+		fesetround(mode);
+		host_rounding_mode = mode;
+	}
+	feclearexcept(FE_ALL_EXCEPT);
+}
+
+static uint host_end() {
+	int exc = fetestexcept(FE_ALL_EXCEPT);
+	return
+		(exc & FE_INEXACT   ? FPEXC_NX : 0) |
+		(exc & FE_UNDERFLOW ? FPEXC_UF : 0) |
+		(exc & FE_OVERFLOW  ? FPEXC_OF : 0) |
+		(exc & FE_DIVBYZERO ? FPEXC_DZ : 0) |
+		(exc & FE_INVALID   ? FPEXC_NV : 0);
+}
+
+// Operands and results pass through volatiles, to stop the compiler moving
+// host arithmetic outside of the host_begin()/host_end() window.
+template <typename T>
+static T launder(T x) {
+	volatile T v = x;
+	return v;
+}
+
+// The host has no round-to-nearest-ties-to-max-magnitude mode, so RMM
+// operations are performed as RNE, and the caller supplies the exact error
+// of the RNE result (exact = r + err). The two modes differ only when the
+// exact result is halfway between two representable values, and RNE picked
+// the one closer to zero.
+template <typename F>
+static F rmm_fixup(F r, double err) {
+	if (err == 0 || !std::isfinite(r) || std::signbit(err) != std::signbit(r))
+		return r;
+	F away = std::nextafter(r, std::copysign((F)INFINITY, r));
+	if ((double)(away - r) == 2 * err)
+		return away;
+	else
+		return r;
+}
+
+// Whether a sum of terms is exactly zero. The terms are accumulated into a
+// nonoverlapping expansion (Shewchuk's Grow-Expansion, built from TwoSum, so
+// with no rounding error as long as nothing overflows), and the sum of such
+// an expansion is zero only if every component is. Needs the host to be in
+// round-to-nearest mode.
+static bool exact_sum_is_zero(std::initializer_list<long double> terms) {
+	long double e[8];
+	uint n = 0;
+	for (long double x : terms) {
+		long double q = x;
+		for (uint i = 0; i < n; ++i) {
+			long double s = q + e[i];
+			long double bb = s - q;
+			e[i] = (q - (s - bb)) + (e[i] - bb);
+			q = s;
+		}
+		e[n++] = q;
+	}
+	for (uint i = 0; i < n; ++i) {
+		if (e[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Arithmetic
+
+template <typename F>
+static F fp_add(F a, F b, uint rm, uint &fflags) {
+	host_begin(rm);
+	volatile F r = launder(a) + launder(b);
+	fflags |= host_end();
+	if (rm == FRM_RMM) {
+		// TwoSum: exact error of an RNE addition
+		F s = r;
+		F bb = s - a;
+		return rmm_fixup<F>(s, (a - (s - bb)) + (b - bb));
+	}
+	return r;
+}
+
+template <typename F>
+static F fp_mul(F a, F b, uint rm, uint &fflags) {
+	host_begin(rm);
+	volatile F r = launder(a) * launder(b);
+	fflags |= host_end();
+	if (rm == FRM_RMM)
+		return rmm_fixup<F>(r, std::fma(a, b, -(F)r));
+	return r;
+}
+
+// A quotient or square root can only be exactly halfway between two
+// representable values if the result is subnormal. We don't fix up RMM ties
+// for these (the result is RNE).
+template <typename F>
+static F fp_div(F a, F b, uint rm, uint &fflags) {
+	host_begin(rm);
+	volatile F r = launder(a) / launder(b);
+	fflags |= host_end();
+	return r;
+}
+
+template <typename F>
+static F fp_sqrt(F a, uint rm, uint &fflags) {
+	host_begin(rm);
+	volatile F r = std::sqrt(launder(a));
+	fflags |= host_end();
+	return r;
+}
+
+// The exact error of an FMA is not generally representable, so RMM ties are
+// found in software instead: the exact result is a tie which RNE rounded
+// towards zero if a * b + c - r - half an ulp (away from zero) is exactly
+// zero. a * b is split into a long double product and its exact error,
+// which needs no more exponent range than long double has for float or
+// double operands.
+template <typename F>
+static F fp_fma(F a, F b, F c, uint rm, uint &fflags) {
+	host_begin(rm);
+	volatile F r = std::fma(launder(a), launder(b), launder(c));
+	fflags |= host_end();
+	// RISC-V requires inf * 0 to be invalid even when the addend is a quiet
+	// NaN; IEEE 754 leaves this to the implementation.
+	if ((std::isinf(a) && b == 0) || (a == 0 && std::isinf(b)))
+		fflags |= FPEXC_NV;
+	if (rm == FRM_RMM && std::isfinite(r)) {
+		F rne = r;
+		F away = std::nextafter(rne, std::copysign((F)INFINITY, rne));
+		long double half = ((long double)away - rne) / 2;
+		long double p = (long double)a * b;
+		long double p_err = std::fma((long double)a, (long double)b, -p);
+		if (exact_sum_is_zero({p, p_err, c, -(long double)rne, -half}))
+			return away;
+	}
+	return r;
+}
+
+// Convert a double to F with host rounding (RMM fixed up in software).
+template <typename F>
+static F fp_narrow(double x, uint rm, uint &fflags) {
+	host_begin(rm);
+	volatile F r = (F)launder(x);
+	fflags |= host_end();
+	if (rm == FRM_RMM && std::isfinite(x))
+		return rmm_fixup<F>(r, x - (double)r);
+	return r;
+}
+
+template <typename F>
+static ux_t fp_to_int(F x, bool is_signed, uint rm, uint &fflags) {
+	if (std::isnan(x)) {
+		fflags |= FPEXC_NV;
+		return is_signed ? 0x7fffffffu : 0xffffffffu;
+	}
+	// Rounding to integer is exact, so raises no flags (NaNs already handled)
+	F r;
+	if (rm == FRM_RTZ) {
+		r = std::trunc(x);
+	} else if (rm == FRM_RDN) {
+		r = std::floor(x);
+	} else if (rm == FRM_RUP) {
+		r = std::ceil(x);
+	} else if (rm == FRM_RMM) {
+		r = std::round(x);
+	} else {
+		host_begin(FRM_RNE);
+		r = std::nearbyint(x);
+	}
+	double lo = is_signed ? -2147483648.0 : 0.0;
+	double hi = is_signed ?  2147483647.0 : 4294967295.0;
+	if ((double)r < lo || (double)r > hi) {
+		fflags |= FPEXC_NV;
+		if (r < 0)
+			return is_signed ? 0x80000000u : 0u;
+		else
+			return is_signed ? 0x7fffffffu : 0xffffffffu;
+	}
+	if (r != x)
+		fflags |= FPEXC_NX;
+	return is_signed ? (ux_t)(sx_t)r : (ux_t)r;
+}
+
+template <typename F>
+static typename FPFormat<F>::bits_t fp_minmax(typename FPFormat<F>::bits_t a, typename FPFormat<F>::bits_t b,
+		bool is_max, uint &fflags) {
+	if (is_snan<F>(a) || is_snan<F>(b))
+		fflags |= FPEXC_NV;
+	if (is_nan<F>(a) && is_nan<F>(b))
+		return FPFormat<F>::CANONICAL_NAN;
+	else if (is_nan<F>(a))
+		return b;
+	else if (is_nan<F>(b))
+		return a;
+	F fa = from_bits<F>(a);
+	F fb = from_bits<F>(b);
+	if (fa == fb) {
+		// Only differ if +0/-0; -0 is considered less than +0.
+		bool a_neg = a & FPFormat<F>::SIGN;
+		return a_neg != is_max ? a : b;
+	}
+	return (fa < fb) != is_max ? a : b;
+}
+
+template <typename F>
+static ux_t fp_compare(typename FPFormat<F>::bits_t a, typename FPFormat<F>::bits_t b, uint funct3, uint &fflags) {
+	if (is_nan<F>(a) || is_nan<F>(b)) {
+		// FEQ is a quiet comparison, FLT/FLE are signalling
+		if (funct3 != 0b010 || is_snan<F>(a) || is_snan<F>(b))
+			fflags |= FPEXC_NV;
+		return 0;
+	}
+	F fa = from_bits<F>(a);
+	F fb = from_bits<F>(b);
+	if (funct3 == 0b010)
+		return fa == fb;
+	else if (funct3 == 0b001)
+		return fa < fb;
+	else
+		return fa <= fb;
+}
+
+template <typename F>
+static ux_t fp_classify(typename FPFormat<F>::bits_t a) {
+	bool neg = a & FPFormat<F>::SIGN;
+	switch (std::fpclassify(from_bits<F>(a))) {
+		case FP_INFINITE:  return neg ? 1u << 0 : 1u << 7;
+		case FP_NORMAL:    return neg ? 1u << 1 : 1u << 6;
+		case FP_SUBNORMAL: return neg ? 1u << 2 : 1u << 5;
+		case FP_ZERO:      return neg ? 1u << 3 : 1u << 4;
+		default:           return is_snan<F>(a) ? 1u << 8 : 1u << 9;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Instruction decode
+
+template <typename F>
+static std::optional<FPUResult> fpu_execute_fmt(uint32_t instr, uint frm, ux_t xrs1,
+		uint64_t frs1, uint64_t frs2, uint64_t frs3, uint &fflags) {
+	typedef FPFormat<F> fmt;
+	typedef typename fmt::bits_t bits_t;
+	constexpr bool is_single = sizeof(F) == sizeof(float);
+
+	uint opc    = instr & 0x7f;
+	uint funct5 = instr >> 27;
+	uint funct3 = instr >> 12 & 0x7;
+	uint rs2    = instr >> 20 & 0x1f;
+	uint rm     = funct3 == FRM_DYN ? frm : funct3;
+	bool rm_ok  = rm <= FRM_RMM;
+
+	bits_t a_bits = fmt::unbox(frs1);
+	bits_t b_bits = fmt::unbox(frs2);
+	bits_t c_bits = fmt::unbox(frs3);
+	F a = from_bits<F>(a_bits);
+	F b = from_bits<F>(b_bits);
+	F c = from_bits<F>(c_bits);
+
+	auto fp_result  = [](F x)      {return FPUResult{fmt::box(canonicalise<F>(x)), false};};
+	auto raw_result = [](bits_t x) {return FPUResult{fmt::box(x), false};};
+	auto int_result = [](ux_t x)   {return FPUResult{x, true};};
+
+	if (opc != 0b1010011) {
+		// Fused multiply-add: negation is applied to the operands, which
+		// is exact, and doesn't affect NaN results since they're canonical.
+		if (!rm_ok)
+			return std::nullopt;
+		switch (opc) {
+			case 0b1000011: return fp_result(fp_fma<F>( a, b,  c, rm, fflags)); // FMADD
+			case 0b1000111: return fp_result(fp_fma<F>( a, b, -c, rm, fflags)); // FMSUB
+			case 0b1001011: return fp_result(fp_fma<F>(-a, b,  c, rm, fflags)); // FNMSUB
+			case 0b1001111: return fp_result(fp_fma<F>(-a, b, -c, rm, fflags)); // FNMADD
+			default:        return std::nullopt;
+		}
+	}
+
+	switch (funct5) {
+	case 0b00000:
+		if (rm_ok)
+			return fp_result(fp_add<F>(a, b, rm, fflags));
+		break;
+	case 0b00001:
+		if (rm_ok)
+			return fp_result(fp_add<F>(a, -b, rm, fflags));
+		break;
+	case 0b00010:
+		if (rm_ok)
+			return fp_result(fp_mul<F>(a, b, rm, fflags));
+		break;
+	case 0b00011:
+		if (rm_ok)
+			return fp_result(fp_div<F>(a, b, rm, fflags));
+		break;
+	case 0b01011:
+		if (rm_ok && rs2 == 0)
+			return fp_result(fp_sqrt<F>(a, rm, fflags));
+		break;
+	case 0b00100:
+		// Sign injection does not canonicalise NaNs
+		if (funct3 == 0b000)
+			return raw_result((a_bits & ~fmt::SIGN) | (b_bits & fmt::SIGN));
+		else if (funct3 == 0b001)
+			return raw_result((a_bits & ~fmt::SIGN) | (~b_bits & fmt::SIGN));
+		else if (funct3 == 0b010)
+			return raw_result(a_bits ^ (b_bits & fmt::SIGN));
+		break;
+	case 0b00101:
+		if (funct3 <= 0b001)
+			return raw_result(fp_minmax<F>(a_bits, b_bits, funct3 == 0b001, fflags));
+		break;
+	case 0b01000:
+		// Conversion from the other format (fmt is the destination format)
+		if (!rm_ok) {
+			break;
+		} else if (is_single && rs2 == 1) {
+			double x = from_bits<double>(frs1);
+			return fp_result(fp_narrow<F>(x, rm, fflags));
+		} else if (!is_single && rs2 == 0) {
+			float x = from_bits<float>(FPFormat<float>::unbox(frs1));
+			host_begin(rm);
+			volatile F r = launder(x);
+			fflags |= host_end();
+			return fp_result(r);
+		}
+		break;
+	case 0b10100:
+		if (funct3 <= 0b010)
+			return int_result(fp_compare<F>(a_bits, b_bits, funct3, fflags));
+		break;
+	case 0b11000:
+		if (rm_ok && rs2 <= 1)
+			return int_result(fp_to_int<F>(a, rs2 == 0, rm, fflags));
+		break;
+	case 0b11010:
+		if (rm_ok && rs2 <= 1) {
+			double x = rs2 == 0 ? (double)(sx_t)xrs1 : (double)xrs1;
+			return fp_result(fp_narrow<F>(x, rm, fflags));
+		}
+		break;
+	case 0b11100:
+		// FMV.X.W moves the raw register bits, without unboxing. There is
+		// no FMV.X.D on RV32.
+		if (rs2 == 0 && funct3 == 0b000 && is_single)
+			return int_result(frs1 & 0xffffffffu);
+		else if (rs2 == 0 && funct3 == 0b001)
+			return int_result(fp_classify<F>(a_bits));
+		break;
+	case 0b11110:
+		if (rs2 == 0 && funct3 == 0b000 && is_single)
+			return raw_result(xrs1);
+		break;
+	default:
+		break;
+	}
+	return std::nullopt;
+}
+
+std::optional<FPUResult> fpu_execute(uint32_t instr, uint frm, ux_t xrs1,
+		uint64_t frs1, uint64_t frs2, uint64_t frs3, uint &fflags) {
+	uint fmt = GETBITS(instr, 26, 25);
+	if (fmt == 0b00) {
+		return fpu_execute_fmt<float>(instr, frm, xrs1, frs1, frs2, frs3, fflags);
+	} else if (fmt == 0b01) {
+		return fpu_execute_fmt<double>(instr, frm, xrs1, frs1, frs2, frs3, fflags);
+	} else {
+		return std::nullopt;
+	}
+}
@@ -0,0 +1,480 @@
+#include "rv_linux_user.h"
+#include "rv_core.h"
+#include "encoding/rv_csr.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+// Linux syscall numbers for RV32 (asm-generic table, time64 only)
+enum {
+	SYS_IOCTL              = 29,
+	SYS_OPENAT             = 56,
+	SYS_CLOSE              = 57,
+	SYS_LLSEEK             = 62,
+	SYS_READ               = 63,
+	SYS_WRITE              = 64,
+	SYS_READV              = 65,
+	SYS_WRITEV             = 66,
+	SYS_EXIT               = 93,
+	SYS_EXIT_GROUP         = 94,
+	SYS_SET_TID_ADDRESS    = 96,
+	SYS_SET_ROBUST_LIST    = 99,
+	SYS_RT_SIGACTION       = 134,
+	SYS_RT_SIGPROCMASK     = 135,
+	SYS_UNAME              = 160,
+	SYS_GETPID             = 172,
+	SYS_GETUID             = 174,
+	SYS_GETEUID            = 175,
+	SYS_GETGID             = 176,
+	SYS_GETEGID            = 177,
+	SYS_GETTID             = 178,
+	SYS_BRK                = 214,
+	SYS_MUNMAP             = 215,
+	SYS_MMAP               = 222,
+	SYS_MPROTECT           = 226,
+	SYS_MADVISE            = 233,
+	SYS_PRLIMIT64          = 261,
+	SYS_GETRANDOM          = 278,
+	SYS_STATX              = 291,
+	SYS_CLOCK_GETTIME64    = 403
+};
+
+enum {
+	PAGE_SIZE  = 4096,
+	STACK_SIZE = 8 * 1024 * 1024,
+	// Load address for position-independent (static-pie) executables
+	PIE_BASE   = 0x10000
+};
+
+// Guest flag and struct layouts which differ from (or are not guaranteed to
+// match) the host's. Open flags, AT_* flags, errno values, struct statx and
+// struct iovec/timespec field order are the asm-generic ones on both sides,
+// which assumes a Linux host.
+enum {
+	GUEST_MAP_FIXED     = 0x10,
+	GUEST_MAP_ANONYMOUS = 0x20,
+	GUEST_TCGETS        = 0x5401,
+	GUEST_TIOCGWINSZ    = 0x5413,
+	GUEST_TERMIOS_SIZE  = 36,
+	GUEST_UTSNAME_LEN   = 65,
+	GUEST_RLIMIT_STACK  = 3,
+	GUEST_IOV_MAX       = 1024
+};
+
+static ux_t page_round_up(ux_t x) {
+	return (x + PAGE_SIZE - 1) & -(ux_t)PAGE_SIZE;
+}
+
+static sx_t host_result(long result) {
+	return result < 0 ? -errno : (sx_t)result;
+}
+
+uint8_t *LinuxUser::guest_ptr(RVCore &core, ux_t addr, ux_t size, bool for_write) {
+	if (addr < core.ram_base || addr > core.ram_top || size > core.ram_top - addr) {
+		return nullptr;
+	}
+	if (for_write) {
+		core.code_cache.write(addr, size);
+	}
+	return (uint8_t*)core.ram + (addr - core.ram_base);
+}
+
+const char *LinuxUser::guest_str(RVCore &core, ux_t addr) {
+	const char *s = (const char*)guest_ptr(core, addr, 1, false);
+	if (!s || !memchr(s, 0, core.ram_top - addr)) {
+		return nullptr;
+	}
+	return s;
+}
+
+bool LinuxUser::load(RVCore &core, const std::string &path, const std::vector<std::string> &argv,
+		const std::vector<std::string> &envp) {
+	std::ifstream fd(path, std::ios::binary);
+	if (!fd) {
+		fprintf(stderr, "Can't open ELF file \"%s\"\n", path.c_str());
+		return false;
+	}
+	std::vector<char> file((std::istreambuf_iterator<char>(fd)), std::istreambuf_iterator<char>());
+
+	Elf32_Ehdr ehdr;
+	if (file.size() < sizeof(ehdr)) {
+		fprintf(stderr, "\"%s\" is not an ELF file\n", path.c_str());
+		return false;
+	}
+	memcpy(&ehdr, file.data(), sizeof(ehdr));
+	if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS32 ||
+			ehdr.e_ident[EI_DATA] != ELFDATA2LSB || ehdr.e_machine != EM_RISCV) {
+		fprintf(stderr, "\"%s\" is not an RV32 little-endian ELF file\n", path.c_str());
+		return false;
+	}
+	if (ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN) {
+		fprintf(stderr, "\"%s\" is not an executable\n", path.c_str());
+		return false;
+	}
+	if (ehdr.e_phentsize != sizeof(Elf32_Phdr) ||
+			(uint64_t)ehdr.e_phoff + (uint64_t)ehdr.e_phnum * sizeof(Elf32_Phdr) > file.size()) {
+		fprintf(stderr, "\"%s\" has a malformed program header table\n", path.c_str());
+		return false;
+	}
+	// Position-independent executables relocate themselves, given the
+	// addresses passed in auxv.
+	ux_t load_bias = ehdr.e_type == ET_DYN ? core.ram_base + PIE_BASE : 0;
+
+	ux_t load_end = 0;
+	ux_t phdr_addr = 0;
+	for (uint i = 0; i < ehdr.e_phnum; ++i) {
+		Elf32_Phdr phdr;
+		memcpy(&phdr, &file[ehdr.e_phoff + i * sizeof(phdr)], sizeof(phdr));
+		if (phdr.p_type == PT_INTERP) {
+			fprintf(stderr, "\"%s\" is dynamically linked, only static executables are supported\n",
+				path.c_str());
+			return false;
+		}
+		if (phdr.p_type != PT_LOAD) {
+			continue;
+		}
+		ux_t vaddr = phdr.p_vaddr + load_bias;
+		uint8_t *dst = guest_ptr(core, vaddr, phdr.p_memsz, true);
+		if (!dst || phdr.p_filesz > phdr.p_memsz || (uint64_t)phdr.p_offset + phdr.p_filesz > file.size()) {
+			fprintf(stderr, "Segment at %08x (%u bytes) does not fit in RAM (%08x through %08x)\n",
+				vaddr, phdr.p_memsz, core.ram_base, core.ram_top - 1);
+			return false;
+		}
+		memcpy(dst, &file[phdr.p_offset], phdr.p_filesz);
+		memset(dst + phdr.p_filesz, 0, phdr.p_memsz - phdr.p_filesz);
+		if (ehdr.e_phoff >= phdr.p_offset && ehdr.e_phoff - phdr.p_offset < phdr.p_filesz) {
+			phdr_addr = vaddr + (ehdr.e_phoff - phdr.p_offset);
+		}
+		load_end = std::max(load_end, vaddr + phdr.p_memsz);
+	}
+
+	brk_start = page_round_up(load_end);
+	brk_cur = brk_start;
+	mmap_top = (core.ram_top - STACK_SIZE) & -(ux_t)PAGE_SIZE;
+	mmap_bottom = mmap_top;
+	if (mmap_bottom < brk_start) {
+		fprintf(stderr, "Not enough RAM for the program and an %u byte stack\n", (uint)STACK_SIZE);
+		return false;
+	}
+
+	// Strings go at the top of the stack, followed by the pointer arrays.
+	ux_t sp = core.ram_top;
+	auto push_bytes = [&](const void *data, ux_t size) {
+		sp -= size;
+		memcpy(guest_ptr(core, sp, size, true), data, size);
+		return sp;
+	};
+	std::vector<ux_t> argv_addr, envp_addr;
+	for (const std::string &s : argv) {
+		argv_addr.push_back(push_bytes(s.c_str(), s.size() + 1));
+	}
+	for (const std::string &s : envp) {
+		envp_addr.push_back(push_bytes(s.c_str(), s.size() + 1));
+	}
+	uint8_t random_bytes[16];
+	if (getrandom(random_bytes, sizeof(random_bytes), 0) != sizeof(random_bytes)) {
+		memset(random_bytes, 0x5a, sizeof(random_bytes));
+	}
+	ux_t random_addr = push_bytes(random_bytes, sizeof(random_bytes));
+
+	// Single-letter extensions, as in misa. V is not reported, as only
+	// Zve64x is implemented.
+	ux_t hwcap = 0;
+	for (char c : std::string("imafdc")) {
+		hwcap |= 1u << (c - 'a');
+	}
+	std::vector<std::pair<ux_t, ux_t>> auxv = {
+		{AT_PHDR,   phdr_addr},
+		{AT_PHENT,  sizeof(Elf32_Phdr)},
+		{AT_PHNUM,  ehdr.e_phnum},
+		{AT_PAGESZ, PAGE_SIZE},
+		{AT_ENTRY,  ehdr.e_entry + load_bias},
+		{AT_UID,    0},
+		{AT_EUID,   0},
+		{AT_GID,    0},
+		{AT_EGID,   0},
+		{AT_HWCAP,  hwcap},
+		{AT_CLKTCK, 100},
+		{AT_SECURE, 0},
+		{AT_RANDOM, random_addr},
+		{AT_NULL,   0}
+	};
+	std::vector<ux_t> words;
+	words.push_back(argv_addr.size());
+	words.insert(words.end(), argv_addr.begin(), argv_addr.end());
+	words.push_back(0);
+	words.insert(words.end(), envp_addr.begin(), envp_addr.end());
+	words.push_back(0);
+	for (auto [key, value] : auxv) {
+		words.push_back(key);
+		words.push_back(value);
+	}
+	sp = (sp - words.size() * sizeof(ux_t)) & -16u;
+	if (sp < mmap_bottom) {
+		fprintf(stderr, "Arguments and environment are too large for the stack\n");
+		return false;
+	}
+	memcpy(guest_ptr(core, sp, words.size() * sizeof(ux_t), true), words.data(), words.size() * sizeof(ux_t));
+
+	// Enter the program in U-mode, with the FPU and vector unit enabled and
+	// counters readable, as a Linux kernel would. Linux also emulates
+	// misaligned accesses from user code. PMP grants U-mode access to all
+	// of memory.
+	RVCSR &csr = core.csr;
+	csr.write(CSR_MCOUNTEREN, 0x7);
+	csr.write(CSR_SCOUNTEREN, 0x7);
+	csr.write(CSR_PMPADDR0, -1u);
+	csr.write(CSR_PMPCFG0, PMP_NAPOT | PMP_R | PMP_W | PMP_X);
+	csr.write(CSR_MSTATUS, MSTATUS_MPP, RVCSR::WRITE_CLEAR);
+	csr.write(CSR_MSTATUS, MSTATUS_FS_INITIAL | MSTATUS_VS_INITIAL, RVCSR::WRITE_SET);
+	csr.write(CSR_MEPC, ehdr.e_entry + load_bias);
+	core.allow_misaligned = true;
+	core.regs[2] = sp;
+	core.pc = csr.trap_mret();
+	return true;
+}
+
+sx_t LinuxUser::sys_brk(RVCore &core, ux_t addr) {
+	// Returns the new break on success, or the old one on failure
+	if (addr >= brk_start && addr <= mmap_bottom) {
+		if (addr > brk_cur) {
+			memset(guest_ptr(core, brk_cur, addr - brk_cur, true), 0, addr - brk_cur);
+		}
+		brk_cur = addr;
+	}
+	return brk_cur;
+}
+
+sx_t LinuxUser::sys_mmap(RVCore &core, const ux_t *args) {
+	ux_t addr = args[0];
+	ux_t len = page_round_up(args[1]);
+	ux_t flags = args[3];
+	int fd = args[4];
+	// Offset is in units of 4096 bytes on 32-bit targets (mmap2)
+	off_t offset = (off_t)args[5] * 4096;
+	if (len == 0) {
+		return -EINVAL;
+	}
+	if (flags & GUEST_MAP_FIXED) {
+		if (addr & (PAGE_SIZE - 1) || !guest_ptr(core, addr, len, false)) {
+			return -EINVAL;
+		}
+	} else {
+		// Allocations are never reused, apart from unmapping the most recent
+		// one, which is enough for a program that mostly allocates at startup.
+		if (len > mmap_bottom - brk_cur) {
+			return -ENOMEM;
+		}
+		mmap_bottom -= len;
+		addr = mmap_bottom;
+	}
+	uint8_t *dst = guest_ptr(core, addr, len, true);
+	memset(dst, 0, len);
+	if (!(flags & GUEST_MAP_ANONYMOUS)) {
+		// Private file mappings are copied in. Shared mappings are not
+		// written back.
+		if (pread(fd, dst, args[1], offset) < 0) {
+			return -errno;
+		}
+	}
+	return addr;
+}
+
+sx_t LinuxUser::sys_munmap(ux_t addr, ux_t len) {
+	if (addr & (PAGE_SIZE - 1)) {
+		return -EINVAL;
+	}
+	if (addr == mmap_bottom) {
+		mmap_bottom = std::min(mmap_bottom + page_round_up(len), mmap_top);
+	}
+	return 0;
+}
+
+sx_t LinuxUser::syscall(RVCore &core, ux_t num, const ux_t *args) {
+	switch (num) {
+	case SYS_READ:
+	case SYS_WRITE: {
+		uint8_t *buf = guest_ptr(core, args[1], args[2], num == SYS_READ);
+		if (!buf) {
+			return -EFAULT;
+		}
+		return host_result(num == SYS_READ ? read(args[0], buf, args[2]) : write(args[0], buf, args[2]));
+	}
+	case SYS_READV:
+	case SYS_WRITEV: {
+		// struct iovec is {base, len}, 32 bits each. The count is checked
+		// first so that the size of the array can't overflow.
+		if (args[2] > GUEST_IOV_MAX) {
+			return -EINVAL;
+		}
+		const ux_t *iov = (const ux_t*)guest_ptr(core, args[1], args[2] * 2 * sizeof(ux_t), false);
+		if (!iov) {
+			return -EFAULT;
+		}
+		sx_t total = 0;
+		for (ux_t i = 0; i < args[2]; ++i) {
+			ux_t len = iov[2 * i + 1];
+			uint8_t *buf = guest_ptr(core, iov[2 * i], len, num == SYS_READV);
+			if (!buf) {
+				return total ? total : -EFAULT;
+			}
+			long n = num == SYS_READV ? read(args[0], buf, len) : write(args[0], buf, len);
+			if (n < 0) {
+				return total ? total : -errno;
+			}
+			total += n;
+			if ((ux_t)n < len) {
+				break;
+			}
+		}
+		return total;
+	}
+	case SYS_OPENAT: {
+		const char *path = guest_str(core, args[1]);
+		if (!path) {
+			return -EFAULT;
+		}
+		return host_result(openat((int)args[0], path, (int)args[2], (mode_t)args[3]));
+	}
+	case SYS_CLOSE:
+		// Keep the simulator's own stdio open
+		if (args[0] <= 2) {
+			return 0;
+		}
+		return host_result(close(args[0]));
+	case SYS_LLSEEK: {
+		// llseek(fd, offset_hi, offset_lo, result *, whence)
+		uint8_t *result = guest_ptr(core, args[3], 8, true);
+		if (!result) {
+			return -EFAULT;
+		}
+		off_t pos = lseek(args[0], (off_t)((uint64_t)args[1] << 32 | args[2]), args[4]);
+		if (pos < 0) {
+			return -errno;
+		}
+		int64_t pos64 = pos;
+		memcpy(result, &pos64, 8);
+		return 0;
+	}
+	case SYS_STATX: {
+		const char *path = guest_str(core, args[1]);
+		uint8_t *buf = guest_ptr(core, args[4], sizeof(struct statx), true);
+		if (!path || !buf) {
+			return -EFAULT;
+		}
+		return host_result(statx((int)args[0], path, (int)args[2], args[3], (struct statx*)buf));
+	}
+	case SYS_IOCTL:
+		// Just enough for libc to tell whether stdio is a terminal
+		if (args[1] == GUEST_TCGETS) {
+			uint8_t *buf = guest_ptr(core, args[2], GUEST_TERMIOS_SIZE, true);
+			if (!buf) {
+				return -EFAULT;
+			}
+			if (!isatty(args[0])) {
+				return -ENOTTY;
+			}
+			memset(buf, 0, GUEST_TERMIOS_SIZE);
+			return 0;
+		} else if (args[1] == GUEST_TIOCGWINSZ) {
+			uint8_t *buf = guest_ptr(core, args[2], sizeof(struct winsize), true);
+			if (!buf) {
+				return -EFAULT;
+			}
+			return host_result(ioctl(args[0], TIOCGWINSZ, buf));
+		}
+		return -ENOTTY;
+	case SYS_EXIT:
+	case SYS_EXIT_GROUP:
+		fflush(stdout);
+		throw TBExitException(args[0]);
+	case SYS_BRK:
+		return sys_brk(core, args[0]);
+	case SYS_MMAP:
+		return sys_mmap(core, args);
+	case SYS_MUNMAP:
+		return sys_munmap(args[0], args[1]);
+	case SYS_MPROTECT:
+	case SYS_MADVISE:
+	case SYS_SET_ROBUST_LIST:
+	case SYS_RT_SIGACTION:
+	case SYS_RT_SIGPROCMASK:
+		// No memory protection or signals, so nothing to do
+		return 0;
+	case SYS_SET_TID_ADDRESS:
+	case SYS_GETPID:
+	case SYS_GETTID:
+		return host_result(getpid());
+	case SYS_GETUID:
+	case SYS_GETEUID:
+	case SYS_GETGID:
+	case SYS_GETEGID:
+		return 0;
+	case SYS_UNAME: {
+		char *buf = (char*)guest_ptr(core, args[0], 6 * GUEST_UTSNAME_LEN, true);
+		if (!buf) {
+			return -EFAULT;
+		}
+		const char *fields[6] = {"Linux", "rvcpp", "6.6.0", "#1", "riscv32", "(none)"};
+		memset(buf, 0, 6 * GUEST_UTSNAME_LEN);
+		for (int i = 0; i < 6; ++i) {
+			strcpy(buf + i * GUEST_UTSNAME_LEN, fields[i]);
+		}
+		return 0;
+	}
+	case SYS_PRLIMIT64: {
+		// Report everything as unlimited, apart from the stack
+		if (args[3]) {
+			uint64_t *old = (uint64_t*)guest_ptr(core, args[3], 16, true);
+			if (!old) {
+				return -EFAULT;
+			}
+			old[0] = old[1] = args[1] == GUEST_RLIMIT_STACK ? (uint64_t)STACK_SIZE : -1ull;
+		}
+		return 0;
+	}
+	case SYS_GETRANDOM: {
+		uint8_t *buf = guest_ptr(core, args[0], args[1], true);
+		if (!buf) {
+			return -EFAULT;
+		}
+		return host_result(getrandom(buf, args[1], args[2]));
+	}
+	case SYS_CLOCK_GETTIME64: {
+		int64_t *tp = (int64_t*)guest_ptr(core, args[1], 16, true);
+		if (!tp) {
+			return -EFAULT;
+		}
+		struct timespec ts;
+		if (clock_gettime((clockid_t)args[0], &ts) < 0) {
+			return -errno;
+		}
+		tp[0] = ts.tv_sec;
+		tp[1] = ts.tv_nsec;
+		return 0;
+	}
+	default:
+		fprintf(stderr, "Unimplemented syscall %u at pc %08x\n", num, core.pc);
+		return -ENOSYS;
+	}
+}
+
+bool LinuxUser::ecall(RVCore &core, uint priv) {
+	if (priv != PRV_U) {
+		return false;
+	}
+	ux_t *a = &core.regs[10];
+	a[0] = syscall(core, a[7], a);
+	return true;
+}
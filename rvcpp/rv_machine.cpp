@@ -0,0 +1,266 @@
+#include "rv_machine.h"
+#include "mmio/uart8250.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+// Fixed register-block sizes for each device type
+static const std::map<MachineRegionType, ux_t> device_sizes = {
+	{REGION_TBIO,     12},
+	{REGION_UART8250, 8},
+	{REGION_MTIMER,   8 * (MTIMER_N_HARTS + 1)}
+};
+
+static const std::map<std::string, MachineRegionType> region_type_names = {
+	{"ram",      REGION_RAM},
+	{"rom",      REGION_ROM},
+	{"tbio",     REGION_TBIO},
+	{"uart8250", REGION_UART8250},
+	{"mtimer",   REGION_MTIMER}
+};
+
+MachineConfig machine_config_default(ux_t ram_base, ux_t ram_size) {
+	MachineConfig config;
+	config.n_harts = 1;
+	config.mtime_div = 0x1000;
+	config.clock_hz = 50000000;
+	config.reset_vector = ram_base;
+	config.regions = {
+		{REGION_RAM,      "ram",      ram_base,   ram_size, {}},
+		{REGION_TBIO,     "tbio",     0xe0000000, device_sizes.at(REGION_TBIO), {}},
+		{REGION_UART8250, "uart8250", 0xe0004000, device_sizes.at(REGION_UART8250), {}},
+		{REGION_MTIMER,   "mtimer",   0xe0008000, device_sizes.at(REGION_MTIMER), {}}
+	};
+	return config;
+}
+
+static std::string trim(const std::string &s) {
+	size_t start = s.find_first_not_of(" \t\r");
+	size_t end = s.find_last_not_of(" \t\r");
+	return start == std::string::npos ? "" : s.substr(start, end - start + 1);
+}
+
+static std::optional<ux_t> parse_number(const std::string &s) {
+	try {
+		size_t len;
+		unsigned long long x = std::stoull(s, &len, 0);
+		if (len != s.size() || x > 0xffffffffull)
+			return std::nullopt;
+		return x;
+	} catch (std::exception&) {
+		return std::nullopt;
+	}
+}
+
+static bool validate(MachineConfig &config, const std::string &path) {
+	if (config.n_harts != 1) {
+		fprintf(stderr, "%s: %u harts requested, but only 1 is supported\n", path.c_str(), config.n_harts);
+		return false;
+	}
+	if (config.mtime_div == 0 || (config.mtime_div & (config.mtime_div - 1))) {
+		fprintf(stderr, "%s: mtime_div must be a power of 2\n", path.c_str());
+		return false;
+	}
+	if (std::none_of(config.regions.begin(), config.regions.end(),
+			[](const MachineRegion &r) {return r.type == REGION_RAM;})) {
+		fprintf(stderr, "%s: no RAM region\n", path.c_str());
+		return false;
+	}
+	if (std::count_if(config.regions.begin(), config.regions.end(),
+			[](const MachineRegion &r) {return r.type == REGION_MTIMER;}) > 1) {
+		fprintf(stderr, "%s: more than one mtimer\n", path.c_str());
+		return false;
+	}
+	for (const MachineRegion &r : config.regions) {
+		if (r.size == 0 || r.base % 4 || r.size % 4 || r.base + (r.size - 1) < r.base) {
+			fprintf(stderr, "%s: region \"%s\" at %08x (size %08x) must be nonempty, word-aligned "
+				"and below 4 GiB\n", path.c_str(), r.name.c_str(), r.base, r.size);
+			return false;
+		}
+		if (r.contents.size() > r.size) {
+			fprintf(stderr, "%s: initial contents of region \"%s\" (%zu bytes) are larger than the "
+				"region (%u bytes)\n", path.c_str(), r.name.c_str(), r.contents.size(), r.size);
+			return false;
+		}
+	}
+	std::vector<const MachineRegion*> sorted;
+	for (const MachineRegion &r : config.regions) {
+		sorted.push_back(&r);
+	}
+	std::sort(sorted.begin(), sorted.end(),
+		[](const MachineRegion *a, const MachineRegion *b) {return a->base < b->base;});
+	for (size_t i = 1; i < sorted.size(); ++i) {
+		const MachineRegion *prev = sorted[i - 1];
+		if (prev->base + (prev->size - 1) >= sorted[i]->base) {
+			fprintf(stderr, "%s: region \"%s\" at %08x overlaps region \"%s\" at %08x\n", path.c_str(),
+				sorted[i]->name.c_str(), sorted[i]->base, prev->name.c_str(), prev->base);
+			return false;
+		}
+	}
+	return true;
+}
+
+std::optional<MachineConfig> machine_config_load(const std::string &path) {
+	std::ifstream fd(path);
+	if (!fd) {
+		fprintf(stderr, "Can't open machine config \"%s\"\n", path.c_str());
+		return std::nullopt;
+	}
+	MachineConfig config = machine_config_default(0, 0);
+	config.regions.clear();
+	bool reset_set = false;
+	bool in_machine_section = false;
+	MachineRegion *region = nullptr;
+	std::string line;
+	for (int lineno = 1; std::getline(fd, line); ++lineno) {
+		line = trim(line.substr(0, line.find_first_of(";#")));
+		if (line.empty()) {
+			continue;
+		}
+		if (line.front() == '[') {
+			if (line.back() != ']') {
+				fprintf(stderr, "%s:%d: malformed section header\n", path.c_str(), lineno);
+				return std::nullopt;
+			}
+			std::string header = trim(line.substr(1, line.size() - 2));
+			size_t space = header.find_first_of(" \t");
+			std::string type = header.substr(0, space);
+			std::string name = space == std::string::npos ? type : trim(header.substr(space));
+			in_machine_section = type == "machine";
+			region = nullptr;
+			if (in_machine_section) {
+				continue;
+			}
+			auto it = region_type_names.find(type);
+			if (it == region_type_names.end()) {
+				fprintf(stderr, "%s:%d: unknown section type \"%s\"\n", path.c_str(), lineno, type.c_str());
+				return std::nullopt;
+			}
+			config.regions.push_back({it->second, name, 0, 0, {}});
+			region = &config.regions.back();
+			if (device_sizes.count(region->type)) {
+				region->size = device_sizes.at(region->type);
+			}
+			continue;
+		}
+		size_t eq = line.find('=');
+		if (eq == std::string::npos) {
+			fprintf(stderr, "%s:%d: expected key = value\n", path.c_str(), lineno);
+			return std::nullopt;
+		}
+		std::string key = trim(line.substr(0, eq));
+		std::string value = trim(line.substr(eq + 1));
+		if (!in_machine_section && !region) {
+			fprintf(stderr, "%s:%d: key \"%s\" outside of a section\n", path.c_str(), lineno, key.c_str());
+			return std::nullopt;
+		}
+		if (region && key == "file" && (region->type == REGION_RAM || region->type == REGION_ROM)) {
+			std::ifstream contents(value, std::ios::binary);
+			if (!contents) {
+				fprintf(stderr, "%s:%d: can't open \"%s\"\n", path.c_str(), lineno, value.c_str());
+				return std::nullopt;
+			}
+			region->contents.assign(std::istreambuf_iterator<char>(contents), std::istreambuf_iterator<char>());
+			continue;
+		}
+		std::optional<ux_t> x = parse_number(value);
+		if (!x) {
+			fprintf(stderr, "%s:%d: \"%s\" is not a number\n", path.c_str(), lineno, value.c_str());
+			return std::nullopt;
+		}
+		if (in_machine_section && key == "harts") {
+			config.n_harts = *x;
+		} else if (in_machine_section && key == "mtime_div") {
+			config.mtime_div = *x;
+		} else if (in_machine_section && key == "clock_hz") {
+			config.clock_hz = *x;
+		} else if (in_machine_section && key == "reset") {
+			config.reset_vector = *x;
+			reset_set = true;
+		} else if (region && key == "base") {
+			region->base = *x;
+		} else if (region && key == "size" && !device_sizes.count(region->type)) {
+			region->size = *x;
+		} else {
+			fprintf(stderr, "%s:%d: unknown key \"%s\"\n", path.c_str(), lineno, key.c_str());
+			return std::nullopt;
+		}
+	}
+	if (!validate(config, path)) {
+		return std::nullopt;
+	}
+	// Main RAM is moved to the front
+	auto ram = std::find_if(config.regions.begin(), config.regions.end(),
+		[](const MachineRegion &r) {return r.type == REGION_RAM;});
+	std::rotate(config.regions.begin(), ram, ram + 1);
+	if (!reset_set) {
+		config.reset_vector = config.regions[0].base;
+	}
+	return config;
+}
+
+static const MachineRegion &find_main_ram(const MachineConfig &config) {
+	assert(!config.regions.empty() && config.regions[0].type == REGION_RAM);
+	return config.regions[0];
+}
+
+Machine::Machine(const MachineConfig &config_):
+		config(config_),
+		mtimer(nullptr),
+		core(mem, config_.reset_vector, find_main_ram(config_).base, find_main_ram(config_).size) {
+	const MachineRegion &ram = main_ram();
+	memcpy(core.ram, ram.contents.data(), ram.contents.size());
+	for (size_t i = 1; i < config.regions.size(); ++i) {
+		const MachineRegion &r = config.regions[i];
+		MemBase32 *dev;
+		switch (r.type) {
+		case REGION_RAM:
+		case REGION_ROM: {
+			FlatMem32 *m = r.type == REGION_RAM ? new FlatMem32(r.size) : new ROM32(r.size);
+			memcpy(m->mem, r.contents.data(), r.contents.size());
+			dev = m;
+			break;
+		}
+		case REGION_TBIO:
+			dev = new TBMemIO();
+			break;
+		case REGION_UART8250:
+			dev = new UART8250();
+			break;
+		case REGION_MTIMER:
+			mtimer = new MTimer();
+			dev = mtimer;
+			break;
+		default:
+			assert(false);
+			dev = nullptr;
+		}
+		devices.emplace_back(dev);
+		mem.add(r.base, r.size, dev);
+	}
+}
+
+const MachineRegion &Machine::main_ram() const {
+	return find_main_ram(config);
+}
+
+FDTMachine Machine::fdt_description() const {
+	FDTMachine m;
+	m.ram_base = main_ram().base;
+	m.ram_size = main_ram().size;
+	m.n_harts = config.n_harts;
+	m.timebase_freq = config.clock_hz / config.mtime_div;
+	m.svade = false;
+	for (const MachineRegion &r : config.regions) {
+		switch (r.type) {
+		case REGION_TBIO:     m.devices.push_back({FDT_DEV_TBIO,     r.base, r.size}); break;
+		case REGION_UART8250: m.devices.push_back({FDT_DEV_UART8250, r.base, r.size}); break;
+		case REGION_MTIMER:   m.devices.push_back({FDT_DEV_MTIMER,   r.base, r.size}); break;
+		default: break;
+		}
+	}
+	return m;
+}
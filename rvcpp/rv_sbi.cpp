@@ -0,0 +1,231 @@
+#include "rv_sbi.h"
+#include "rv_core.h"
+#include "encoding/rv_csr.h"
+
+#include <cstdio>
+#include <cassert>
+
+enum {
+	SBI_SPEC_VERSION = 0x02000000, // v2.0
+	// Not a registered implementation ID
+	SBI_IMPL_ID      = 0x72766370,
+	SBI_IMPL_VERSION = 1
+};
+
+// All exceptions are delegated to S-mode, except ECALLs from S-mode, which
+// are handled here, and M-mode ECALLs, which can't be delegated
+static const ux_t SBI_MEDELEG =
+	1u << XCAUSE_INSTR_MISALIGN |
+	1u << XCAUSE_INSTR_FAULT |
+	1u << XCAUSE_INSTR_ILLEGAL |
+	1u << XCAUSE_EBREAK |
+	1u << XCAUSE_LOAD_ALIGN |
+	1u << XCAUSE_LOAD_FAULT |
+	1u << XCAUSE_STORE_ALIGN |
+	1u << XCAUSE_STORE_FAULT |
+	1u << XCAUSE_ECALL_U |
+	1u << XCAUSE_INSTR_PAGEFAULT |
+	1u << XCAUSE_LOAD_PAGEFAULT |
+	1u << XCAUSE_STORE_PAGEFAULT;
+
+static const ux_t SBI_MIDELEG = MIP_SSIP | MIP_STIP | MIP_SEIP;
+
+void SBI::boot(RVCore &core, ux_t entry, ux_t dtb_addr) {
+	RVCSR &csr = core.csr;
+	assert(csr.get_true_priv() == PRV_M);
+	csr.write(CSR_MEDELEG, SBI_MEDELEG);
+	csr.write(CSR_MIDELEG, SBI_MIDELEG);
+	csr.write(CSR_MCOUNTEREN, 0x7);
+	csr.write(CSR_SCOUNTEREN, 0x7);
+	csr.write(CSR_MENVCFG, ENVCFG_CBIE_INVAL | ENVCFG_CBCFE | ENVCFG_CBZE);
+	csr.write(CSR_MENVCFGH, ENVCFGH_STCE, RVCSR::WRITE_SET);
+	// One PMP entry covering all of memory, since S-mode has no access
+	// when no entry matches
+	csr.write(CSR_PMPADDR0, -1u);
+	csr.write(CSR_PMPCFG0, PMP_NAPOT | PMP_R | PMP_W | PMP_X);
+	csr.write(CSR_MSTATUS, MSTATUS_MPP, RVCSR::WRITE_CLEAR);
+	csr.write(CSR_MSTATUS, PRV_S << 11, RVCSR::WRITE_SET);
+	csr.write(CSR_MEPC, entry);
+	core.regs[10] = 0;
+	core.regs[11] = dtb_addr;
+	core.pc = csr.trap_mret();
+}
+
+void SBI::set_timer(RVCore &core, uint64_t stime_value) {
+	// boot() enables Sstc, so the S-mode timer interrupt is driven by
+	// stimecmp. Writing it also clears STIP unless the new time has passed.
+	core.csr.write(CSR_STIMECMPH, stime_value >> 32);
+	core.csr.write(CSR_STIMECMP, stime_value & 0xffffffffu);
+}
+
+std::pair<sx_t, ux_t> SBI::call(RVCore &core, ux_t eid, ux_t fid, const ux_t *args) {
+	switch (eid) {
+	case SBI_EXT_BASE:
+		switch (fid) {
+		case 0: return {SBI_SUCCESS, SBI_SPEC_VERSION};
+		case 1: return {SBI_SUCCESS, SBI_IMPL_ID};
+		case 2: return {SBI_SUCCESS, SBI_IMPL_VERSION};
+		case 3: {
+			// probe_extension
+			switch (args[0]) {
+			case SBI_EXT_LEGACY_SET_TIMER:
+			case SBI_EXT_LEGACY_PUTCHAR:
+			case SBI_EXT_LEGACY_GETCHAR:
+			case SBI_EXT_LEGACY_SHUTDOWN:
+			case SBI_EXT_BASE:
+			case SBI_EXT_TIME:
+			case SBI_EXT_IPI:
+			case SBI_EXT_RFENCE:
+			case SBI_EXT_HSM:
+			case SBI_EXT_SRST:
+			case SBI_EXT_DBCN:
+				return {SBI_SUCCESS, 1};
+			default:
+				return {SBI_SUCCESS, 0};
+			}
+		}
+		// mvendorid, marchid, mimpid
+		case 4: return {SBI_SUCCESS, 0};
+		case 5: return {SBI_SUCCESS, 0};
+		case 6: return {SBI_SUCCESS, 0};
+		default: break;
+		}
+		break;
+
+	case SBI_EXT_TIME:
+		if (fid == 0) {
+			set_timer(core, (uint64_t)args[1] << 32 | args[0]);
+			return {SBI_SUCCESS, 0};
+		}
+		break;
+
+	case SBI_EXT_IPI:
+		if (fid == 0) {
+			// send_ipi(hart_mask, hart_mask_base). Base of -1 means all harts.
+			bool hart0 = args[1] == -1u || (args[1] == 0 && (args[0] & 1u));
+			if (hart0) {
+				core.csr.set_sip_bits(MIP_SSIP);
+			}
+			return {SBI_SUCCESS, 0};
+		}
+		break;
+
+	case SBI_EXT_RFENCE:
+		// There is only one hart, so remote fences apply to it. The ASID is
+		// ignored, as the TLB doesn't tag entries with one. The hypervisor
+		// fences (3 to 6) have nothing to do.
+		if (fid == 0) {
+			// remote_fence_i(hart_mask, hart_mask_base), as FENCE.I
+			core.code_cache.flush_all();
+			return {SBI_SUCCESS, 0};
+		}
+		if (fid == 1 || fid == 2) {
+			// remote_sfence_vma(hart_mask, hart_mask_base, start_addr, size)
+			// and remote_sfence_vma_asid(..., asid). A size of 0 or -1 means
+			// the whole address space, and a range with more pages than the
+			// TLB has entries is cheaper to flush all at once.
+			ux_t start = args[2] & ~0xfffu;
+			ux_t size = args[3] + (args[2] & 0xfffu);
+			if (args[3] == 0 || args[3] >= TLB::N_PAGES * 0x1000u) {
+				core.tlb.flush_all();
+			} else {
+				for (ux_t offset = 0; offset < size; offset += 0x1000) {
+					core.tlb.flush(start + offset);
+				}
+			}
+			return {SBI_SUCCESS, 0};
+		}
+		if (fid <= 6) {
+			return {SBI_SUCCESS, 0};
+		}
+		break;
+
+	case SBI_EXT_HSM:
+		switch (fid) {
+		// hart_start: hart 0 is the only hart, and it's already running
+		case 0: return {args[0] == 0 ? SBI_ERR_ALREADY_AVAILABLE : SBI_ERR_INVALID_PARAM, 0};
+		// hart_stop: stopping the only hart is not supported
+		case 1: return {SBI_ERR_FAILED, 0};
+		// hart_get_status: STARTED
+		case 2: return {args[0] == 0 ? SBI_SUCCESS : SBI_ERR_INVALID_PARAM, 0};
+		// hart_suspend: only retentive suspend, which behaves like WFI
+		case 3: return {args[0] == 0 ? SBI_SUCCESS : SBI_ERR_NOT_SUPPORTED, 0};
+		default: break;
+		}
+		break;
+
+	case SBI_EXT_SRST:
+		if (fid == 0) {
+			// Any shutdown or reset ends simulation. The reset reason (0 for
+			// no reason, 1 for system failure) is the exit code.
+			if (args[0] > 2 && args[0] < 0xf0000000u) {
+				return {SBI_ERR_INVALID_PARAM, 0};
+			}
+			fflush(stdout);
+			throw TBExitException(args[1]);
+		}
+		break;
+
+	case SBI_EXT_DBCN:
+		if (fid == 0) {
+			// console_write(num_bytes, base_addr_lo, base_addr_hi): physical address
+			if (args[2] != 0) {
+				return {SBI_ERR_INVALID_PARAM, 0};
+			}
+			for (ux_t i = 0; i < args[0]; ++i) {
+				std::optional<uint8_t> c = core.r8(args[1] + i);
+				if (!c) {
+					return {SBI_ERR_INVALID_PARAM, i};
+				}
+				putchar((char)*c);
+			}
+			fflush(stdout);
+			return {SBI_SUCCESS, args[0]};
+		} else if (fid == 1) {
+			// console_read: no input
+			return {SBI_SUCCESS, 0};
+		} else if (fid == 2) {
+			putchar((char)args[0]);
+			fflush(stdout);
+			return {SBI_SUCCESS, 0};
+		}
+		break;
+
+	default:
+		break;
+	}
+	return {SBI_ERR_NOT_SUPPORTED, 0};
+}
+
+bool SBI::ecall(RVCore &core, uint priv) {
+	if (priv != PRV_S) {
+		return false;
+	}
+	ux_t *a = &core.regs[10];
+	ux_t eid = a[7];
+	ux_t fid = a[6];
+	// Legacy extensions return a single value in a0, and leave a1 alone
+	switch (eid) {
+	case SBI_EXT_LEGACY_SET_TIMER:
+		set_timer(core, (uint64_t)a[1] << 32 | a[0]);
+		a[0] = 0;
+		return true;
+	case SBI_EXT_LEGACY_PUTCHAR:
+		putchar((char)a[0]);
+		fflush(stdout);
+		a[0] = 0;
+		return true;
+	case SBI_EXT_LEGACY_GETCHAR:
+		a[0] = -1u;
+		return true;
+	case SBI_EXT_LEGACY_SHUTDOWN:
+		fflush(stdout);
+		throw TBExitException(0);
+	default:
+		break;
+	}
+	std::pair<sx_t, ux_t> result = call(core, eid, fid, a);
+	a[0] = result.first;
+	a[1] = result.second;
+	return true;
+}
@@ -0,0 +1,323 @@
+#include "rv_semihosting.h"
+#include "rv_core.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <unistd.h>
+
+// slli x0, x0, 0x1f; ebreak; srai x0, x0, 7
+#define SEMIHOST_ENTRY_NOP 0x01f01013u
+#define SEMIHOST_EXIT_NOP  0x40705013u
+
+static const char *open_modes[12] = {
+	"r", "rb", "r+", "r+b", "w", "wb", "w+", "w+b", "a", "ab", "a+", "a+b"
+};
+
+static std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+Semihosting::Semihosting() {
+	// Handle 0 is left unused, in case firmware treats it as invalid
+	files.push_back(nullptr);
+	last_errno = 0;
+}
+
+Semihosting::~Semihosting() {
+	for (FILE *f : files) {
+		if (f && f != stdin && f != stdout && f != stderr) {
+			fclose(f);
+		}
+	}
+}
+
+uint8_t *Semihosting::ram_ptr(RVCore &core, ux_t addr, ux_t size) {
+	if (addr >= core.ram_base && addr <= core.ram_top && size <= core.ram_top - addr) {
+		return (uint8_t*)core.ram + (addr - core.ram_base);
+	}
+	return nullptr;
+}
+
+bool Semihosting::copy_from_guest(RVCore &core, void *dst, ux_t src, ux_t size) {
+	if (const uint8_t *host = ram_ptr(core, src, size)) {
+		memcpy(dst, host, size);
+		return true;
+	}
+	for (ux_t i = 0; i < size; ++i) {
+		std::optional<uint8_t> b = core.r8(src + i);
+		if (!b) {
+			return false;
+		}
+		((uint8_t*)dst)[i] = *b;
+	}
+	return true;
+}
+
+bool Semihosting::copy_to_guest(RVCore &core, ux_t dst, const void *src, ux_t size) {
+	if (uint8_t *host = ram_ptr(core, dst, size)) {
+		memcpy(host, src, size);
+		core.code_cache.write(dst, size);
+		return true;
+	}
+	for (ux_t i = 0; i < size; ++i) {
+		if (!core.w8(dst + i, ((const uint8_t*)src)[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::optional<std::vector<ux_t>> Semihosting::read_params(RVCore &core, ux_t addr, uint n) {
+	std::vector<ux_t> params(n);
+	if (!copy_from_guest(core, params.data(), addr, n * sizeof(ux_t))) {
+		return std::nullopt;
+	}
+	return params;
+}
+
+FILE *Semihosting::get_file(ux_t handle) {
+	return handle < files.size() ? files[handle] : nullptr;
+}
+
+bool Semihosting::read_name(RVCore &core, ux_t addr, ux_t len, std::string &name) {
+	if (len > PATH_MAX) {
+		last_errno = ENAMETOOLONG;
+		return false;
+	}
+	name.assign(len, '\0');
+	return copy_from_guest(core, name.data(), addr, len);
+}
+
+sx_t Semihosting::call(RVCore &core, ux_t op, ux_t arg) {
+	switch (op) {
+	case SEMIHOST_SYS_OPEN: {
+		// {name, mode, name length}
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 3);
+		if (!p || (*p)[1] >= 12) {
+			return -1;
+		}
+		std::string name;
+		if (!read_name(core, (*p)[0], (*p)[2], name)) {
+			return -1;
+		}
+		ux_t mode = (*p)[1];
+		FILE *f;
+		if (name == ":tt") {
+			f = mode < 4 ? stdin : mode < 8 ? stdout : stderr;
+		} else {
+			f = fopen(name.c_str(), open_modes[mode]);
+			if (!f) {
+				last_errno = errno;
+				return -1;
+			}
+		}
+		for (ux_t handle = 1; handle < files.size(); ++handle) {
+			if (!files[handle]) {
+				files[handle] = f;
+				return handle;
+			}
+		}
+		files.push_back(f);
+		return files.size() - 1;
+	}
+	case SEMIHOST_SYS_CLOSE: {
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 1);
+		FILE *f = p ? get_file((*p)[0]) : nullptr;
+		if (!f) {
+			last_errno = EBADF;
+			return -1;
+		}
+		files[(*p)[0]] = nullptr;
+		if (f == stdin || f == stdout || f == stderr) {
+			return 0;
+		}
+		return fclose(f) == 0 ? 0 : -1;
+	}
+	case SEMIHOST_SYS_WRITEC: {
+		std::optional<uint8_t> c = core.r8(arg);
+		if (c) {
+			putchar(*c);
+		}
+		return 0;
+	}
+	case SEMIHOST_SYS_WRITE0: {
+		for (ux_t addr = arg; ; ++addr) {
+			std::optional<uint8_t> c = core.r8(addr);
+			if (!c || !*c) {
+				break;
+			}
+			putchar(*c);
+		}
+		return 0;
+	}
+	case SEMIHOST_SYS_WRITE:
+	case SEMIHOST_SYS_READ: {
+		// {handle, buffer, length}. Returns the number of bytes *not*
+		// transferred.
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 3);
+		if (!p) {
+			return -1;
+		}
+		FILE *f = get_file((*p)[0]);
+		ux_t addr = (*p)[1];
+		ux_t len = (*p)[2];
+		if (!f) {
+			last_errno = EBADF;
+			return len;
+		}
+		size_t n = 0;
+		if (uint8_t *host = ram_ptr(core, addr, len)) {
+			if (op == SEMIHOST_SYS_WRITE) {
+				n = fwrite(host, 1, len, f);
+			} else {
+				core.code_cache.write(addr, len);
+				n = fread(host, 1, len, f);
+			}
+		} else {
+			// Not entirely in RAM, so go through the memory map a chunk at
+			// a time. The length comes from the guest, so the buffer is
+			// not sized by it.
+			uint8_t chunk[4096];
+			while (n < len) {
+				ux_t size = std::min<ux_t>(len - n, sizeof(chunk));
+				size_t done;
+				if (op == SEMIHOST_SYS_WRITE) {
+					if (!copy_from_guest(core, chunk, addr + n, size)) {
+						break;
+					}
+					done = fwrite(chunk, 1, size, f);
+				} else {
+					done = fread(chunk, 1, size, f);
+					if (!copy_to_guest(core, addr + n, chunk, done)) {
+						break;
+					}
+				}
+				n += done;
+				if (done < size) {
+					break;
+				}
+			}
+		}
+		if (op == SEMIHOST_SYS_WRITE && (f == stdout || f == stderr)) {
+			fflush(f);
+		}
+		return len - n;
+	}
+	case SEMIHOST_SYS_READC:
+		return getchar();
+	case SEMIHOST_SYS_ISERROR: {
+		// {status}
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 1);
+		return p && (sx_t)(*p)[0] < 0;
+	}
+	case SEMIHOST_SYS_ISTTY: {
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 1);
+		FILE *f = p ? get_file((*p)[0]) : nullptr;
+		return f && isatty(fileno(f));
+	}
+	case SEMIHOST_SYS_SEEK: {
+		// {handle, absolute position}
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 2);
+		FILE *f = p ? get_file((*p)[0]) : nullptr;
+		if (!f) {
+			last_errno = EBADF;
+			return -1;
+		}
+		if (fseek(f, (*p)[1], SEEK_SET) != 0) {
+			last_errno = errno;
+			return -1;
+		}
+		return 0;
+	}
+	case SEMIHOST_SYS_FLEN: {
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 1);
+		FILE *f = p ? get_file((*p)[0]) : nullptr;
+		if (!f) {
+			last_errno = EBADF;
+			return -1;
+		}
+		long pos = ftell(f);
+		if (pos < 0 || fseek(f, 0, SEEK_END) != 0) {
+			last_errno = errno;
+			return -1;
+		}
+		long len = ftell(f);
+		fseek(f, pos, SEEK_SET);
+		return len;
+	}
+	case SEMIHOST_SYS_REMOVE: {
+		// {name, name length}
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 2);
+		if (!p) {
+			return -1;
+		}
+		std::string name;
+		if (!read_name(core, (*p)[0], (*p)[1], name)) {
+			return -1;
+		}
+		if (remove(name.c_str()) != 0) {
+			last_errno = errno;
+			return errno;
+		}
+		return 0;
+	}
+	case SEMIHOST_SYS_CLOCK:
+		// Centiseconds since the simulator started
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start_time).count() / 10;
+	case SEMIHOST_SYS_TIME:
+		return time(nullptr);
+	case SEMIHOST_SYS_ERRNO:
+		return last_errno;
+	case SEMIHOST_SYS_HEAPINFO: {
+		// a1 points to a pointer to a block of {heap base, heap limit, stack
+		// base, stack limit}. Zeroes tell the C library to use its own
+		// linker-script defaults.
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 1);
+		ux_t zeroes[4] = {0, 0, 0, 0};
+		if (!p || !copy_to_guest(core, (*p)[0], zeroes, sizeof(zeroes))) {
+			return -1;
+		}
+		return 0;
+	}
+	case SEMIHOST_SYS_EXIT:
+		// On 32-bit targets a1 holds the reason code itself
+		fflush(stdout);
+		throw TBExitException(arg == SEMIHOST_ADP_STOPPED_APPLICATION_EXIT ? 0 : 1);
+	case SEMIHOST_SYS_EXIT_EXTENDED: {
+		// {reason, exit code}
+		std::optional<std::vector<ux_t>> p = read_params(core, arg, 2);
+		fflush(stdout);
+		if (!p) {
+			throw TBExitException(1);
+		}
+		throw TBExitException((*p)[0] == SEMIHOST_ADP_STOPPED_APPLICATION_EXIT ? (*p)[1] : 1);
+	}
+	default:
+		fprintf(stderr, "Unsupported semihosting operation %02x at pc %08x\n", op, core.pc);
+		return -1;
+	}
+}
+
+bool Semihosting::ebreak(RVCore &core, uint priv) {
+	if (priv != PRV_M || core.pc < 4) {
+		return false;
+	}
+	// The markers must be uncompressed, but the sequence is only 2-byte
+	// aligned if the firmware was built with C.
+	std::optional<uint16_t> entry_lo = core.r16(core.pc - 4);
+	std::optional<uint16_t> entry_hi = core.r16(core.pc - 2);
+	std::optional<uint16_t> exit_lo = core.r16(core.pc + 4);
+	std::optional<uint16_t> exit_hi = core.r16(core.pc + 6);
+	if (!(entry_lo && entry_hi && exit_lo && exit_hi) ||
+			((ux_t)*entry_hi << 16 | *entry_lo) != SEMIHOST_ENTRY_NOP ||
+			((ux_t)*exit_hi << 16 | *exit_lo) != SEMIHOST_EXIT_NOP) {
+		return false;
+	}
+	core.regs[10] = call(core, core.regs[10], core.regs[11]);
+	return true;
+}
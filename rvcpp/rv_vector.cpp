@@ -0,0 +1,822 @@
+#include "rv_core.h"
+#include "rv_vector.h"
+#include "encoding/rv_csr.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+// Kernels are compiled twice on x86-64: once for the baseline ISA (SSE2) and
+// once for AVX2. The dynamic loader picks one when the program starts, so
+// there is no per-instruction cost for the dispatch.
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define VECTOR_KERNEL __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef VECTOR_KERNEL
+#define VECTOR_KERNEL
+#endif
+
+// OP-V funct3 encodings
+enum {
+	OPIVV = 0b000,
+	OPFVV = 0b001,
+	OPMVV = 0b010,
+	OPIVI = 0b011,
+	OPIVX = 0b100,
+	OPFVF = 0b101,
+	OPMVX = 0b110,
+	OPCFG = 0b111
+};
+
+VType::VType(ux_t vtype) {
+	uint vsew = GETBITS(vtype, 5, 3);
+	uint vlmul = GETBITS(vtype, 2, 0);
+	sew = 8u << vsew;
+	lmul_log2 = vlmul & 0x4 ? (int)vlmul - 8 : (int)vlmul;
+	vill = (vtype & ~(VTYPE_VMA | VTYPE_VTA | VTYPE_VSEW | VTYPE_VLMUL)) ||
+		vsew > 3 || vlmul == 4 ||
+		(lmul_log2 < 0 && sew > (uint)VELEN >> -lmul_log2);
+}
+
+// Small element types are promoted to unsigned int for arithmetic, so that
+// e.g. multiplying two uint16_t values does not overflow a signed int.
+template <typename T>
+using promoted_t = std::conditional_t<(sizeof(T) < sizeof(uint)), uint, T>;
+
+template <typename T> struct DoubleWidth;
+template <> struct DoubleWidth<uint8_t > {typedef uint16_t type;};
+template <> struct DoubleWidth<uint16_t> {typedef uint32_t type;};
+template <> struct DoubleWidth<uint32_t> {typedef uint64_t type;};
+
+// ----------------------------------------------------------------------------
+// Kernels
+
+// Element-wise operations: vd[i] = op(vd[i], vs2[i], vs1[i]) for i in
+// [start, end). vd may be the same register group as either source.
+template <typename T, typename Op>
+VECTOR_KERNEL static void kernel_vv(T *vd, const T *vs2, const T *vs1, uint start, uint end, Op op) {
+	for (uint i = start; i < end; ++i)
+		vd[i] = op(vd[i], vs2[i], vs1[i]);
+}
+
+// As above, but with a scalar operand in place of vs1
+template <typename T, typename Op>
+VECTOR_KERNEL static void kernel_vx(T *vd, const T *vs2, T x, uint start, uint end, Op op) {
+	for (uint i = start; i < end; ++i)
+		vd[i] = op(vd[i], vs2[i], x);
+}
+
+template <typename T, typename Op>
+VECTOR_KERNEL static T kernel_reduce(const T *vs2, uint end, T acc, Op op) {
+	for (uint i = 0; i < end; ++i)
+		acc = op(acc, vs2[i]);
+	return acc;
+}
+
+// ----------------------------------------------------------------------------
+// Arithmetic
+
+// Decoded OP-V instruction, plus the vector state it operates on
+struct VecArith {
+	VRegFile &v;
+	RVCSR &csr;
+	uint funct3;
+	uint funct6;
+	uint vd;
+	uint vs1;
+	uint vs2;
+	bool masked;
+	// The second operand comes from vs1, rather than a scalar
+	bool vector_operand;
+	// Sign-extended scalar operand (rs1 or immediate)
+	uint64_t scalar;
+	uint vstart;
+	uint vl;
+	uint vlmax;
+	uint group_regs;
+	std::optional<ux_t> rd_wdata;
+
+	bool aligned(uint vreg) const {
+		return !(vreg & (group_regs - 1));
+	}
+
+	bool active(uint i) const {
+		return !masked || v.mask_bit(0, i);
+	}
+
+	// Checks common to all instructions which write a register group
+	bool vd_ok() const {
+		return aligned(vd) && !(masked && vd == 0);
+	}
+
+	bool sources_ok() const {
+		return aligned(vs2) && (!vector_operand || aligned(vs1));
+	}
+};
+
+template <typename T, typename Op>
+static bool elementwise(VecArith &c, Op op) {
+	if (!(c.vd_ok() && c.sources_ok()))
+		return false;
+	T *vd = c.v.reg<T>(c.vd);
+	const T *vs2 = c.v.reg<T>(c.vs2);
+	const T *vs1 = c.v.reg<T>(c.vs1);
+	T x = c.scalar;
+	if (!c.masked && c.vector_operand) {
+		kernel_vv(vd, vs2, vs1, c.vstart, c.vl, op);
+	} else if (!c.masked) {
+		kernel_vx(vd, vs2, x, c.vstart, c.vl, op);
+	} else {
+		for (uint i = c.vstart; i < c.vl; ++i) {
+			if (c.active(i))
+				vd[i] = op(vd[i], vs2[i], c.vector_operand ? vs1[i] : x);
+		}
+	}
+	return true;
+}
+
+// Integer compare, writing a mask register. The destination may overlap
+// the sources, so results are collected in a temporary first.
+template <typename T, typename Cmp>
+static bool compare(VecArith &c, Cmp cmp) {
+	if (!c.sources_ok())
+		return false;
+	const T *vs2 = c.v.reg<T>(c.vs2);
+	const T *vs1 = c.v.reg<T>(c.vs1);
+	T x = c.scalar;
+	uint8_t result[VLENB];
+	memcpy(result, c.v.bytes(c.vd), VLENB);
+	for (uint i = c.vstart; i < c.vl; ++i) {
+		if (c.active(i)) {
+			bool bit = cmp(vs2[i], c.vector_operand ? vs1[i] : x);
+			result[i / 8] = (result[i / 8] & ~(1u << i % 8)) | (uint)bit << i % 8;
+		}
+	}
+	memcpy(c.v.bytes(c.vd), result, VLENB);
+	return true;
+}
+
+// vd[0] = op(vs1[0], active elements of vs2)
+template <typename T, typename Op>
+static bool reduce(VecArith &c, Op op) {
+	if (c.vstart != 0 || !c.aligned(c.vs2))
+		return false;
+	if (c.vl == 0)
+		return true;
+	const T *vs2 = c.v.reg<T>(c.vs2);
+	T acc = c.v.reg<T>(c.vs1)[0];
+	if (!c.masked) {
+		acc = kernel_reduce(vs2, c.vl, acc, op);
+	} else {
+		for (uint i = 0; i < c.vl; ++i) {
+			if (c.active(i))
+				acc = op(acc, vs2[i]);
+		}
+	}
+	c.v.reg<T>(c.vd)[0] = acc;
+	return true;
+}
+
+template <typename T>
+static bool slide(VecArith &c, bool up, bool slide1) {
+	if (!(c.vd_ok() && c.aligned(c.vs2)) || (up && c.vd == c.vs2))
+		return false;
+	T *vd = c.v.reg<T>(c.vd);
+	const T *vs2 = c.v.reg<T>(c.vs2);
+	// Slide amount is an unsigned XLEN-bit value for .vx, so don't sign-extend
+	uint64_t offset = slide1 ? 1 : (ux_t)c.scalar;
+	for (uint i = c.vstart; i < c.vl; ++i) {
+		if (!c.active(i))
+			continue;
+		if (up) {
+			if (i >= offset)
+				vd[i] = vs2[i - offset];
+			else if (slide1)
+				vd[i] = c.scalar;
+		} else {
+			if (slide1 && i == c.vl - 1)
+				vd[i] = c.scalar;
+			else
+				vd[i] = i + offset < c.vlmax ? vs2[i + offset] : 0;
+		}
+	}
+	return true;
+}
+
+template <typename T>
+static bool vec_opi(VecArith &c) {
+	typedef std::make_signed_t<T> S;
+	typedef promoted_t<T> P;
+	constexpr uint shamt_mask = 8 * sizeof(T) - 1;
+	constexpr T max_s = (T)std::numeric_limits<S>::max();
+	constexpr T min_s = (T)std::numeric_limits<S>::min();
+	bool vv = c.funct3 == OPIVV;
+	bool vi = c.funct3 == OPIVI;
+
+	switch (c.funct6) {
+	case 0b000000: return elementwise<T>(c, [](T, T a, T b) {return T(a + b);});
+	case 0b000010: return !vi && elementwise<T>(c, [](T, T a, T b) {return T(a - b);});
+	case 0b000011: return !vv && elementwise<T>(c, [](T, T a, T b) {return T(b - a);});
+	case 0b000100: return !vi && elementwise<T>(c, [](T, T a, T b) {return std::min(a, b);});
+	case 0b000101: return !vi && elementwise<T>(c, [](T, T a, T b) {return (S)a < (S)b ? a : b;});
+	case 0b000110: return !vi && elementwise<T>(c, [](T, T a, T b) {return std::max(a, b);});
+	case 0b000111: return !vi && elementwise<T>(c, [](T, T a, T b) {return (S)a > (S)b ? a : b;});
+	case 0b001001: return elementwise<T>(c, [](T, T a, T b) {return T(a & b);});
+	case 0b001010: return elementwise<T>(c, [](T, T a, T b) {return T(a | b);});
+	case 0b001011: return elementwise<T>(c, [](T, T a, T b) {return T(a ^ b);});
+
+	case 0b001100: {
+		// vrgather: destination must not overlap either source
+		if (!(c.vd_ok() && c.sources_ok()) || c.vd == c.vs2 || (vv && c.vd == c.vs1))
+			return false;
+		T *vd = c.v.reg<T>(c.vd);
+		const T *vs2 = c.v.reg<T>(c.vs2);
+		const T *vs1 = c.v.reg<T>(c.vs1);
+		for (uint i = c.vstart; i < c.vl; ++i) {
+			uint64_t index = vv ? vs1[i] : vi ? c.scalar : (ux_t)c.scalar;
+			if (c.active(i))
+				vd[i] = index < c.vlmax ? vs2[index] : 0;
+		}
+		return true;
+	}
+
+	case 0b001110: return !vv && slide<T>(c, true, false);
+	case 0b001111: return !vv && slide<T>(c, false, false);
+
+	case 0b010111: {
+		if (!c.masked) {
+			// vmv.v.v/x/i
+			return c.vs2 == 0 && elementwise<T>(c, [](T, T, T b) {return b;});
+		}
+		// vmerge: mask selects between the operands, rather than disabling
+		// elements
+		if (c.vd == 0 || !(c.aligned(c.vd) && c.sources_ok()))
+			return false;
+		T *vd = c.v.reg<T>(c.vd);
+		const T *vs2 = c.v.reg<T>(c.vs2);
+		const T *vs1 = c.v.reg<T>(c.vs1);
+		for (uint i = c.vstart; i < c.vl; ++i) {
+			T b = vv ? vs1[i] : (T)c.scalar;
+			vd[i] = c.v.mask_bit(0, i) ? b : vs2[i];
+		}
+		return true;
+	}
+
+	case 0b011000: return compare<T>(c, [](T a, T b) {return a == b;});
+	case 0b011001: return compare<T>(c, [](T a, T b) {return a != b;});
+	case 0b011010: return !vi && compare<T>(c, [](T a, T b) {return a < b;});
+	case 0b011011: return !vi && compare<T>(c, [](T a, T b) {return (S)a < (S)b;});
+	case 0b011100: return compare<T>(c, [](T a, T b) {return a <= b;});
+	case 0b011101: return compare<T>(c, [](T a, T b) {return (S)a <= (S)b;});
+	case 0b011110: return !vv && compare<T>(c, [](T a, T b) {return a > b;});
+	case 0b011111: return !vv && compare<T>(c, [](T a, T b) {return (S)a > (S)b;});
+
+	case 0b100000: {
+		bool sat = false;
+		bool ok = elementwise<T>(c, [&sat](T, T a, T b) {
+			T r = a + b;
+			if (r < a) {
+				sat = true;
+				r = ~T(0);
+			}
+			return r;
+		});
+		if (sat)
+			c.csr.vec_set_vxsat();
+		return ok;
+	}
+	case 0b100001: {
+		bool sat = false;
+		bool ok = elementwise<T>(c, [&sat](T, T a, T b) {
+			S r;
+			if (__builtin_add_overflow((S)a, (S)b, &r)) {
+				sat = true;
+				return (S)a < 0 ? min_s : max_s;
+			}
+			return (T)r;
+		});
+		if (sat)
+			c.csr.vec_set_vxsat();
+		return ok;
+	}
+	case 0b100010: {
+		bool sat = false;
+		bool ok = !vi && elementwise<T>(c, [&sat](T, T a, T b) {
+			if (a < b) {
+				sat = true;
+				return T(0);
+			}
+			return T(a - b);
+		});
+		if (sat)
+			c.csr.vec_set_vxsat();
+		return ok;
+	}
+	case 0b100011: {
+		bool sat = false;
+		bool ok = !vi && elementwise<T>(c, [&sat](T, T a, T b) {
+			S r;
+			if (__builtin_sub_overflow((S)a, (S)b, &r)) {
+				sat = true;
+				return (S)a < 0 ? min_s : max_s;
+			}
+			return (T)r;
+		});
+		if (sat)
+			c.csr.vec_set_vxsat();
+		return ok;
+	}
+
+	case 0b100101: return elementwise<T>(c, [](T, T a, T b) {return T((P)a << (b & shamt_mask));});
+	case 0b101000: return elementwise<T>(c, [](T, T a, T b) {return T(a >> (b & shamt_mask));});
+	case 0b101001: return elementwise<T>(c, [](T, T a, T b) {return T((S)a >> (b & shamt_mask));});
+
+	default: return false;
+	}
+}
+
+// Mask-register logical operations work on single registers, one bit per
+// element, regardless of SEW
+template <typename Op>
+static bool mask_logical(VecArith &c, Op op) {
+	if (c.masked)
+		return false;
+	for (uint i = c.vstart; i < c.vl; ++i)
+		c.v.set_mask_bit(c.vd, i, op(c.v.mask_bit(c.vs2, i), c.v.mask_bit(c.vs1, i)));
+	return true;
+}
+
+template <typename T>
+static bool vec_opm(VecArith &c) {
+	typedef std::make_signed_t<T> S;
+	typedef promoted_t<T> P;
+	constexpr uint sew = 8 * sizeof(T);
+	constexpr T min_s = (T)std::numeric_limits<S>::min();
+	bool vv = c.funct3 == OPMVV;
+
+	switch (c.funct6) {
+	// Reductions are only allowed with vstart == 0
+	case 0b000000: return vv && reduce<T>(c, [](T acc, T x) {return T(acc + x);});
+	case 0b000001: return vv && reduce<T>(c, [](T acc, T x) {return T(acc & x);});
+	case 0b000010: return vv && reduce<T>(c, [](T acc, T x) {return T(acc | x);});
+	case 0b000011: return vv && reduce<T>(c, [](T acc, T x) {return T(acc ^ x);});
+	case 0b000100: return vv && reduce<T>(c, [](T acc, T x) {return std::min(acc, x);});
+	case 0b000101: return vv && reduce<T>(c, [](T acc, T x) {return (S)acc < (S)x ? acc : x;});
+	case 0b000110: return vv && reduce<T>(c, [](T acc, T x) {return std::max(acc, x);});
+	case 0b000111: return vv && reduce<T>(c, [](T acc, T x) {return (S)acc > (S)x ? acc : x;});
+
+	case 0b001110: return !vv && slide<T>(c, true, true);
+	case 0b001111: return !vv && slide<T>(c, false, true);
+
+	case 0b010000: {
+		if (!vv) {
+			// vmv.s.x: ignores LMUL and masking, writes element 0 only
+			if (c.masked || c.vs2 != 0)
+				return false;
+			if (c.vstart < c.vl)
+				c.v.reg<T>(c.vd)[0] = c.scalar;
+			return true;
+		} else if (c.vs1 == 0b00000) {
+			// vmv.x.s: performed even if vl is 0
+			if (c.masked)
+				return false;
+			c.rd_wdata = (ux_t)(S)c.v.reg<T>(c.vs2)[0];
+			return true;
+		} else if (c.vs1 == 0b10000 || c.vs1 == 0b10001) {
+			// vcpop.m, vfirst.m
+			if (c.vstart != 0)
+				return false;
+			ux_t count = 0;
+			ux_t first = -1u;
+			for (uint i = 0; i < c.vl; ++i) {
+				if (c.active(i) && c.v.mask_bit(c.vs2, i)) {
+					if (!count)
+						first = i;
+					++count;
+				}
+			}
+			c.rd_wdata = c.vs1 == 0b10000 ? count : first;
+			return true;
+		}
+		return false;
+	}
+
+	case 0b010100: {
+		if (!vv || c.vstart != 0)
+			return false;
+		if (c.vs1 == 0b10001) {
+			// vid.v
+			if (c.vs2 != 0 || !c.vd_ok())
+				return false;
+			T *vd = c.v.reg<T>(c.vd);
+			for (uint i = 0; i < c.vl; ++i) {
+				if (c.active(i))
+					vd[i] = i;
+			}
+			return true;
+		}
+		// The remaining instructions read a mask from vs2, and must not
+		// overwrite it (or v0) part way through
+		if (c.vd == c.vs2 || (c.masked && c.vd == 0))
+			return false;
+		if (c.vs1 == 0b10000) {
+			// viota.m
+			if (!c.aligned(c.vd))
+				return false;
+			T *vd = c.v.reg<T>(c.vd);
+			T count = 0;
+			for (uint i = 0; i < c.vl; ++i) {
+				if (c.active(i)) {
+					vd[i] = count;
+					count += c.v.mask_bit(c.vs2, i);
+				}
+			}
+			return true;
+		} else if (c.vs1 == 0b00001 || c.vs1 == 0b00010 || c.vs1 == 0b00011) {
+			// vmsbf.m, vmsof.m, vmsif.m: set before/only/including first
+			bool found = false;
+			for (uint i = 0; i < c.vl; ++i) {
+				if (!c.active(i))
+					continue;
+				bool first = !found && c.v.mask_bit(c.vs2, i);
+				bool result =
+					c.vs1 == 0b00001 ? !found && !first :
+					c.vs1 == 0b00010 ? first : !found;
+				found = found || first;
+				c.v.set_mask_bit(c.vd, i, result);
+			}
+			return true;
+		}
+		return false;
+	}
+
+	case 0b011000: return vv && mask_logical(c, [](bool a, bool b) {return a && !b;});
+	case 0b011001: return vv && mask_logical(c, [](bool a, bool b) {return a && b;});
+	case 0b011010: return vv && mask_logical(c, [](bool a, bool b) {return a || b;});
+	case 0b011011: return vv && mask_logical(c, [](bool a, bool b) {return a != b;});
+	case 0b011100: return vv && mask_logical(c, [](bool a, bool b) {return a || !b;});
+	case 0b011101: return vv && mask_logical(c, [](bool a, bool b) {return !(a && b);});
+	case 0b011110: return vv && mask_logical(c, [](bool a, bool b) {return !(a || b);});
+	case 0b011111: return vv && mask_logical(c, [](bool a, bool b) {return a == b;});
+
+	// Division follows the scalar M extension for divide-by-zero and overflow
+	case 0b100000: return elementwise<T>(c, [](T, T a, T b) {return b ? T(a / b) : ~T(0);});
+	case 0b100001: return elementwise<T>(c, [](T, T a, T b) {
+		return !b ? ~T(0) : a == min_s && (S)b == -1 ? a : T((S)a / (S)b);
+	});
+	case 0b100010: return elementwise<T>(c, [](T, T a, T b) {return b ? T(a % b) : a;});
+	case 0b100011: return elementwise<T>(c, [](T, T a, T b) {
+		return !b ? a : a == min_s && (S)b == -1 ? T(0) : T((S)a % (S)b);
+	});
+
+	case 0b100101: return elementwise<T>(c, [](T, T a, T b) {return T((P)a * b);});
+	case 0b100100:
+	case 0b100110:
+	case 0b100111:
+		// High-half multiplies are not part of Zve64* for SEW=64
+		if constexpr (sew == 64) {
+			return false;
+		} else {
+			typedef typename DoubleWidth<T>::type W;
+			typedef std::make_signed_t<W> SW;
+			switch (c.funct6) {
+			case 0b100100: return elementwise<T>(c, [](T, T a, T b) {return T((W)a * b >> sew);});
+			case 0b100110: return elementwise<T>(c, [](T, T a, T b) {return T((SW)(S)a * (SW)b >> sew);});
+			default:       return elementwise<T>(c, [](T, T a, T b) {return T((SW)(S)a * (S)b >> sew);});
+			}
+		}
+
+	case 0b101001: return elementwise<T>(c, [](T d, T a, T b) {return T((P)d * b + a);});
+	case 0b101011: return elementwise<T>(c, [](T d, T a, T b) {return T(a - (P)d * b);});
+	case 0b101101: return elementwise<T>(c, [](T d, T a, T b) {return T(d + (P)a * b);});
+	case 0b101111: return elementwise<T>(c, [](T d, T a, T b) {return T(d - (P)a * b);});
+
+	default: return false;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Core interface
+
+std::optional<uint> RVCore::vector_op(uint32_t instr, std::optional<ux_t> &rd_wdata) {
+	uint funct3 = GETBITS(instr, 14, 12);
+	uint regnum_rd = GETBITS(instr, 11, 7);
+	uint regnum_rs1 = GETBITS(instr, 19, 15);
+	ux_t rs1 = regs[regnum_rs1];
+
+	if (!csr.vec_enabled())
+		return XCAUSE_INSTR_ILLEGAL;
+
+	if (funct3 == OPCFG) {
+		ux_t vtype;
+		ux_t avl;
+		if (!GETBIT(instr, 31)) {
+			// vsetvli
+			vtype = GETBITS(instr, 30, 20);
+			avl = rs1;
+		} else if (GETBITS(instr, 31, 30) == 0b11) {
+			// vsetivli
+			vtype = GETBITS(instr, 29, 20);
+			avl = regnum_rs1;
+		} else if (GETBITS(instr, 31, 25) == 0b1000000) {
+			// vsetvl
+			vtype = regs[GETBITS(instr, 24, 20)];
+			avl = rs1;
+		} else {
+			return XCAUSE_INSTR_ILLEGAL;
+		}
+		bool avl_is_reg = GETBITS(instr, 31, 30) != 0b11;
+		if (avl_is_reg && regnum_rs1 == 0) {
+			// rd == x0, rs1 == x0 keeps the current vl, otherwise rs1 == x0
+			// requests VLMAX.
+			avl = regnum_rd == 0 ? csr.get_vl() : -1u;
+		}
+		uint vlmax = VType(vtype).vlmax();
+		if (!vlmax) {
+			vtype = VTYPE_VILL;
+		}
+		ux_t vl = std::min<ux_t>(avl, vlmax);
+		csr.vec_set_config(vl, vtype);
+		csr.vec_set_vstart(0);
+		csr.vec_set_dirty();
+		rd_wdata = vl;
+		return std::nullopt;
+	}
+
+	if (funct3 == OPFVV || funct3 == OPFVF) {
+		// No vector floating point
+		return XCAUSE_INSTR_ILLEGAL;
+	}
+
+	uint funct6 = GETBITS(instr, 31, 26);
+	uint regnum_vs2 = GETBITS(instr, 24, 20);
+
+	if (funct6 == 0b100111 && funct3 == OPIVI) {
+		// vmv<nr>r.v: whole register move, independent of vtype
+		uint nr = regnum_rs1 + 1;
+		if (!GETBIT(instr, 25) || (nr != 1 && nr != 2 && nr != 4 && nr != 8) ||
+			(regnum_rd & (nr - 1)) || (regnum_vs2 & (nr - 1))) {
+			return XCAUSE_INSTR_ILLEGAL;
+		}
+		VType vt(csr.get_vtype());
+		uint eew_bytes = vt.vill ? 1 : vt.sew / 8;
+		uint start = std::min<uint>(csr.get_vstart() * eew_bytes, nr * VLENB);
+		memmove(vregs.bytes(regnum_rd) + start, vregs.bytes(regnum_vs2) + start, nr * VLENB - start);
+		csr.vec_set_vstart(0);
+		csr.vec_set_dirty();
+		return std::nullopt;
+	}
+
+	VType vt(csr.get_vtype());
+	if (vt.vill)
+		return XCAUSE_INSTR_ILLEGAL;
+
+	bool imm = funct3 == OPIVI;
+	bool scalar_operand = funct3 == OPIVX || funct3 == OPMVX;
+	// Shift amounts, slide offsets and gather indices are unsigned immediates
+	bool uimm = imm && (funct6 == 0b100101 || funct6 == 0b101000 || funct6 == 0b101001 ||
+		funct6 == 0b001100 || funct6 == 0b001110 || funct6 == 0b001111);
+	uint64_t scalar =
+		scalar_operand ? (uint64_t)(int64_t)(sx_t)rs1 :
+		uimm ? (uint64_t)regnum_rs1 :
+		imm ? (uint64_t)(int64_t)(regnum_rs1 & 0x10 ? (int)regnum_rs1 - 32 : (int)regnum_rs1) : 0;
+
+	VecArith c = {
+		vregs,
+		csr,
+		funct3,
+		funct6,
+		regnum_rd,
+		regnum_rs1,
+		regnum_vs2,
+		!GETBIT(instr, 25),
+		funct3 == OPIVV || funct3 == OPMVV,
+		scalar,
+		csr.get_vstart(),
+		csr.get_vl(),
+		vt.vlmax(),
+		vt.regs_per_group(),
+		std::nullopt
+	};
+
+	bool opm = funct3 == OPMVV || funct3 == OPMVX;
+	bool ok;
+	switch (vt.sew) {
+		case 8:  ok = opm ? vec_opm<uint8_t >(c) : vec_opi<uint8_t >(c); break;
+		case 16: ok = opm ? vec_opm<uint16_t>(c) : vec_opi<uint16_t>(c); break;
+		case 32: ok = opm ? vec_opm<uint32_t>(c) : vec_opi<uint32_t>(c); break;
+		default: ok = opm ? vec_opm<uint64_t>(c) : vec_opi<uint64_t>(c); break;
+	}
+	if (!ok)
+		return XCAUSE_INSTR_ILLEGAL;
+
+	rd_wdata = c.rd_wdata;
+	csr.vec_set_vstart(0);
+	csr.vec_set_dirty();
+	return std::nullopt;
+}
+
+// Load or store one element. data points into the vector register file.
+std::optional<uint> RVCore::vector_access_element(ux_t vaddr, uint size, uint8_t *data, bool store) {
+	if (vaddr & (size - 1)) {
+		return store ? XCAUSE_STORE_ALIGN : XCAUSE_LOAD_ALIGN;
+	}
+	uint8_t *p;
+	std::optional<ux_t> paddr = vmap_ls(vaddr, store ? PTE_W : PTE_R, &p);
+	if (!paddr) {
+		return store ? XCAUSE_STORE_PAGEFAULT : XCAUSE_LOAD_PAGEFAULT;
+	}
+	if (!pmp_permits_ls(*paddr, size, store ? PMP_W : PMP_R)) {
+		return store ? XCAUSE_STORE_FAULT : XCAUSE_LOAD_FAULT;
+	}
+	if (p) {
+		if (store) {
+			memcpy(p, data, size);
+			code_cache.write(*paddr, size);
+		} else {
+			memcpy(data, p, size);
+		}
+		return std::nullopt;
+	}
+	bool ok = true;
+	for (uint i = 0; i < size && ok; i += std::min(size, 4u)) {
+		ux_t addr = *paddr + i;
+		uint32_t x = 0;
+		if (store) {
+			memcpy(&x, data + i, std::min(size, 4u));
+			ok = size == 1 ? mem.w8(addr, x) : size == 2 ? mem.w16(addr, x) : mem.w32(addr, x);
+		} else {
+			std::optional<uint32_t> rdata;
+			if (size == 1)
+				rdata = mem.r8(addr);
+			else if (size == 2)
+				rdata = mem.r16(addr);
+			else
+				rdata = mem.r32(addr);
+			ok = rdata.has_value();
+			x = rdata.value_or(0);
+			memcpy(data + i, &x, std::min(size, 4u));
+		}
+	}
+	if (!ok) {
+		return store ? XCAUSE_STORE_FAULT : XCAUSE_LOAD_FAULT;
+	}
+	return std::nullopt;
+}
+
+std::optional<uint> RVCore::vector_load_store(uint32_t instr, std::optional<ux_t> &xtval) {
+	bool store = GETBITS(instr, 6, 2) == OPC_STORE_FP;
+	uint nf = GETBITS(instr, 31, 29) + 1;
+	uint mop = GETBITS(instr, 27, 26);
+	bool masked = !GETBIT(instr, 25);
+	uint umop = GETBITS(instr, 24, 20);
+	uint width = GETBITS(instr, 14, 12);
+	uint vd = GETBITS(instr, 11, 7);
+	ux_t base = regs[GETBITS(instr, 19, 15)];
+	ux_t stride_reg = regs[GETBITS(instr, 24, 20)];
+	uint vs2 = GETBITS(instr, 24, 20);
+
+	if (!csr.vec_enabled() || GETBIT(instr, 28))
+		return XCAUSE_INSTR_ILLEGAL;
+	uint eew_log2 = width == 0b000 ? 0 : width - 0b100;
+	uint eew = 8u << eew_log2;
+
+	enum {UNIT, WHOLE, MASK, FAULT_FIRST, STRIDED, INDEXED} kind;
+	if (mop == 0b00) {
+		if (umop == 0b00000)
+			kind = UNIT;
+		else if (umop == 0b01000)
+			kind = WHOLE;
+		else if (umop == 0b01011)
+			kind = MASK;
+		else if (umop == 0b10000 && !store)
+			kind = FAULT_FIRST;
+		else
+			return XCAUSE_INSTR_ILLEGAL;
+	} else {
+		kind = mop == 0b10 ? STRIDED : INDEXED;
+	}
+
+	// Segment loads/stores are not implemented (nf > 1 only valid for
+	// whole-register accesses)
+	if (nf > 1 && kind != WHOLE)
+		return XCAUSE_INSTR_ILLEGAL;
+
+	VType vt(csr.get_vtype());
+	uint start = csr.get_vstart();
+	uint evl;
+	uint elem_size;
+	if (kind == WHOLE) {
+		// Independent of vtype and vl
+		if (masked || (nf != 1 && nf != 2 && nf != 4 && nf != 8) || (vd & (nf - 1)))
+			return XCAUSE_INSTR_ILLEGAL;
+		// Whole-register stores are always byte-sized (the width field must be 8)
+		if (store && width != 0b000)
+			return XCAUSE_INSTR_ILLEGAL;
+		elem_size = eew / 8;
+		evl = nf * VLENB / elem_size;
+	} else if (kind == MASK) {
+		if (vt.vill || masked || width != 0b000)
+			return XCAUSE_INSTR_ILLEGAL;
+		elem_size = 1;
+		evl = (csr.get_vl() + 7) / 8;
+	} else {
+		if (vt.vill)
+			return XCAUSE_INSTR_ILLEGAL;
+		// For indexed accesses, EEW applies to the index and data is SEW.
+		// Otherwise data EMUL = (EEW / SEW) * LMUL.
+		uint data_eew = kind == INDEXED ? vt.sew : eew;
+		int sew_log2 = __builtin_ctz(vt.sew);
+		int emul_log2 = (int)__builtin_ctz(eew) - sew_log2 + vt.lmul_log2;
+		if (emul_log2 < -3 || emul_log2 > 3)
+			return XCAUSE_INSTR_ILLEGAL;
+		uint data_regs = 1u << std::max(kind == INDEXED ? vt.lmul_log2 : emul_log2, 0);
+		uint index_regs = 1u << std::max(emul_log2, 0);
+		if ((vd & (data_regs - 1)) || (masked && vd == 0))
+			return XCAUSE_INSTR_ILLEGAL;
+		if (kind == INDEXED && ((vs2 & (index_regs - 1)) || (!store && vd == vs2)))
+			return XCAUSE_INSTR_ILLEGAL;
+		elem_size = data_eew / 8;
+		evl = csr.get_vl();
+	}
+
+	uint8_t *data = vregs.bytes(vd);
+	auto element_addr = [&](uint i) -> ux_t {
+		switch (kind) {
+			case STRIDED: return base + i * stride_reg;
+			case INDEXED: {
+				uint8_t *index = vregs.bytes(vs2) + i * (eew / 8);
+				uint64_t offset = 0;
+				memcpy(&offset, index, eew / 8);
+				return base + (ux_t)offset;
+			}
+			default:      return base + i * elem_size;
+		}
+	};
+
+	// Record a fault on element i. Fault-only-first loads just truncate vl,
+	// unless it's the first element.
+	auto fault = [&](uint i, uint cause) -> std::optional<uint> {
+		if (kind == FAULT_FIRST && i > 0) {
+			csr.vec_set_config(i, csr.get_vtype());
+			csr.vec_set_vstart(0);
+			csr.vec_set_dirty();
+			return std::nullopt;
+		}
+		csr.vec_set_vstart(i);
+		xtval = element_addr(i);
+		return cause;
+	};
+
+	uint i = start;
+	bool contiguous = kind == UNIT || kind == WHOLE || kind == MASK || kind == FAULT_FIRST;
+	if (contiguous && !masked) {
+		// Fast path: translate once per page, and copy runs of elements
+		// directly to/from RAM.
+		while (i < evl) {
+			ux_t vaddr = base + i * elem_size;
+			if (vaddr & (elem_size - 1))
+				return fault(i, store ? XCAUSE_STORE_ALIGN : XCAUSE_LOAD_ALIGN);
+			uint n = std::min<uint>(evl - i, (0x1000 - (vaddr & 0xfff)) / elem_size);
+			uint8_t *p;
+			std::optional<ux_t> paddr = vmap_ls(vaddr, store ? PTE_W : PTE_R, &p);
+			if (!paddr)
+				return fault(i, store ? XCAUSE_STORE_PAGEFAULT : XCAUSE_LOAD_PAGEFAULT);
+			uint bytes = n * elem_size;
+			// A run which fails PMP is retried element by element, to find
+			// the faulting element
+			if (p && pmp_permits_ls(*paddr, bytes, store ? PMP_W : PMP_R)) {
+				if (store) {
+					memcpy(p, data + i * elem_size, bytes);
+					code_cache.write(*paddr, bytes);
+				} else {
+					memcpy(data + i * elem_size, p, bytes);
+				}
+				i += n;
+			} else {
+				for (uint end = i + n; i < end; ++i) {
+					std::optional<uint> cause = vector_access_element(
+						base + i * elem_size, elem_size, data + i * elem_size, store);
+					if (cause)
+						return fault(i, *cause);
+				}
+			}
+		}
+	} else {
+		for (; i < evl; ++i) {
+			if (masked && !vregs.mask_bit(0, i))
+				continue;
+			std::optional<uint> cause = vector_access_element(element_addr(i), elem_size,
+				data + i * elem_size, store);
+			if (cause)
+				return fault(i, *cause);
+		}
+	}
+
+	csr.vec_set_vstart(0);
+	csr.vec_set_dirty();
+	return std::nullopt;
+}
@@ -0,0 +1,349 @@
+#!/usr/bin/env python3
+
+import argparse
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+import gen_decoder
+
+# Translate the code in a program image ahead of time into C++, and build it
+# into a shared object for rvcpp --aot. See include/rv_aot.h for how rvcpp
+# uses it.
+#
+# Code is found by recursive traversal from the entry point, and from every
+# function symbol if the image is an ELF file: branch and jump targets are
+# followed, and falling through stops at unconditional jumps, returns and
+# anything which does not decode. An auipc/jalr pair (call or tail with a
+# far target) is followed as a direct jump. Other indirect jump targets
+# can't be known, so code only reached that way is left to the interpreter.
+#
+# A block starts at each place execution can enter from elsewhere: a root,
+# a branch or jump target, the return address of a call, and the
+# instruction after anything which isn't translated (which the interpreter
+# runs before carrying on). It runs on through instructions from the fast
+# path's set (include/rv_ops.h) until an unconditional jump, something
+# which isn't translated, the end of the page, or MAX_BLOCK_INSTRS. Blocks
+# overlap where one leader falls inside another block. Each instruction is
+# translated by the fast path's own macro for it, so the semantics are
+# shared with the interpreter, and direct branches to instructions within
+# the same block are jumps within the function.
+#
+# Anything wrongly taken to be code costs only space: rvcpp only uses a
+# block while memory holds exactly the instructions it was translated from,
+# and only from an address execution actually reaches.
+
+PAGE_SIZE = 0x1000
+MAX_BLOCK_INSTRS = 128
+# As in include/rv_aot.h
+RV_AOT_IMAGE_SYMBOL = "rvcpp_aot_image"
+
+class Decoder:
+	def __init__(self, opcodes_path):
+		ops = gen_decoder.parse_opcodes(opcodes_path)
+		self.version = gen_decoder.decode_version(ops)
+		self.by_priority = gen_decoder.priority_order(ops)
+
+	def decode(self, instr):
+		width = 32 if instr & 0x3 == 0x3 else 16
+		for o in self.by_priority:
+			if o.width == width and instr & o.mask == o.bits:
+				return o.name
+		return None
+
+class Image:
+	def __init__(self):
+		# Loaded bytes by physical address, and the address of each byte
+		# which came from the file (code is only looked for there)
+		self.pages = {}
+		self.file_bytes = set()
+		self.entry = None
+		self.symbols = []
+		# (vaddr, paddr, size) of each loaded segment
+		self.segments = []
+
+	def store(self, paddr, data, from_file=True):
+		for i, b in enumerate(data):
+			addr = paddr + i
+			page = self.pages.setdefault(addr & ~(PAGE_SIZE - 1), bytearray(PAGE_SIZE))
+			page[addr & (PAGE_SIZE - 1)] = b
+			if from_file:
+				self.file_bytes.add(addr)
+
+	def has_code(self, paddr, size):
+		return all(paddr + i in self.file_bytes for i in range(size))
+
+	def read(self, paddr, size):
+		page = self.pages.get(paddr & ~(PAGE_SIZE - 1))
+		offset = paddr & (PAGE_SIZE - 1)
+		if page is None or offset + size > PAGE_SIZE:
+			return None
+		return int.from_bytes(page[offset:offset + size], "little")
+
+	def slice(self, paddr, size):
+		page = self.pages[paddr & ~(PAGE_SIZE - 1)]
+		offset = paddr & (PAGE_SIZE - 1)
+		return bytes(page[offset:offset + size])
+
+	def to_paddr(self, vaddr):
+		for seg_vaddr, seg_paddr, size in self.segments:
+			if seg_vaddr <= vaddr < seg_vaddr + size:
+				return vaddr - seg_vaddr + seg_paddr
+		return None
+
+def load_elf(data, image):
+	if data[4] != 1 or data[5] != 1:
+		sys.exit("Only little-endian 32-bit ELF files are supported")
+	(e_type, e_machine, e_version, e_entry, e_phoff, e_shoff, e_flags, e_ehsize,
+		e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx) = struct.unpack_from("<HHIIIIIHHHHHH", data, 16)
+	if e_machine != 243:
+		sys.exit("Not a RISC-V ELF file")
+	for i in range(e_phnum):
+		p_type, p_offset, p_vaddr, p_paddr, p_filesz, p_memsz, p_flags, p_align = \
+			struct.unpack_from("<IIIIIIII", data, e_phoff + i * e_phentsize)
+		if p_type != 1:
+			continue
+		image.store(p_paddr, data[p_offset:p_offset + p_filesz])
+		image.store(p_paddr + p_filesz, bytes(p_memsz - p_filesz), from_file=False)
+		image.segments.append((p_vaddr, p_paddr, p_memsz))
+	image.entry = image.to_paddr(e_entry)
+	sections = [struct.unpack_from("<IIIIIIIIII", data, e_shoff + i * e_shentsize) for i in range(e_shnum)]
+	for sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, sh_link, sh_info, sh_addralign, sh_entsize in sections:
+		# SHT_SYMTAB, with STT_FUNC symbols
+		if sh_type != 2:
+			continue
+		for off in range(sh_offset, sh_offset + sh_size, sh_entsize):
+			st_name, st_value, st_size, st_info, st_other, st_shndx = struct.unpack_from("<IIIBBH", data, off)
+			if st_info & 0xf == 2 and st_shndx != 0:
+				paddr = image.to_paddr(st_value)
+				if paddr is not None:
+					image.symbols.append(paddr)
+
+def sext(x, bits):
+	return x - (1 << bits) if x >> (bits - 1) & 1 else x
+
+def imm_b(i):
+	return sext((i >> 31 & 1) << 12 | (i >> 7 & 1) << 11 | (i >> 25 & 0x3f) << 5 | (i >> 8 & 0xf) << 1, 13)
+
+def imm_j(i):
+	return sext((i >> 31 & 1) << 20 | (i >> 12 & 0xff) << 12 | (i >> 20 & 1) << 11 | (i >> 21 & 0x3ff) << 1, 21)
+
+def imm_cj(i):
+	return sext((i >> 12 & 1) << 11 | (i >> 11 & 1) << 4 | (i >> 9 & 0x3) << 8 | (i >> 8 & 1) << 10 |
+		(i >> 7 & 1) << 6 | (i >> 6 & 1) << 7 | (i >> 3 & 0x7) << 1 | (i >> 2 & 1) << 5, 12)
+
+def imm_cb(i):
+	return sext((i >> 12 & 1) << 8 | (i >> 10 & 0x3) << 3 | (i >> 5 & 0x3) << 6 | (i >> 3 & 0x3) << 1 |
+		(i >> 2 & 1) << 5, 9)
+
+BRANCHES = {"BEQ", "BNE", "BLT", "BGE", "BLTU", "BGEU"}
+
+def instr_size(instr):
+	return 4 if instr & 0x3 == 0x3 else 2
+
+def successors(name, instr, pc, image, decoder):
+	size = instr_size(instr)
+	rd = instr >> 7 & 0x1f
+	rs2_c = instr >> 2 & 0x1f
+	if name in BRANCHES:
+		return [pc + 4, pc + imm_b(instr)]
+	if name == "JAL":
+		return [pc + imm_j(instr)] + ([pc + 4] if rd else [])
+	if name == "JALR":
+		targets = [pc + 4] if rd else []
+		rs1 = instr >> 15 & 0x1f
+		prev = image.read(pc - 4, 4) if image.has_code(pc - 4, 4) else None
+		if prev is not None and rs1 != 0 and decoder.decode(prev) == "AUIPC" and prev >> 7 & 0x1f == rs1:
+			targets.append((pc - 4 + (prev & 0xfffff000) + sext(instr >> 20, 12)) & ~1)
+		return targets
+	if name in ("C_BEQZ", "C_BNEZ"):
+		return [pc + 2, pc + imm_cb(instr)]
+	if name == "C_J":
+		return [pc + imm_cj(instr)]
+	if name == "C_JAL":
+		return [pc + imm_cj(instr), pc + 2]
+	if name == "C_MV" and rs2_c == 0:
+		# c.jr
+		return []
+	if name in ("MRET", "SRET", "ILLEGAL16"):
+		return []
+	return [pc + size]
+
+# Target of a direct branch or jump, or None
+def direct_target(name, instr, pc):
+	if name in BRANCHES:
+		return pc + imm_b(instr)
+	if name == "JAL":
+		return pc + imm_j(instr)
+	if name in ("C_BEQZ", "C_BNEZ"):
+		return pc + imm_cb(instr)
+	if name in ("C_J", "C_JAL"):
+		return pc + imm_cj(instr)
+	return None
+
+def ends_block(name, instr):
+	c_rs1 = instr >> 7 & 0x1f
+	c_rs2 = instr >> 2 & 0x1f
+	return name in ("JAL", "JALR", "C_J", "C_JAL") or \
+		(name in ("C_MV", "C_ADD") and c_rs2 == 0 and c_rs1 != 0)
+
+def traverse(image, decoder):
+	# Instruction and op name by physical address
+	found = {}
+	roots = ([image.entry] if image.entry is not None else []) + image.symbols
+	work = [pc & 0xffffffff for pc in roots]
+	while work:
+		pc = work.pop()
+		if pc in found or pc & 0x1 or not image.has_code(pc, 2):
+			continue
+		instr = image.read(pc, 2)
+		if instr & 0x3 == 0x3:
+			if not image.has_code(pc, 4):
+				continue
+			instr = image.read(pc, 4)
+		name = decoder.decode(instr)
+		if name is None:
+			continue
+		found[pc] = (instr, name)
+		work.extend(s & 0xffffffff for s in successors(name, instr, pc, image, decoder))
+	return found
+
+# Names of the ops in RV_FAST_OPS in rv_ops.h
+def parse_fast_ops(path):
+	text = open(path).read()
+	m = re.search(r"#define RV_FAST_OPS\(X\)((?:.*\\\n)*.*)", text)
+	if not m:
+		sys.exit(f"{path}: RV_FAST_OPS not found")
+	return set(re.findall(r"X\((\w+)\)", m.group(1)))
+
+def translatable(pc, found, fast_ops):
+	if pc not in found:
+		return False
+	instr, name = found[pc]
+	if name not in fast_ops:
+		return False
+	# c.ebreak is left to the slow path
+	if name == "C_ADD" and instr >> 2 & 0x1f == 0 and instr >> 7 & 0x1f == 0:
+		return False
+	# As are 32-bit instructions which cross a page
+	return not (instr_size(instr) == 4 and pc & (PAGE_SIZE - 1) == PAGE_SIZE - 2)
+
+def find_blocks(image, decoder, found, fast_ops):
+	leaders = set(pc & 0xffffffff for pc in ([image.entry] if image.entry is not None else []) + image.symbols)
+	for pc, (instr, name) in found.items():
+		size = instr_size(instr)
+		succ = successors(name, instr, pc, image, decoder)
+		if succ != [pc + size] or not translatable(pc, found, fast_ops):
+			leaders.update(s & 0xffffffff for s in succ)
+			leaders.add((pc + size) & 0xffffffff)
+	blocks = []
+	work = list(leaders)
+	while work:
+		start = work.pop()
+		instrs = []
+		pc = start
+		while len(instrs) < MAX_BLOCK_INSTRS and translatable(pc, found, fast_ops) and \
+				pc & ~(PAGE_SIZE - 1) == start & ~(PAGE_SIZE - 1):
+			instr, name = found[pc]
+			instrs.append((pc, instr, name))
+			pc += instr_size(instr)
+			if ends_block(name, instr):
+				break
+		if instrs:
+			blocks.append((start, instrs))
+			# The instruction after a block cut short is entered from it
+			if pc in found and pc not in leaders and not ends_block(instrs[-1][2], instrs[-1][1]):
+				leaders.add(pc)
+				work.append(pc)
+	return sorted(blocks)
+
+def emit(image, decoder, blocks):
+	out = []
+	out.append("// Generated by scripts/aot_translate.py. Do not edit.")
+	out.append("")
+	out.append("#include \"rv_aot_block.h\"")
+	for start, instrs in blocks:
+		size = instrs[-1][0] + instr_size(instrs[-1][1]) - start
+		labels = {pc: k for k, (pc, instr, name) in enumerate(instrs)}
+		cases = sorted(set(labels[t] for pc, instr, name in instrs
+			for t in [direct_target(name, instr, pc)] if t is not None and t & 0xffffffff in labels))
+		out.append("")
+		code = image.slice(start, size)
+		out.append(f"static const uint8_t code_{start:08x}[] = {{")
+		for i in range(0, size, 16):
+			out.append("\t" + " ".join(f"0x{b:02x}," for b in code[i:i + 16]))
+		out.append("};")
+		out.append("")
+		out.append(f"static void block_{start:08x}(AOTContext *ctx, ux_t pc) {{")
+		out.append("\tAOT_BLOCK_BEGIN")
+		for k, (pc, instr, name) in enumerate(instrs):
+			out.append(f"i{k}:")
+			out.append(f"#define AOT_NEXT i{k + 1}")
+			out.append(f"\t{{const uint32_t instr = 0x{instr:08x}u; RV_FAST_OP_{name}}}")
+			out.append("#undef AOT_NEXT")
+		out.append(f"i{len(instrs)}:")
+		out.append(f"\tAOT_BLOCK_END({len(instrs)})")
+		for k in cases:
+			out.append(f"\tcase 0x{instrs[k][0] - start:x}: goto i{k};")
+		out.append("\tAOT_BLOCK_RETURN")
+		out.append("}")
+	out.append("")
+	out.append("static const AOTBlock blocks[] = {")
+	for start, instrs in blocks:
+		size = instrs[-1][0] + instr_size(instrs[-1][1]) - start
+		out.append(f"\t{{0x{start:08x}u, 0x{size:x}, {len(instrs)}, code_{start:08x}, block_{start:08x}}},")
+	out.append("};")
+	out.append("")
+	out.append(f"extern \"C\" const AOTImage {RV_AOT_IMAGE_SYMBOL} = {{")
+	out.append(f"\tRV_AOT_ABI_VERSION, 0x{decoder.version:08x}u, {len(blocks)}, blocks")
+	out.append("};")
+	return "\n".join(out) + "\n"
+
+def main():
+	include_dir = os.path.join(os.path.dirname(__file__), "..", "include")
+	parser = argparse.ArgumentParser(description="Translate a program image into a shared object for rvcpp --aot")
+	parser.add_argument("image", help="ELF file, or flat binary")
+	parser.add_argument("out", help="Shared object to write")
+	parser.add_argument("--base", type=lambda x: int(x, 0), default=0x80000000,
+		help="Load address of a flat binary (default 0x80000000, the beginning of RAM)")
+	parser.add_argument("--entry", type=lambda x: int(x, 0), action="append", default=[],
+		help="Additional address to start from. Can be passed multiple times.")
+	parser.add_argument("--include", default=include_dir,
+		help="Path to the rvcpp include directory")
+	parser.add_argument("--cxx", default=os.environ.get("CXX", "c++"),
+		help="C++ compiler (default $CXX, or c++)")
+	parser.add_argument("--keep-cpp", metavar="PATH",
+		help="Also write the generated C++ to PATH")
+	args = parser.parse_args()
+
+	decoder = Decoder(os.path.join(args.include, "encoding", "rv_opcodes.h"))
+	fast_ops = parse_fast_ops(os.path.join(args.include, "rv_ops.h"))
+	data = open(args.image, "rb").read()
+	image = Image()
+	if data[:4] == b"\x7fELF":
+		load_elf(data, image)
+	else:
+		image.store(args.base, data)
+		image.entry = args.base
+	image.symbols += args.entry
+	found = traverse(image, decoder)
+	blocks = find_blocks(image, decoder, found, fast_ops)
+	source = emit(image, decoder, blocks)
+	if args.keep_cpp:
+		with open(args.keep_cpp, "w") as f:
+			f.write(source)
+	with tempfile.TemporaryDirectory() as tmp:
+		cpp_path = os.path.join(tmp, "aot.cpp")
+		with open(cpp_path, "w") as f:
+			f.write(source)
+		cmd = [args.cxx, "-std=c++17", "-O2", "-shared", "-fPIC", "-I", args.include, cpp_path, "-o", args.out]
+		if subprocess.run(cmd).returncode != 0:
+			sys.exit("Failed to compile translated code")
+	n_instrs = sum(len(instrs) for start, instrs in blocks)
+	print(f"{len(blocks)} blocks, {n_instrs} instructions")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,247 @@
+#!/usr/bin/env python3
+
+import argparse
+import re
+import sys
+import zlib
+
+# Generate a decoder from the RVOPC_<name>_BITS/RVOPC_<name>_MASK tables in
+# encoding/rv_opcodes.h. Each opcode gets a dense index (RVOP_<name>), and
+# rv_decode() maps an instruction to its index, or RVOP_INVALID.
+#
+# The first level is a table indexed by the major opcode and funct3 of a
+# 32-bit instruction, or the quadrant and funct3 of a 16-bit instruction.
+# This is enough to identify most instructions on its own. The rest are
+# resolved by a decision tree, where each node switches on the bit field
+# which best splits the remaining candidates. Where encodings overlap (e.g.
+# c.addi4spn and the all-zeroes illegal instruction) the one with more fixed
+# bits wins, so table order does not matter.
+
+# Extensions which rvcpp does not implement. These are left out so they
+# decode as invalid, and so they don't shadow implemented instructions (Zcmp
+# reuses the c.fsdsp encoding space).
+EXCLUDED_SECTIONS = ["Zbc", "Zbkb", "Zbkc", "Zbkx", "Hazard3", "Xh3b", "Zcb", "Zcmp"]
+
+# First-level key: 256 entries for 32-bit instructions, 24 for 16-bit
+N_KEYS = 256 + 24
+
+class Opcode:
+	def __init__(self, name, bits, mask, width):
+		self.name = name
+		self.bits = bits
+		self.mask = mask
+		self.width = width
+
+def parse_opcodes(path):
+	opcodes = {}
+	order = []
+	excluded = False
+	for l in open(path).readlines():
+		m = re.match(r"^//\s*(\S+)", l)
+		if m:
+			excluded = m.group(1) in EXCLUDED_SECTIONS
+			continue
+		m = re.match(r"^#define\s+RVOPC_(\w+)_(BITS|MASK)\s+0b([01]+)", l)
+		if not m or excluded:
+			continue
+		name, kind, value = m.group(1), m.group(2), m.group(3)
+		if name not in opcodes:
+			opcodes[name] = {"width": len(value)}
+			order.append(name)
+		opcodes[name][kind] = int(value, 2)
+	ops = []
+	for name in order:
+		o = opcodes[name]
+		if "BITS" not in o or "MASK" not in o:
+			sys.exit(f"{path}: {name} is missing BITS or MASK")
+		if o["BITS"] & ~o["MASK"]:
+			sys.exit(f"{path}: {name} has BITS outside of MASK")
+		ops.append(Opcode(name, o["BITS"], o["MASK"], o["width"]))
+	return ops
+
+def key_fields(key):
+	# Returns (mask, bits) fixed by a first-level key, or None if the key is
+	# not a possible instruction (16-bit quadrant 3)
+	if key < 256:
+		return (0x1f << 2 | 0x7 << 12 | 0x3, (key >> 3) << 2 | (key & 0x7) << 12 | 0x3)
+	quadrant, funct3 = (key - 256) >> 3, (key - 256) & 0x7
+	if quadrant == 3:
+		return None
+	return (0x3 | 0x7 << 13, quadrant | funct3 << 13)
+
+def compatible(op, mask, bits):
+	common = op.mask & mask
+	return (op.bits & common) == (bits & common)
+
+def emit_tree(cands, known_mask, known_bits, indent, out):
+	# cands is in priority order. Anything after a candidate which is fully
+	# determined by the known bits is unreachable.
+	for i, c in enumerate(cands):
+		if c.mask & ~known_mask == 0:
+			cands = cands[:i + 1]
+			break
+	pad = "\t" * indent
+	if not cands:
+		out.append(f"{pad}return RVOP_INVALID;")
+		return
+	if len(cands) == 1:
+		c = cands[0]
+		rest = c.mask & ~known_mask
+		if rest == 0:
+			out.append(f"{pad}return RVOP_{c.name};")
+		else:
+			out.append(f"{pad}return (instr & 0x{rest:x}u) == 0x{c.bits & rest:x}u ? RVOP_{c.name} : RVOP_INVALID;")
+		return
+	# Pick the contiguous field (of up to 8 bits which some candidate cares
+	# about) which minimises the largest resulting candidate set
+	care = 0
+	for c in cands:
+		care |= c.mask & ~known_mask
+	best = None
+	for lsb in range(32):
+		for width in range(1, 9):
+			fmask = ((1 << width) - 1) << lsb
+			if lsb + width > 32 or fmask & ~care:
+				break
+			subsets = []
+			for v in range(1 << width):
+				vbits = v << lsb
+				subsets.append([c for c in cands if compatible(c, fmask, vbits)])
+			score = (max(len(s) for s in subsets), sum(len(s) for s in subsets), width)
+			if best is None or score < best[0]:
+				best = (score, lsb, width, subsets)
+	if best is None or best[0][0] == len(cands):
+		# No field separates them: check in priority order
+		for c in cands:
+			rest = c.mask & ~known_mask
+			out.append(f"{pad}if ((instr & 0x{rest:x}u) == 0x{c.bits & rest:x}u)")
+			out.append(f"{pad}\treturn RVOP_{c.name};")
+		out.append(f"{pad}return RVOP_INVALID;")
+		return
+	_, lsb, width, subsets = best
+	fmask = ((1 << width) - 1) << lsb
+	out.append(f"{pad}switch (instr >> {lsb} & 0x{(1 << width) - 1:x}u) {{")
+	# Values with the same candidates share a case body
+	groups = []
+	for v, s in enumerate(subsets):
+		names = [c.name for c in s]
+		for g in groups:
+			if g[0] == names:
+				g[1].append(v)
+				break
+		else:
+			groups.append((names, [v], s))
+	for names, values, s in groups:
+		if not s:
+			continue
+		for v in values:
+			out.append(f"{pad}case 0x{v:x}:")
+		emit_tree(s, known_mask | fmask, known_bits | (values[0] << lsb), indent + 1, out)
+	out.append(f"{pad}default:")
+	out.append(f"{pad}\treturn RVOP_INVALID;")
+	out.append(f"{pad}}}")
+
+def priority_order(ops):
+	# More fixed bits means higher priority. Stable, so ties keep table order.
+	return sorted(ops, key=lambda o: -bin(o.mask).count("1"))
+
+def decode_version(ops):
+	return zlib.crc32("".join(f"{o.name} {o.bits:x} {o.mask:x} {o.width}\n" for o in ops).encode())
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("opcodes", help="Path to encoding/rv_opcodes.h")
+	parser.add_argument("out", help="Output header path")
+	args = parser.parse_args()
+
+	ops = parse_opcodes(args.opcodes)
+	by_priority = priority_order(ops)
+
+	level1 = []
+	subtrees = []
+	for key in range(N_KEYS):
+		fields = key_fields(key)
+		if fields is None:
+			level1.append("RVOP_INVALID")
+			continue
+		kmask, kbits = fields
+		width = 32 if key < 256 else 16
+		cands = [o for o in by_priority if o.width == width and compatible(o, kmask, kbits)]
+		for i, c in enumerate(cands):
+			if c.mask & ~kmask == 0:
+				cands = cands[:i + 1]
+				break
+		if not cands:
+			level1.append("RVOP_INVALID")
+		elif len(cands) == 1 and cands[0].mask & ~kmask == 0:
+			level1.append(f"RVOP_{cands[0].name}")
+		else:
+			body = []
+			emit_tree(cands, kmask, kbits, 2, body)
+			for i, b in enumerate(subtrees):
+				if b == body:
+					break
+			else:
+				i = len(subtrees)
+				subtrees.append(body)
+			level1.append(f"RV_DECODE_SUBTREE | {i}")
+
+	out = []
+	out.append("// Generated by scripts/gen_decoder.py from encoding/rv_opcodes.h. Do not edit.")
+	out.append("")
+	out.append("#ifndef _ENCODING_RV_DECODE_H")
+	out.append("#define _ENCODING_RV_DECODE_H")
+	out.append("")
+	out.append("#include <cstdint>")
+	out.append("")
+	out.append("enum RVOp {")
+	out.append("\tRVOP_INVALID,")
+	for o in ops:
+		out.append(f"\tRVOP_{o.name},")
+	out.append("\tRVOP_COUNT")
+	out.append("};")
+	out.append("")
+	version = decode_version(ops)
+	out.append("// Identifies the op numbering and decode, for decoded instructions saved to")
+	out.append("// disk by a previous build")
+	out.append(f"static const uint32_t RV_DECODE_VERSION = 0x{version:08x}u;")
+	out.append("")
+	out.append("// First-level key: major opcode and funct3 of a 32-bit instruction, or")
+	out.append("// quadrant and funct3 of a 16-bit instruction")
+	out.append("static inline unsigned rv_decode_key(uint32_t instr) {")
+	out.append("\treturn (instr & 0x3) == 0x3 ?")
+	out.append("\t\t(instr >> 2 & 0x1fu) << 3 | (instr >> 12 & 0x7u) :")
+	out.append("\t\t256 + ((instr & 0x3u) << 3 | (instr >> 13 & 0x7u));")
+	out.append("}")
+	out.append("")
+	out.append("static const uint16_t RV_DECODE_SUBTREE = 0x8000;")
+	out.append("")
+	out.append(f"static const uint16_t rv_decode_level1[{N_KEYS}] = {{")
+	for key, entry in enumerate(level1):
+		out.append(f"\t{entry}, // {key:03x}")
+	out.append("};")
+	out.append("")
+	out.append("static inline RVOp rv_decode_subtree(unsigned tree, uint32_t instr) {")
+	out.append("\tswitch (tree) {")
+	for i, body in enumerate(subtrees):
+		out.append(f"\tcase {i}:")
+		out.extend(body)
+	out.append("\tdefault:")
+	out.append("\t\treturn RVOP_INVALID;")
+	out.append("\t}")
+	out.append("}")
+	out.append("")
+	out.append("// Instructions are 32-bit if instr[1:0] == 3, otherwise only instr[15:0]")
+	out.append("// is examined")
+	out.append("static inline RVOp rv_decode(uint32_t instr) {")
+	out.append("\tuint16_t entry = rv_decode_level1[rv_decode_key(instr)];")
+	out.append("\tif (entry & RV_DECODE_SUBTREE)")
+	out.append("\t\treturn rv_decode_subtree(entry & ~RV_DECODE_SUBTREE, instr);")
+	out.append("\treturn (RVOp)entry;")
+	out.append("}")
+	out.append("")
+	out.append("#endif")
+	open(args.out, "w").write("\n".join(out) + "\n")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,105 @@
+#!/bin/bash
+
+# Translate the test program with rvcpp/scripts/aot_translate.py, and check
+# that running it with --aot gives the same results as without. Also check
+# that rvcpp refuses translations it can't use. Needs python3 and a C++
+# compiler ($CXX, or c++).
+#
+# Usage: test.sh path/to/rvcpp aot.elf aot.bin
+
+if [ $# -ne 3 ]; then
+	echo "Usage: $0 rvcpp aot.elf aot.bin" >&2
+	exit 1
+fi
+
+RVCPP=$(realpath "$1")
+ELF=$(realpath "$2")
+BIN=$(realpath "$3")
+SIM_DIR=$(dirname "$RVCPP")
+CXX=${CXX:-c++}
+MAX_CYCLES=1000000
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+FAILED=0
+fail() {
+	echo "FAILED: $*"
+	FAILED=1
+}
+
+# Run a binary, with any further arguments, and write its output and exit
+# code to a file
+run() {
+	local out=$1 bin=$2
+	shift 2
+	"$RVCPP" --bin "$bin" --cpuret "$@" > "$out" 2>&1
+	echo "Exit code $?" >> "$out"
+}
+
+# Same output and exit code with and without the translation
+compare() {
+	local name=$1 bin=$2
+	shift 2
+	run "$TMP/interp" "$bin" "$@"
+	run "$TMP/aot" "$bin" --aot "$TMP/aot.so" "$@"
+	if ! diff -u "$TMP/interp" "$TMP/aot"; then
+		fail "$name"
+	fi
+}
+
+# rvcpp must refuse the translation with an error containing message
+refuse() {
+	local name=$1 so=$2 message=$3
+	"$RVCPP" --bin "$BIN" --cycles $MAX_CYCLES --aot "$so" > "$TMP/out" 2>&1
+	if [ $? -eq 0 ] || ! grep -q "$message" "$TMP/out"; then
+		cat "$TMP/out"
+		fail "$name"
+	fi
+}
+
+if ! python3 "$SIM_DIR/scripts/aot_translate.py" "$ELF" "$TMP/aot.so" --keep-cpp "$TMP/aot.cpp"; then
+	echo "FAILED: translation"
+	exit 1
+fi
+
+compare "full run" "$BIN" --cycles $MAX_CYCLES
+# Stopping part way, the cycle count must still agree
+for cycles in 1000 5003 30011; do
+	compare "run of $cycles cycles" "$BIN" --cycles $cycles
+done
+
+# A copy with one instruction of the hot loop changed (addi a3, zero, 0x5a5
+# to 0x3c3): the blocks containing it no longer match memory, so must not
+# be used, and the results must be the copy's
+python3 - "$BIN" "$TMP/changed.bin" <<'EOF'
+import struct, sys
+data = open(sys.argv[1], "rb").read()
+old = struct.pack("<I", 0x5a500693)
+new = struct.pack("<I", 0x3c300693)
+assert data.count(old) == 1, "marker instruction not found"
+open(sys.argv[2], "wb").write(data.replace(old, new))
+EOF
+compare "changed code" "$TMP/changed.bin" --cycles $MAX_CYCLES
+run "$TMP/original" "$BIN" --cycles $MAX_CYCLES
+if cmp -s "$TMP/original" "$TMP/aot"; then
+	fail "changed code gives the same results as the original"
+fi
+
+# Translations for another version of rvcpp
+build() {
+	sed "$1" "$TMP/aot.cpp" > "$TMP/bad.cpp"
+	"$CXX" -std=c++17 -O2 -shared -fPIC -I "$SIM_DIR/include" "$TMP/bad.cpp" -o "$2"
+}
+build 's/RV_AOT_ABI_VERSION, 0x/RV_AOT_ABI_VERSION + 1, 0x/' "$TMP/abi.so"
+refuse "ABI version mismatch" "$TMP/abi.so" "different version"
+build 's/RV_AOT_ABI_VERSION, 0x\([0-9a-f]*\)u/RV_AOT_ABI_VERSION, ~0x\1u/' "$TMP/decode.so"
+refuse "decoder version mismatch" "$TMP/decode.so" "different version"
+build 's/rvcpp_aot_image/not_the_image/' "$TMP/nosym.so"
+refuse "missing image symbol" "$TMP/nosym.so" "not translated code"
+refuse "missing file" "$TMP/missing.so" "Can't load translated code"
+
+if [ $FAILED -ne 0 ]; then
+	exit 1
+fi
+echo "aot: passed"
@@ -10,19 +10,30 @@ CCFLAGS      ?=
 INCDIR       ?= $(SWTEST_COMMON)
 MAX_CYCLES   ?= 100000
 TMP_PREFIX   ?= tmp/
+# Extra simulator arguments, and for the test target, the expected exit code.
+# Its expected output is in expected_output.txt.
+SIM_ARGS     ?=
+EXPECTED_RC  ?= 0
 
 ###############################################################################
 
 .SUFFIXES:
-.PHONY: all run trace view tb clean clean_tb
+.PHONY: all run test trace view tb clean clean_tb
 
 all: run
 
 run: $(TMP_PREFIX)$(APP).bin
-	$(SIM_EXEC) --bin $(TMP_PREFIX)$(APP).bin --vcd $(TMP_PREFIX)$(APP)_run.vcd --cycles $(MAX_CYCLES)
+	$(SIM_EXEC) --bin $(TMP_PREFIX)$(APP).bin --vcd $(TMP_PREFIX)$(APP)_run.vcd --cycles $(MAX_CYCLES) $(SIM_ARGS)
+
+# The cycle count is left out of the comparison, as it depends on the compiler
+test: $(TMP_PREFIX)$(APP).bin
+	$(SIM_EXEC) --bin $(TMP_PREFIX)$(APP).bin --cycles $(MAX_CYCLES) --cpuret $(SIM_ARGS) > $(TMP_PREFIX)$(APP)_test.log; \
+		rc=$$?; if [ $$rc -ne $(EXPECTED_RC) ]; then echo "Exit code $$rc, expected $(EXPECTED_RC)"; exit 1; fi
+	grep -v "^Ran for" $(TMP_PREFIX)$(APP)_test.log | diff -u expected_output.txt -
+	@echo "$(APP): passed"
 
 trace:
-	$(SIM_EXEC) --bin $(TMP_PREFIX)$(APP).bin --trace --cycles $(MAX_CYCLES) > $(TMP_PREFIX)$(APP)_run.log
+	$(SIM_EXEC) --bin $(TMP_PREFIX)$(APP).bin --trace --cycles $(MAX_CYCLES) $(SIM_ARGS) > $(TMP_PREFIX)$(APP)_run.log
 
 annotate: trace
 	$(SWTEST_SCRIPTS)/annotate_trace.py $(TMP_PREFIX)$(APP)_run.log $(TMP_PREFIX)$(APP)_run_annotated.log -d $(TMP_PREFIX)$(APP).dis
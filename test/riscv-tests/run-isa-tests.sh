@@ -6,7 +6,7 @@ make XLEN=32 clean
 
 # Note SKIP_V is something I added to their Makefile. We have no need for the
 # virtual memory test machine configuration.
-make -j$(nproc) XLEN=32 rv32ui rv32uc rv32um rv32ua rv32mi rv32si
+make -j$(nproc) XLEN=32 rv32ui rv32uc rv32um rv32ua rv32uf rv32ud rv32uzba rv32uzbb rv32uzbs rv32mi rv32si
 
 echo ""
 echo ">>> Running V environment tests"
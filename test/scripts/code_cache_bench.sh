@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# Time a program on rvcpp without the code cache, with an empty one (which
+# is filled in the background as it runs) and with the filled one, e.g.
+#
+#   make -C ../coremark bin
+#   ./code_cache_bench.sh ../coremark/coremark.bin
+#
+# Each is run several times and the best wall-clock time kept. The program's
+# output must be the same every time.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 program.bin [runs] [rvcpp args...]" >&2
+	exit 1
+fi
+BIN=$1
+RUNS=${2:-3}
+shift $(( $# < 2 ? $# : 2 ))
+
+RVCPP=$(dirname "$0")/../../rvcpp/rvcpp
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Prints the wall-clock time of one run, in seconds
+run() {
+	local start end
+	start=$(date +%s%N)
+	"$RVCPP" --bin "$BIN" --cycles 0 "$@" > "$TMP/out" 2>&1 || true
+	end=$(date +%s%N)
+	if [ -e "$TMP/expected" ]; then
+		if ! cmp -s "$TMP/expected" "$TMP/out"; then
+			echo "Output differs:" >&2
+			diff "$TMP/expected" "$TMP/out" >&2 || true
+			exit 1
+		fi
+	else
+		cp "$TMP/out" "$TMP/expected"
+	fi
+	echo $(( (end - start) / 1000000 ))
+}
+
+report() {
+	local name=$1 best=$2
+	printf "%-10s %4d.%03d s\n" "$name" $((best / 1000)) $((best % 1000))
+}
+
+best_of() {
+	local best="" t
+	for i in $(seq "$RUNS"); do
+		if [ "$1" = cold ]; then
+			rm -rf "$TMP/cache"
+			mkdir "$TMP/cache"
+		fi
+		if [ "$1" = none ]; then
+			t=$(run "${@:2}")
+		else
+			t=$(run --code-cache "$TMP/cache" "${@:2}")
+		fi
+		if [ -z "$best" ] || [ "$t" -lt "$best" ]; then
+			best=$t
+		fi
+	done
+	echo "$best"
+}
+
+report "none" "$(best_of none "$@")"
+report "cold" "$(best_of cold "$@")"
+report "warm" "$(best_of warm "$@")"
+echo "$(ls "$TMP/cache" | wc -l) page(s) translated"
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Run the user-mode test program under rvcpp --user, and check its output and
+# exit code.
+#
+# Usage: test.sh path/to/rvcpp path/to/user_mode.elf
+
+if [ $# -ne 2 ]; then
+	echo "Usage: $0 rvcpp user_mode.elf" >&2
+	exit 1
+fi
+
+RVCPP=$(realpath "$1")
+ELF=$(realpath "$2")
+cd "$(dirname "$0")"
+EXPECTED_RC=7
+
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+
+"$RVCPP" --user "$ELF" one "two three" > "$OUT"
+RC=$?
+if [ $RC -ne $EXPECTED_RC ]; then
+	echo "Exit code $RC, expected $EXPECTED_RC"
+	exit 1
+fi
+if ! diff -u expected_output.txt "$OUT"; then
+	exit 1
+fi
+echo "user_mode: passed"